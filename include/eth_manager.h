@@ -14,6 +14,7 @@ extern "C" {
 #include "esp_err.h"
 #include "esp_eth.h"
 #include "esp_netif.h"
+#include "freertos/FreeRTOS.h" // for TickType_t
 /*
  * Holds complete config for the Ethernet interface.
  */
@@ -30,6 +31,15 @@ struct eth_cfg {
     /*!< The IP address of the interface.*/
     esp_netif_dns_info_t dns_info[ESP_NETIF_DNS_MAX];
 };
+
+/*
+ * Field masks for eth_manager_update_eth_cfg().
+ */
+#define ETH_CFG_DISABLED    (1 << 0)    /*!< is_disabled */
+#define ETH_CFG_IP          (1 << 1)    /*!< is_static and ip_info */
+#define ETH_CFG_DNS         (1 << 2)    /*!< dns_info */
+#define ETH_CFG_ALL         0x7
+
 static inline void eth_cfg_init(struct eth_cfg *cfg)
 {
     // Init all values to 0
@@ -37,11 +47,26 @@ static inline void eth_cfg_init(struct eth_cfg *cfg)
 }
 
 esp_err_t eth_manager_set_eth_cfg(struct eth_cfg *new_cfg);
+esp_err_t eth_manager_update_eth_cfg(const struct eth_cfg *patch,
+                                     uint32_t field_mask);
 esp_err_t eth_manager_get_eth_cfg(struct eth_cfg *get_cfg);
 esp_err_t eth_manager_get_eth_state(struct eth_cfg *get_state);
 esp_err_t eth_manager_set_hostname(const char *hostname);
 esp_err_t eth_manager_init(esp_eth_handle_t eth_handle);
 
+/*
+ * Variants taking the number of ticks to wait for the Ethernet Manager's
+ * lock, 0 to fail right away if it is taken. The functions above wait for
+ * CONFIG_WMNGR_API_TIMEOUT milliseconds.
+ */
+esp_err_t eth_manager_set_eth_cfg_ex(struct eth_cfg *new_cfg,
+                                     TickType_t timeout);
+esp_err_t eth_manager_update_eth_cfg_ex(const struct eth_cfg *patch,
+                                        uint32_t field_mask,
+                                        TickType_t timeout);
+esp_err_t eth_manager_get_eth_cfg_ex(struct eth_cfg *get_cfg,
+                                     TickType_t timeout);
+
 #ifdef __cplusplus
 }
 #endif
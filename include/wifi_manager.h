@@ -52,6 +52,7 @@ enum wmngr_state {
     wmngr_state_connecting,     //!< Device is trying to connect to AP
     wmngr_state_disconnecting,  //!< Disconnect from AP has been triggered
     wmngr_state_fallback,       //!< Connection failed, falling back to previous config
+    wmngr_state_roaming,        //!< Looking for or moving to a better AP
     wmngr_state_max,            //!< Number of states
 };
 
@@ -78,6 +79,12 @@ struct wifi_cfg {
     esp_netif_dns_info_t sta_dns_info[ESP_NETIF_DNS_MAX];
                         /*!< IP addresses of DNS servers to use in static IP mode. */
     bool sta_connect;   /*!< True if device should connect to AP in STA mode. */
+    char country[3];    /*!< Two letter country code, e.g. "DE". Empty to use
+                             the driver's world safe default. */
+    uint8_t chan_first; /*!< First channel of the channel plan. Scans and the
+                             AP are limited to the plan. 0 to use all channels
+                             allowed in the country. */
+    uint8_t chan_num;   /*!< Number of channels in the plan. */
 };
 
 esp_err_t esp_wmngr_init(void);
@@ -87,13 +94,36 @@ esp_err_t esp_wmngr_start_scan(void);
 struct scan_data *esp_wmngr_get_scan(void);
 void esp_wmngr_put_scan(struct scan_data *data);
 esp_err_t esp_wmngr_set_cfg(struct wifi_cfg *cfg);
+esp_err_t esp_wmngr_update_cfg(const struct wifi_cfg *patch,
+                               uint32_t field_mask);
 esp_err_t esp_wmngr_get_cfg(struct wifi_cfg *cfg);
+const struct wifi_cfg *esp_wmngr_get_cfg_ref(void);
+void esp_wmngr_put_cfg_ref(const struct wifi_cfg *cfg);
 esp_err_t esp_wmngr_reset_cfg(void);
 esp_err_t esp_wmngr_start_wps(void);
+esp_err_t esp_wmngr_request_ap(void);
 bool esp_wmngr_is_connected(void);
 esp_err_t esp_wmngr_connect(void);
 esp_err_t esp_wmngr_disconnect(void);
 enum wmngr_state esp_wmngr_get_state(void);
 bool esp_wmngr_nvs_valid(void);
 
+/*
+ * Variants taking the number of ticks to wait for the WiFi Manager's lock,
+ * 0 to fail right away if it is taken. The functions above wait for
+ * CONFIG_WMNGR_API_TIMEOUT milliseconds.
+ */
+esp_err_t esp_wmngr_start_ex(TickType_t timeout);
+esp_err_t esp_wmngr_stop_ex(TickType_t timeout);
+struct scan_data *esp_wmngr_get_scan_ex(TickType_t timeout);
+esp_err_t esp_wmngr_set_cfg_ex(struct wifi_cfg *cfg, TickType_t timeout);
+esp_err_t esp_wmngr_update_cfg_ex(const struct wifi_cfg *patch,
+                                  uint32_t field_mask,
+                                  TickType_t timeout);
+esp_err_t esp_wmngr_get_cfg_ex(struct wifi_cfg *cfg, TickType_t timeout);
+esp_err_t esp_wmngr_reset_cfg_ex(TickType_t timeout);
+esp_err_t esp_wmngr_start_wps_ex(TickType_t timeout);
+esp_err_t esp_wmngr_connect_ex(TickType_t timeout);
+esp_err_t esp_wmngr_disconnect_ex(TickType_t timeout);
+
 #endif // ESP_WIFI_MANAGER_H
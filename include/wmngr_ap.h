@@ -0,0 +1,71 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_AP_H
+#define WMNGR_AP_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_event.h"
+
+/** A station connected to the SoftAP. */
+struct wmngr_ap_client {
+    uint8_t mac[6];         //!< MAC address of the station
+    uint8_t aid;            //!< Association ID
+    int8_t rssi;            //!< Last reported signal strength in dBm
+    uint32_t ip;            //!< Assigned IPv4 address, 0 if none yet
+    uint32_t connected;     //!< FreeRTOS tick count at association
+    uint32_t last_active;   //!< Tick count when activity was last seen
+};
+
+/** SoftAP client counters. */
+struct wmngr_ap_stats {
+    uint32_t joins;         //!< Stations that associated
+    uint32_t leaves;        //!< Stations that left or were removed
+    uint32_t displaced;     //!< Idle stations removed by a lower limit
+    uint16_t clients;       //!< Stations currently connected
+    uint16_t peak;          //!< Most stations connected at the same time
+};
+
+esp_err_t esp_wmngr_set_ap_limits(unsigned int max_clients,
+                                  unsigned int idle_s);
+esp_err_t esp_wmngr_get_ap_limits(unsigned int *max_clients,
+                                  unsigned int *idle_s);
+size_t esp_wmngr_get_ap_clients(struct wmngr_ap_client *buf, size_t num);
+esp_err_t esp_wmngr_get_ap_stats(struct wmngr_ap_stats *stats);
+
+/*
+ * Hooks used by the WiFi Manager to feed AP events into the table and to
+ * fetch the client limit for the driver.
+ */
+#if defined(CONFIG_WMNGR_AP_CLIENTS)
+void wmngr_ap_event(esp_event_base_t base, int32_t id, void *data);
+unsigned int wmngr_ap_max_clients(void);
+#define WMNGR_AP_EVENT(base, id, data)  wmngr_ap_event((base), (id), (data))
+#define WMNGR_AP_MAX_CLIENTS(dflt)      wmngr_ap_max_clients()
+#else
+#define WMNGR_AP_EVENT(base, id, data)  do{ } while(0)
+#define WMNGR_AP_MAX_CLIENTS(dflt)      (dflt)
+#endif
+
+#endif // WMNGR_AP_H
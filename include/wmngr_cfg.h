@@ -0,0 +1,52 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_CFG_H
+#define WMNGR_CFG_H
+
+/** @file */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "wifi_manager.h"
+
+/** Parts of a struct wifi_cfg, as reported by wmngr_cfg_diff(). */
+#define WMNGR_CFG_MODE          (1 << 0)    //!< mode
+#define WMNGR_CFG_AP            (1 << 1)    //!< ap
+#define WMNGR_CFG_AP_IP         (1 << 2)    //!< ap_ip_info
+#define WMNGR_CFG_STA           (1 << 3)    //!< sta
+#define WMNGR_CFG_STA_IP        (1 << 4)    //!< sta_static, sta_ip_info, sta_dns_info
+#define WMNGR_CFG_STA_CONNECT   (1 << 5)    //!< sta_connect
+#define WMNGR_CFG_COUNTRY       (1 << 6)    //!< country, chan_first, chan_num
+#define WMNGR_CFG_ALL           0x7f        //!< all of the above
+
+/** Single fields, only used in field masks for esp_wmngr_update_cfg(). */
+#define WMNGR_CFG_STA_SSID      (1 << 8)    //!< sta.sta.ssid
+#define WMNGR_CFG_STA_PASSWORD  (1 << 9)    //!< sta.sta.password
+#define WMNGR_CFG_AP_SSID       (1 << 10)   //!< ap.ap.ssid, ap.ap.ssid_len
+#define WMNGR_CFG_AP_PASSWORD   (1 << 11)   //!< ap.ap.password
+#define WMNGR_CFG_FIELDS        0xf7f       //!< all valid field mask bits
+
+uint32_t wmngr_cfg_diff(const struct wifi_cfg *a, const struct wifi_cfg *b);
+uint32_t wmngr_cfg_patch(struct wifi_cfg *cfg, const struct wifi_cfg *patch,
+                         uint32_t mask);
+esp_err_t esp_wmngr_bench_cfg(unsigned int iterations);
+
+#endif // WMNGR_CFG_H
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_CHAN_H
+#define WMNGR_CHAN_H
+
+/** @file */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "wifi_manager.h"
+
+/** Number of 2.4 GHz channels covered by a survey. */
+#define WMNGR_CHAN_NUM          14
+
+/** Channel congestion computed from a scan. */
+struct wmngr_chan_survey {
+    TickType_t tstamp;      //!< Timestamp of the scan data used
+    uint8_t first;          //!< First channel allowed by the country setting
+    uint8_t num;            //!< Number of allowed channels
+    uint8_t best;           //!< Least congested allowed channel, 0 if unknown
+    uint8_t aps[WMNGR_CHAN_NUM];
+                            //!< APs with their primary channel on channel n+1
+    uint32_t load[WMNGR_CHAN_NUM];
+                            //!< Congestion of a 20 MHz AP on channel n+1
+};
+
+esp_err_t esp_wmngr_get_chan_survey(struct wmngr_chan_survey *survey);
+esp_err_t esp_wmngr_select_ap_channel(void);
+
+/* Used by the WiFi Manager to pick the SoftAP channel. */
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+uint8_t wmngr_chan_survey(const struct scan_data *data);
+#endif
+
+#endif // WMNGR_CHAN_H
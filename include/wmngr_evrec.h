@@ -0,0 +1,85 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_EVREC_H
+#define WMNGR_EVREC_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/** Magic number at the start of an event recording ("WMEV"). */
+#define WMNGR_EVREC_MAGIC       0x56454d57
+/** Version of the event recording format. */
+#define WMNGR_EVREC_VERSION     1
+
+#if defined(CONFIG_WMNGR_EVREC)
+#define WMNGR_EVREC_PAYLOAD     CONFIG_WMNGR_EVREC_PAYLOAD
+#else
+#define WMNGR_EVREC_PAYLOAD     48
+#endif
+
+/** Flags of a recorded event. */
+#define WMNGR_EVREC_TRUNCATED   (1 << 0)    //!< Payload did not fit
+
+/** A single recorded system event. */
+struct wmngr_evrec {
+    uint32_t tick;      //!< FreeRTOS tick count
+    uint8_t base;       //!< Event base, see #wmngr_trace_base
+    uint8_t id;         //!< Event ID
+    uint8_t len;        //!< Number of valid payload bytes
+    uint8_t flags;      //!< WMNGR_EVREC_* flags
+    uint8_t data[WMNGR_EVREC_PAYLOAD];
+                        //!< Event payload as passed to the handlers
+};
+
+/** Header of an event recording, followed by num_records records. */
+struct wmngr_evrec_hdr {
+    uint32_t magic;         //!< #WMNGR_EVREC_MAGIC
+    uint16_t version;       //!< #WMNGR_EVREC_VERSION
+    uint16_t rec_size;      //!< sizeof(struct wmngr_evrec)
+    uint32_t tick_hz;       //!< FreeRTOS tick rate of the recording device
+    uint32_t num_records;   //!< Number of records following the header
+};
+
+esp_err_t esp_wmngr_evrec_start(void);
+esp_err_t esp_wmngr_evrec_stop(void);
+size_t esp_wmngr_evrec_dump(void *buf, size_t len);
+void esp_wmngr_evrec_log(void);
+esp_err_t esp_wmngr_evrec_replay(const void *buf, size_t len,
+                                 unsigned int speedup);
+
+/*
+ * The network managers announce their event handlers, so a replay can
+ * feed recorded events to them and nobody else.
+ */
+#if defined(CONFIG_WMNGR_EVREC)
+#include "esp_event.h"
+void wmngr_evrec_add_handler(esp_event_base_t base,
+                             esp_event_handler_t handler, void *arg);
+#define WMNGR_EVREC_HANDLER(base, handler, arg) \
+    wmngr_evrec_add_handler((base), (handler), (arg))
+#else
+#define WMNGR_EVREC_HANDLER(base, handler, arg) do{ } while(0)
+#endif
+
+#endif // WMNGR_EVREC_H
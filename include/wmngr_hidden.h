@@ -0,0 +1,57 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_HIDDEN_H
+#define WMNGR_HIDDEN_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_wifi_types.h"
+
+/** Number of revealed hidden BSSIDs remembered. */
+#define WMNGR_HIDDEN_CACHE      8
+
+/** A hidden BSSID whose SSID was revealed by a directed probe. */
+struct wmngr_hidden_entry {
+    TickType_t tstamp;      //!< Time it was last seen
+    uint8_t bssid[6];       //!< BSSID of the AP
+    uint8_t ssid[33];       //!< SSID it answered to, NUL terminated
+    uint8_t channel;        //!< Primary channel
+};
+
+size_t esp_wmngr_get_hidden(struct wmngr_hidden_entry *buf, size_t num);
+
+/* Used by the WiFi Manager for directed scans and connects. */
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+unsigned int wmngr_hidden_reveal(const uint8_t *ssid,
+                                 const wifi_ap_record_t *recs,
+                                 unsigned int num);
+unsigned int wmngr_hidden_merge(wifi_ap_record_t *recs, unsigned int num);
+void wmngr_hidden_prepare_sta(wifi_sta_config_t *sta);
+#define WMNGR_HIDDEN_PREPARE_STA(sta)   wmngr_hidden_prepare_sta(sta)
+#else
+#define WMNGR_HIDDEN_PREPARE_STA(sta)   do{ } while(0)
+#endif
+
+#endif // WMNGR_HIDDEN_H
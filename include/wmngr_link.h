@@ -0,0 +1,82 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_LINK_H
+#define WMNGR_LINK_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/** PHY modes reported in link samples. */
+#define WMNGR_LINK_PHY_11B      (1 << 0)    //!< 802.11b
+#define WMNGR_LINK_PHY_11G      (1 << 1)    //!< 802.11g
+#define WMNGR_LINK_PHY_11N      (1 << 2)    //!< 802.11n
+#define WMNGR_LINK_PHY_LR       (1 << 3)    //!< Espressif long range
+#define WMNGR_LINK_PHY_HT40     (1 << 4)    //!< 40 MHz channel
+
+/** A single link quality sample. */
+struct wmngr_link_sample {
+    uint32_t tick;      //!< FreeRTOS tick count
+    int8_t rssi;        //!< Signal strength of the AP in dBm
+    uint8_t channel;    //!< Primary channel
+    uint8_t phy;        //!< WMNGR_LINK_PHY_* flags
+    uint8_t quality;    //!< Quality score after this sample, 0 - 100
+};
+
+/** Summary of the current STA link. */
+struct wmngr_link_stats {
+    uint32_t samples;       //!< Samples taken since connecting
+    uint32_t failures;      //!< Failed attempts to read the link state
+    uint32_t interval_ms;   //!< Current sampling interval
+    uint16_t window;        //!< Number of samples in the summary window
+    int8_t rssi_last;       //!< Latest RSSI in dBm
+    int8_t rssi_min;        //!< Lowest RSSI in window
+    int8_t rssi_avg;        //!< Average RSSI in window
+    int8_t rssi_max;        //!< Highest RSSI in window
+    uint8_t quality;        //!< Quality score, 0 (unusable) - 100 (excellent)
+    uint8_t channel;        //!< Primary channel
+    uint8_t phy;            //!< WMNGR_LINK_PHY_* flags
+};
+
+/**
+ * Called from the timer task after every link sample. Must not block.
+ */
+typedef void (*wmngr_link_cb_t)(const struct wmngr_link_stats *stats,
+                                void *arg);
+
+esp_err_t esp_wmngr_get_link_stats(struct wmngr_link_stats *stats);
+size_t esp_wmngr_get_link_samples(struct wmngr_link_sample *buf, size_t num);
+esp_err_t esp_wmngr_set_link_cb(wmngr_link_cb_t cb, void *arg);
+
+/* Hooks used by the WiFi Manager to run the sampler while connected. */
+#if defined(CONFIG_WMNGR_LINK_MONITOR)
+void wmngr_link_start(void);
+void wmngr_link_stop(void);
+#define WMNGR_LINK_START()      wmngr_link_start()
+#define WMNGR_LINK_STOP()       wmngr_link_stop()
+#else
+#define WMNGR_LINK_START()      do{ } while(0)
+#define WMNGR_LINK_STOP()       do{ } while(0)
+#endif
+
+#endif // WMNGR_LINK_H
@@ -0,0 +1,82 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_LOCK_H
+#define WMNGR_LOCK_H
+
+/** @file */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "wifi_manager.h"
+
+/**
+ * Places where the config lock is taken. The state machine gets one site
+ * per state it was in when it took the lock, so the time spent in e.g.
+ * set_wifi_cfg() shows up under the update state.
+ */
+enum wmngr_lock_site {
+    wmngr_lock_start = 0,       //!< esp_wmngr_start()
+    wmngr_lock_stop,            //!< esp_wmngr_stop()
+    wmngr_lock_set_cfg,         //!< esp_wmngr_set_cfg()
+    wmngr_lock_get_cfg,         //!< esp_wmngr_get_cfg()
+    wmngr_lock_start_wps,       //!< esp_wmngr_start_wps()
+    wmngr_lock_get_scan,        //!< esp_wmngr_get_scan()
+    wmngr_lock_reset_cfg,       //!< esp_wmngr_reset_cfg()
+    wmngr_lock_update_cfg,      //!< esp_wmngr_update_cfg()
+    wmngr_lock_handle,          //!< handle_wifi(), first of wmngr_state_max
+    wmngr_lock_site_max = wmngr_lock_handle + wmngr_state_max,
+};
+
+/** Usage statistics of one lock site. */
+struct wmngr_lock_stat {
+    uint32_t attempts;      //!< Number of times the lock was requested
+    uint32_t failures;      //!< Requests that timed out
+    uint32_t wait_us;       //!< Total time spent waiting for the lock
+    uint32_t wait_max_us;   //!< Longest wait
+    uint32_t hold_us;       //!< Total time the lock was held
+    uint32_t hold_max_us;   //!< Longest time the lock was held
+};
+
+/** Usage statistics of the config lock, indexed by #wmngr_lock_site. */
+struct wmngr_lock_stats {
+    struct wmngr_lock_stat site[wmngr_lock_site_max];
+};
+
+esp_err_t esp_wmngr_get_lock_stats(struct wmngr_lock_stats *stats);
+void esp_wmngr_reset_lock_stats(void);
+void esp_wmngr_dump_lock_stats(void);
+
+/* Wrappers used by the manager to take and release the config lock. */
+#if defined(CONFIG_WMNGR_LOCK_STATS)
+BaseType_t wmngr_lock_take(SemaphoreHandle_t lock, TickType_t timeout,
+                           enum wmngr_lock_site site);
+void wmngr_lock_give(SemaphoreHandle_t lock);
+#define WMNGR_LOCK_TAKE(lock, timeout, site) \
+    wmngr_lock_take((lock), (timeout), (site))
+#define WMNGR_LOCK_GIVE(lock)   wmngr_lock_give(lock)
+#else
+#define WMNGR_LOCK_TAKE(lock, timeout, site)    xSemaphoreTake((lock), (timeout))
+#define WMNGR_LOCK_GIVE(lock)   xSemaphoreGive(lock)
+#endif
+
+#endif // WMNGR_LOCK_H
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_MEM_H
+#define WMNGR_MEM_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/*
+ * Subsystems heap usage is accounted to. Each entry becomes an
+ * enum wmngr_mem_sys value.
+ */
+#define WMNGR_MEM_SUBSYS(X)                                             \
+    X(scan,                 "Scan results")                             \
+    X(netif,                "Network interfaces")                       \
+    X(eth,                  "Ethernet handle")                          \
+    X(cfg,                  "Config versions")                          \
+    X(rtos,                 "FreeRTOS objects")
+
+/** Identifiers of all accounted subsystems. */
+enum wmngr_mem_sys {
+#define WMNGR_X(name, desc) wmngr_mem_##name,
+    WMNGR_MEM_SUBSYS(WMNGR_X)
+#undef WMNGR_X
+    wmngr_mem_max,
+};
+
+/** Heap usage of one subsystem. */
+struct wmngr_mem_stat {
+    uint32_t cur;       //!< Bytes currently in use
+    uint32_t peak;      //!< Highest value of cur
+    uint32_t allocs;    //!< Number of allocations or object creations
+    uint32_t frees;     //!< Number of frees or object deletions
+};
+
+/** Heap usage of the network managers, indexed by #wmngr_mem_sys. */
+struct wmngr_mem_stats {
+    struct wmngr_mem_stat sys[wmngr_mem_max];
+};
+
+extern const char *wmngr_mem_names[wmngr_mem_max];
+
+esp_err_t esp_wmngr_get_mem_stats(struct wmngr_mem_stats *stats);
+void esp_wmngr_reset_mem_peaks(void);
+void esp_wmngr_dump_mem_stats(void);
+
+/* Hooks used by the managers to account their heap usage. */
+#if defined(CONFIG_WMNGR_MEM_STATS)
+void *wmngr_mem_calloc(enum wmngr_mem_sys sys, size_t num, size_t size);
+void wmngr_mem_free(void *ptr);
+void wmngr_mem_account(enum wmngr_mem_sys sys, size_t before);
+size_t wmngr_mem_heap_free(void);
+#define WMNGR_CALLOC(sys, num, size) \
+    wmngr_mem_calloc(wmngr_mem_##sys, (num), (size))
+#define WMNGR_FREE(ptr)     wmngr_mem_free(ptr)
+/*
+ * Account the heap consumed or released by statements creating or
+ * deleting objects we can not allocate ourselves, e.g. netifs or kernel
+ * objects. This measures the change of free heap, so it is only accurate
+ * if no other task allocates at the same time.
+ */
+#define WMNGR_MEM_TRACK(sys, ...)                                       \
+    do{                                                                 \
+        size_t wmngr_mem_before_ = wmngr_mem_heap_free();               \
+        __VA_ARGS__;                                                    \
+        wmngr_mem_account(wmngr_mem_##sys, wmngr_mem_before_);          \
+    } while(0)
+#else
+#define WMNGR_CALLOC(sys, num, size)    calloc((num), (size))
+#define WMNGR_FREE(ptr)                 free(ptr)
+#define WMNGR_MEM_TRACK(sys, ...)       do{ __VA_ARGS__; } while(0)
+#endif
+
+#endif // WMNGR_MEM_H
@@ -0,0 +1,126 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_METRICS_H
+#define WMNGR_METRICS_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/*
+ * Monotonic event counters. Each entry becomes a member of
+ * struct wmngr_metrics and an enum wmngr_counter value.
+ */
+#define WMNGR_COUNTERS(X)                                               \
+    X(scans_started,        "Scans started")                            \
+    X(scans_done,           "Scans completed")                          \
+    X(scans_failed,         "Scans failed")                             \
+    X(scan_time_ms,         "Total scan time [ms]")                     \
+    X(scan_aps,             "Total APs found")                          \
+    X(connect_attempts,     "Connect attempts")                         \
+    X(connect_success,      "Connect successes")                        \
+    X(connects_full,        "Connects, full handshake")                 \
+    X(connect_full_ms,      "Connect time, full [ms]")                  \
+    X(connects_fast,        "Connects, cached PMK")                     \
+    X(connect_fast_ms,      "Connect time, cached PMK [ms]")            \
+    X(connect_saved_ms,     "Connect time saved [ms]")                  \
+    X(fallbacks,            "Fall-backs")                               \
+    X(reconnects,           "Reconnects")                               \
+    X(wps_success,          "WPS successes")                            \
+    X(wps_failed,           "WPS failures")                             \
+    X(wps_timeout,          "WPS timeouts")                             \
+    X(nvs_reads,            "NVS reads")                                \
+    X(nvs_writes,           "NVS writes")                               \
+    X(nvs_bytes,            "NVS bytes written")                        \
+    X(handle_calls,         "State machine runs")                       \
+    X(lock_failures,        "Config lock failures")                     \
+    X(lock_wait_ms,         "Config lock wait [ms]")                    \
+    X(eth_link_up,          "Ethernet link up")                         \
+    X(eth_link_down,        "Ethernet link down")                       \
+    X(eth_got_ip,           "Ethernet DHCP leases")                     \
+    X(tune_tx_up,           "Tuner TX power raised")                    \
+    X(tune_tx_down,         "Tuner TX power lowered")                   \
+    X(tune_bw_changes,      "Tuner bandwidth changes")                  \
+    X(tune_proto_changes,   "Tuner protocol changes")                   \
+    X(hidden_scans,         "Directed hidden SSID scans")               \
+    X(hidden_revealed,      "Hidden BSSIDs revealed")                   \
+    X(hidden_hints,         "Connects with hidden channel hint")
+
+/*
+ * Values that are set rather than accumulated.
+ */
+#define WMNGR_GAUGES(X)                                                 \
+    X(scan_last_ms,         "Last scan time [ms]")                      \
+    X(scan_max_ms,          "Longest scan time [ms]")                   \
+    X(scan_last_aps,        "APs in last scan")                         \
+    X(tune_tx_power,        "Tuner TX power [0.25 dBm]")                \
+    X(tune_bandwidth,       "Tuner bandwidth")                          \
+    X(tune_protocol,        "Tuner protocols")
+
+/** Identifiers of all event counters. */
+enum wmngr_counter {
+#define WMNGR_X(name, desc) wmngr_cnt_##name,
+    WMNGR_COUNTERS(WMNGR_X)
+#undef WMNGR_X
+    wmngr_cnt_max,
+};
+
+/** Identifiers of all gauges. */
+enum wmngr_gauge {
+#define WMNGR_X(name, desc) wmngr_gauge_##name,
+    WMNGR_GAUGES(WMNGR_X)
+#undef WMNGR_X
+    wmngr_gauge_max,
+};
+
+/** Snapshot of the network managers' operational counters. */
+struct wmngr_metrics {
+#define WMNGR_X(name, desc) uint32_t name;
+    WMNGR_COUNTERS(WMNGR_X)
+    WMNGR_GAUGES(WMNGR_X)
+#undef WMNGR_X
+};
+
+esp_err_t esp_wmngr_get_metrics(struct wmngr_metrics *metrics);
+void esp_wmngr_reset_metrics(void);
+void esp_wmngr_dump_metrics(void);
+void esp_wmngr_report_begin(const char *scenario);
+size_t esp_wmngr_report_json(char *buf, size_t len);
+
+/* Hooks used by the managers to update the metrics. */
+#if defined(CONFIG_WMNGR_METRICS)
+void wmngr_metric_add(enum wmngr_counter id, uint32_t val);
+void wmngr_metric_set(enum wmngr_gauge id, uint32_t val);
+void wmngr_metric_max(enum wmngr_gauge id, uint32_t val);
+#define WMNGR_METRIC_INC(name)      wmngr_metric_add(wmngr_cnt_##name, 1)
+#define WMNGR_METRIC_ADD(name, val) wmngr_metric_add(wmngr_cnt_##name, (val))
+#define WMNGR_METRIC_SET(name, val) wmngr_metric_set(wmngr_gauge_##name, (val))
+#define WMNGR_METRIC_MAX(name, val) wmngr_metric_max(wmngr_gauge_##name, (val))
+#else
+#define WMNGR_METRIC_INC(name)      do{ } while(0)
+#define WMNGR_METRIC_ADD(name, val) do{ (void) (val); } while(0)
+#define WMNGR_METRIC_SET(name, val) do{ (void) (val); } while(0)
+#define WMNGR_METRIC_MAX(name, val) do{ (void) (val); } while(0)
+#endif
+
+#endif // WMNGR_METRICS_H
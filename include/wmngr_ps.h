@@ -0,0 +1,66 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_PS_H
+#define WMNGR_PS_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+
+/** Number of power-save modes, indexed by wifi_ps_type_t. */
+#define WMNGR_PS_MODES          3
+
+/** Hints from the application about upcoming traffic. */
+enum wmngr_ps_hint {
+    wmngr_ps_hint_none = 0, //!< No hint, follow the measured traffic
+    wmngr_ps_hint_burst,    //!< Traffic ahead, keep latency low
+    wmngr_ps_hint_idle,     //!< No traffic expected, save power
+};
+
+/** Power-save policy statistics. */
+struct wmngr_ps_stats {
+    uint32_t dwell_ms[WMNGR_PS_MODES];  //!< Time spent in each mode
+    uint32_t entered[WMNGR_PS_MODES];   //!< Times each mode was entered
+    uint32_t failures;      //!< Failed esp_wifi_set_ps() calls
+    uint32_t rate;          //!< Smoothed traffic rate in bytes/s
+    uint8_t mode;           //!< Current mode, a wifi_ps_type_t
+    uint8_t hint;           //!< Active enum wmngr_ps_hint
+};
+
+void esp_wmngr_ps_traffic(size_t bytes);
+esp_err_t esp_wmngr_ps_hint(enum wmngr_ps_hint hint, uint32_t ms);
+esp_err_t esp_wmngr_get_ps_stats(struct wmngr_ps_stats *stats);
+
+/* Hooks used by the WiFi Manager to run the policy while connected. */
+#if defined(CONFIG_WMNGR_PS_POLICY)
+void wmngr_ps_start(void);
+void wmngr_ps_stop(void);
+#define WMNGR_PS_START()        wmngr_ps_start()
+#define WMNGR_PS_STOP()         wmngr_ps_stop()
+#else
+#define WMNGR_PS_START()        do{ } while(0)
+#define WMNGR_PS_STOP()         do{ } while(0)
+#endif
+
+#endif // WMNGR_PS_H
@@ -0,0 +1,125 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_ROAM_H
+#define WMNGR_ROAM_H
+
+/** @file */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_wifi_types.h"
+#include "wmngr_link.h"
+
+/** Flags of a roaming record. */
+#define WMNGR_ROAM_NEIGHBOR     (1 << 0)    //!< Scan used an 802.11k neighbor report
+#define WMNGR_ROAM_BTM          (1 << 1)    //!< AP initiated roam (802.11v BTM)
+#define WMNGR_ROAM_QUERY        (1 << 2)    //!< Supplicant roamed on our BTM query
+#define WMNGR_ROAM_FT_ENABLED   (1 << 3)    //!< 802.11r was enabled in the STA config
+#define WMNGR_ROAM_FT_OFFERED   (1 << 4)    //!< Supplicant made the transition and offered FT
+
+/** Maximum number of channels taken from a neighbor report. */
+#define WMNGR_ROAM_MAX_CHANS    8
+
+/** Timing of a single roam. */
+struct wmngr_roam_rec {
+    uint32_t tick;          //!< FreeRTOS tick count when the roam finished
+    uint32_t ms;            //!< Duration from trigger to link up
+    int8_t rssi_from;       //!< RSSI of the previous AP
+    int8_t rssi_to;         //!< RSSI of the new AP
+    uint8_t channel;        //!< Channel of the new AP
+    uint8_t flags;          //!< WMNGR_ROAM_* flags
+};
+
+/** Roaming statistics. */
+struct wmngr_roam_stats {
+    uint32_t triggers;      //!< Roaming scans started because of low RSSI
+    uint32_t roams;         //!< Successful reassociations to another BSSID
+    uint32_t failures;      //!< Scans or reassociations that failed
+    uint32_t no_candidate;  //!< Scans that found no other BSSID
+    uint32_t avoided;       //!< Roams avoided by the hysteresis margin
+    uint32_t neighbor_reps; //!< Neighbor reports received
+    uint32_t btm_roams;     //!< Roams initiated by the AP
+    uint32_t last_ms;       //!< Duration of the last roam, trigger to link up
+    uint32_t max_ms;        //!< Longest roam
+    uint32_t total_ms;      //!< Sum of all successful roam durations
+};
+
+/** Phases of the roaming state. */
+enum wmngr_roam_phase {
+    wmngr_roam_neighbors = 0,   //!< Waiting for a neighbor report
+    wmngr_roam_scan,            //!< Scanning for candidates
+    wmngr_roam_reassoc,         //!< Reassociating to the chosen AP
+    wmngr_roam_btm,             //!< Link lost, waiting for an AP initiated roam
+};
+
+/** Roaming state, part of the WiFi Manager's state. */
+struct wmngr_roam_ctx {
+    TickType_t start;           //!< Time the roam was triggered
+    TickType_t reassoc_start;   //!< Time the reassociation was started
+    enum wmngr_roam_phase phase;
+    uint8_t chans[WMNGR_ROAM_MAX_CHANS];
+                                //!< Channels to scan, from a neighbor report
+    uint8_t num_chans;          //!< Number of entries in chans, 0 for all
+    uint8_t chan_idx;           //!< Channel currently being scanned
+    uint8_t flags;              //!< WMNGR_ROAM_* flags for this roam
+    uint8_t cur_bssid[6];       //!< BSSID we are roaming away from
+    int8_t cur_rssi;            //!< Its RSSI
+    bool have_best;             //!< best holds a candidate
+    wifi_ap_record_t best;      //!< Strongest candidate seen so far
+};
+
+esp_err_t esp_wmngr_get_roam_stats(struct wmngr_roam_stats *stats);
+size_t esp_wmngr_get_roam_history(struct wmngr_roam_rec *buf, size_t num);
+
+/*
+ * Wakes up the state machine owning the STA when roaming is due. Called
+ * from the link monitor's timer callback or the supplicant task, so it
+ * must not block.
+ */
+typedef void (*wmngr_roam_trigger_t)(void *arg);
+
+/* Hooks connecting the link monitor, roaming policy and state machine. */
+#if defined(CONFIG_WMNGR_ROAMING)
+void wmngr_roam_attach(wmngr_roam_trigger_t trigger, void *arg);
+void wmngr_roam_sample(const struct wmngr_link_stats *stats);
+void wmngr_roam_prepare_sta(wifi_sta_config_t *sta);
+esp_err_t wmngr_roam_request_neighbors(void);
+esp_err_t wmngr_roam_request_transition(void);
+bool wmngr_roam_btm_supported(void);
+int wmngr_roam_get_neighbors(uint8_t *chans, unsigned int max);
+void wmngr_roam_collect(struct wmngr_roam_ctx *ctx,
+                        const wifi_ap_record_t *recs, unsigned int num);
+bool wmngr_roam_pick(struct wmngr_roam_ctx *ctx);
+void wmngr_roam_done(const struct wmngr_roam_ctx *ctx, bool success,
+                     int8_t rssi, uint32_t ms);
+#define WMNGR_ROAM_ATTACH(trigger, arg) wmngr_roam_attach((trigger), (arg))
+#define WMNGR_ROAM_SAMPLE(stats)    wmngr_roam_sample(stats)
+#define WMNGR_ROAM_PREPARE_STA(sta) wmngr_roam_prepare_sta(sta)
+#else
+#define WMNGR_ROAM_ATTACH(trigger, arg) do{ } while(0)
+#define WMNGR_ROAM_SAMPLE(stats)    do{ } while(0)
+#define WMNGR_ROAM_PREPARE_STA(sta) do{ } while(0)
+#endif
+
+#endif // WMNGR_ROAM_H
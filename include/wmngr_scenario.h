@@ -0,0 +1,48 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_SCENARIO_H
+#define WMNGR_SCENARIO_H
+
+/** @file */
+
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/** Scripted scenarios run by esp_wmngr_run_scenario(). All of them start
+ *  with the STA connected and a run ends when the named state has been
+ *  reached. */
+enum wmngr_scenario {
+    wmngr_scn_cold_boot = 0,    //!< Manager restarted, WiFi driver stopped, until connected
+    wmngr_scn_ap_reboot,        //!< Association dropped, until reconnected
+    wmngr_scn_wrong_password,   //!< Wrong STA password set, until fallen back
+    wmngr_scn_wps_success,      //!< WPS with the AP's button pressed, until connected
+    wmngr_scn_wps_timeout,      //!< WPS without a registrar, until fallen back
+    wmngr_scn_scan_connected,   //!< AP scan while connected, until new scan data
+    wmngr_scn_max,              //!< Number of scenarios
+};
+
+/** Array of strings naming the scenarios in reports. */
+extern const char *wmngr_scn_names[wmngr_scn_max];
+
+esp_err_t esp_wmngr_run_scenario(enum wmngr_scenario scn, unsigned int runs,
+                                 char *buf, size_t len);
+
+#endif // WMNGR_SCENARIO_H
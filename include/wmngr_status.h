@@ -0,0 +1,73 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_STATUS_H
+#define WMNGR_STATUS_H
+
+/** @file */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
+#include "wifi_manager.h"
+
+/** Interface carrying the default route. */
+enum netmgr_uplink {
+    netmgr_uplink_none = 0,     //!< No interface has an IP address
+    netmgr_uplink_wifi,         //!< WiFi STA
+    netmgr_uplink_eth,          //!< Ethernet
+};
+
+/** Consistent snapshot of the WiFi and Ethernet state. */
+struct netmgr_status {
+    uint32_t version;           //!< Changes whenever any other field does
+    enum wmngr_state wifi_state;
+                                //!< State of the WiFi Manager
+    bool sta_connected;         //!< STA is associated to an AP
+    bool sta_got_ip;            //!< STA has an IP address
+    esp_netif_ip_info_t sta_ip; //!< STA address, valid if sta_got_ip
+    int8_t rssi;                //!< Latest RSSI of the AP, 0 if unknown
+    uint8_t channel;            //!< Channel of the AP
+    uint8_t last_reason;        //!< Reason code of the last STA disconnect
+    bool eth_link;              //!< Ethernet link is up
+    bool eth_got_ip;            //!< Ethernet has an IP address
+    esp_netif_ip_info_t eth_ip; //!< Ethernet address, valid if eth_got_ip
+    enum netmgr_uplink uplink;  //!< Interface used for the default route
+    esp_err_t last_err;         //!< Last error applying a config, or ESP_OK
+    uint16_t scan_aps;          //!< Number of APs in the latest scan data
+    TickType_t scan_tstamp;     //!< Timestamp of the latest scan data
+};
+
+esp_err_t netmgr_get_status(struct netmgr_status *status,
+                            uint32_t since_version);
+
+/* Used by the WiFi and Ethernet Managers to keep the snapshot current. */
+void wmngr_status_wifi(enum wmngr_state state);
+void wmngr_status_sta(bool connected, uint8_t channel, uint8_t reason);
+void wmngr_status_sta_ip(const esp_netif_ip_info_t *ip);
+void wmngr_status_rssi(int8_t rssi);
+void wmngr_status_eth_link(bool up);
+void wmngr_status_eth_ip(const esp_netif_ip_info_t *ip);
+void wmngr_status_error(esp_err_t err);
+void wmngr_status_scan(uint16_t aps, TickType_t tstamp);
+
+#endif // WMNGR_STATUS_H
@@ -0,0 +1,95 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_TIMELINE_H
+#define WMNGR_TIMELINE_H
+
+/** @file */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/** Number of log2 buckets per phase histogram. Bucket n counts phases
+ *  lasting [2^(n-1), 2^n) microseconds, so the buckets cover all
+ *  durations up to the 71 minutes a uint32_t can hold. */
+#define WMNGR_TL_BUCKETS    33
+
+/** Boundaries of the connection timeline. Each histogram measures the
+ *  time from the previously recorded boundary to the named one. */
+enum wmngr_tl_mark {
+    wmngr_tl_start = 0,         //!< esp_wmngr_start() called
+    wmngr_tl_cfg_begin,         //!< Applying a WiFi config started
+    wmngr_tl_wifi_start,        //!< esp_wifi_start() returned
+    wmngr_tl_cfg_end,           //!< Applying a WiFi config finished
+    wmngr_tl_sta_start,         //!< WIFI_EVENT_STA_START received
+    wmngr_tl_sta_connected,     //!< WIFI_EVENT_STA_CONNECTED received
+    wmngr_tl_got_ip,            //!< IP_EVENT_STA_GOT_IP received
+    wmngr_tl_connected,         //!< State machine reached connected state
+    wmngr_tl_saved,             //!< Config has been written to NVS
+    wmngr_tl_wps_done,          //!< WPS succeeded, failed or timed out
+    wmngr_tl_fallback,          //!< Falling back to the previous config
+
+    /* Outside of the connection cycle. */
+    wmngr_tl_link_lost,         //!< Connection lost, reconnecting
+    wmngr_tl_scan_start,        //!< Scan started while the STA was connected
+    wmngr_tl_scan_done,         //!< That scan finished
+    wmngr_tl_max,               //!< Number of boundaries
+};
+
+/** Array of strings naming the timeline boundaries. */
+extern const char *wmngr_tl_names[wmngr_tl_max];
+
+/** Histogram of the durations of one phase. */
+struct wmngr_tl_hist {
+    uint32_t count;                         //!< Number of samples
+    uint32_t min_us;                        //!< Shortest phase seen
+    uint32_t max_us;                        //!< Longest phase seen
+    uint64_t sum_us;                        //!< Sum of all samples
+    uint32_t buckets[WMNGR_TL_BUCKETS];     //!< log2 scaled sample counts
+};
+
+/** Snapshot of the connection timeline. */
+struct wmngr_timeline {
+    int64_t last_us[wmngr_tl_max];  //!< esp_timer time of latest boundary, 0 if never seen
+    struct wmngr_tl_hist phase[wmngr_tl_max];
+                                    //!< Durations of phases ending at each boundary
+    struct wmngr_tl_hist total;     //!< Config start to connected state
+    struct wmngr_tl_hist reconnect; //!< Connection lost to connected state
+    struct wmngr_tl_hist scenario;  //!< Runs of esp_wmngr_run_scenario()
+};
+
+esp_err_t esp_wmngr_get_timeline(struct wmngr_timeline *tl);
+uint32_t esp_wmngr_tl_percentile(const struct wmngr_tl_hist *hist,
+                                 unsigned int pct);
+void esp_wmngr_reset_timeline(void);
+void esp_wmngr_dump_timeline(void);
+
+/* Hook used by the managers to record a boundary. */
+#if defined(CONFIG_WMNGR_TIMELINE)
+void wmngr_tl_mark(enum wmngr_tl_mark mark);
+void wmngr_tl_scenario(int64_t us);
+#define WMNGR_TL_MARK(mark)     wmngr_tl_mark(mark)
+#define WMNGR_TL_SCENARIO(us)   wmngr_tl_scenario(us)
+#else
+#define WMNGR_TL_MARK(mark)     do{ } while(0)
+#define WMNGR_TL_SCENARIO(us)   do{ (void) (us); } while(0)
+#endif
+
+#endif // WMNGR_TIMELINE_H
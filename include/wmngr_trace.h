@@ -0,0 +1,107 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_TRACE_H
+#define WMNGR_TRACE_H
+
+/** @file */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+
+/** Magic number at the start of a trace dump ("WMTR"). */
+#define WMNGR_TRACE_MAGIC       0x52544d57
+/** Version of the trace dump format. */
+#define WMNGR_TRACE_VERSION     1
+
+/** Record types. */
+enum wmngr_trace_type {
+    wmngr_trace_none = 0,       //!< Unused record
+    wmngr_trace_state,          //!< State change: arg0 = old, arg1 = new state
+    wmngr_trace_event,          //!< System event: arg0 = base, arg1 = event ID
+    wmngr_trace_call,           //!< Driver call: arg0 = site, arg1 = esp_err_t
+};
+
+/** Event bases as recorded in #wmngr_trace_event records. */
+enum wmngr_trace_base {
+    wmngr_trace_base_wifi = 0,  //!< WIFI_EVENT
+    wmngr_trace_base_ip,        //!< IP_EVENT
+    wmngr_trace_base_eth,       //!< ETH_EVENT
+};
+
+/** Call sites recorded in #wmngr_trace_call records. */
+enum wmngr_trace_site {
+    wmngr_site_restore = 0,     //!< esp_wifi_restore()
+    wmngr_site_set_mode,        //!< esp_wifi_set_mode()
+    wmngr_site_set_ap,          //!< esp_wifi_set_config() AP
+    wmngr_site_set_sta,         //!< esp_wifi_set_config() STA
+    wmngr_site_set_ip,          //!< esp_netif_set_ip_info() STA
+    wmngr_site_wifi_start,      //!< esp_wifi_start()
+    wmngr_site_connect,         //!< esp_wifi_connect()
+    wmngr_site_scan_start,      //!< esp_wifi_scan_start()
+    wmngr_site_wps_enable,      //!< esp_wifi_wps_enable()
+    wmngr_site_wps_start,       //!< esp_wifi_wps_start()
+    wmngr_site_save_cfg,        //!< Writing WiFi config to NVS
+    wmngr_site_eth_start,       //!< esp_eth_start()
+    wmngr_site_eth_stop,        //!< esp_eth_stop()
+    wmngr_site_max,
+};
+
+/** A single trace record. */
+struct wmngr_trace_rec {
+    uint32_t tick;      //!< FreeRTOS tick count
+    uint8_t type;       //!< #wmngr_trace_type
+    uint8_t arg0;       //!< Type specific
+    int16_t arg1;       //!< Type specific
+};
+
+/** Header of a trace dump, followed by num_records records, oldest first. */
+struct wmngr_trace_hdr {
+    uint32_t magic;         //!< #WMNGR_TRACE_MAGIC
+    uint16_t version;       //!< #WMNGR_TRACE_VERSION
+    uint16_t rec_size;      //!< sizeof(struct wmngr_trace_rec)
+    uint32_t tick_hz;       //!< FreeRTOS tick rate
+    uint32_t num_records;   //!< Number of records following the header
+};
+
+size_t esp_wmngr_trace_dump(void *buf, size_t len);
+void esp_wmngr_trace_log(void);
+void esp_wmngr_trace_clear(void);
+
+/* Hooks used by the managers to add trace records. */
+#if defined(CONFIG_WMNGR_TRACE)
+void wmngr_trace_init(void);
+void wmngr_trace_add(enum wmngr_trace_type type, uint8_t arg0, int16_t arg1);
+#define WMNGR_TRACE_INIT()              wmngr_trace_init()
+#define WMNGR_TRACE(type, arg0, arg1)   wmngr_trace_add((type), (arg0), (arg1))
+#else
+#define WMNGR_TRACE_INIT()              do{ } while(0)
+#define WMNGR_TRACE(type, arg0, arg1)   do{ } while(0)
+#endif
+
+#define WMNGR_TRACE_STATE(old, new) \
+    WMNGR_TRACE(wmngr_trace_state, (old), (new))
+#define WMNGR_TRACE_EVENT(base, id) \
+    WMNGR_TRACE(wmngr_trace_event, (base), (id))
+#define WMNGR_TRACE_CALL(site, err) \
+    WMNGR_TRACE(wmngr_trace_call, (site), (err))
+
+#endif // WMNGR_TRACE_H
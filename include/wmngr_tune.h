@@ -0,0 +1,62 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#ifndef WMNGR_TUNE_H
+#define WMNGR_TUNE_H
+
+/** @file */
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "wmngr_link.h"
+
+/** Radio settings chosen by the link tuner. */
+struct wmngr_tune_state {
+    int8_t tx_power;        //!< Maximum TX power in 0.25 dBm, 0 if untouched
+    int8_t tx_floor;        //!< Lowest TX power allowed after a link loss, until stable
+    uint8_t bandwidth;      //!< wifi_bandwidth_t for the next association
+    uint8_t protocol;       //!< WIFI_PROTOCOL_* bits for the next association
+    uint8_t failures;       //!< Connection losses not yet outlived
+    uint32_t decisions;     //!< Number of changes made
+};
+
+esp_err_t esp_wmngr_get_tune_state(struct wmngr_tune_state *state);
+
+/* Hooks used by the link monitor and the WiFi Manager. */
+#if defined(CONFIG_WMNGR_TUNER)
+void wmngr_tune_sample(const struct wmngr_link_stats *stats);
+void wmngr_tune_prepare(void);
+void wmngr_tune_lost(void);
+void wmngr_tune_restored(void);
+void wmngr_tune_new_ap(const uint8_t *bssid);
+#define WMNGR_TUNE_SAMPLE(stats)    wmngr_tune_sample(stats)
+#define WMNGR_TUNE_PREPARE()        wmngr_tune_prepare()
+#define WMNGR_TUNE_LOST()           wmngr_tune_lost()
+#define WMNGR_TUNE_RESTORED()       wmngr_tune_restored()
+#define WMNGR_TUNE_NEW_AP(bssid)    wmngr_tune_new_ap(bssid)
+#else
+#define WMNGR_TUNE_SAMPLE(stats)    do{ } while(0)
+#define WMNGR_TUNE_PREPARE()        do{ } while(0)
+#define WMNGR_TUNE_LOST()           do{ } while(0)
+#define WMNGR_TUNE_RESTORED()       do{ } while(0)
+#define WMNGR_TUNE_NEW_AP(bssid)    do{ } while(0)
+#endif
+
+#endif // WMNGR_TUNE_H
@@ -29,6 +29,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 
 #include "esp_event.h"
 #include "esp_eth.h"
@@ -43,12 +44,19 @@
 
 #include "kutils.h"
 #include "kref.h"
+#include "wmngr_metrics.h"
+#include "wmngr_trace.h"
+#include "wmngr_mem.h"
+#include "wmngr_status.h"
+#include "wmngr_evrec.h"
 
 static const char *TAG = "eth_manager";
 
 #define WMNGR_NAMESPACE "eth_manager"
 #define NVS_CFG_VER     1
 #define ETH_USE_IPV6 (CONFIG_LWIP_IPV6)
+/* Lock timeout of the API functions without _ex suffix. */
+#define API_TIMEOUT  (CONFIG_WMNGR_API_TIMEOUT / portTICK_PERIOD_MS)
 
 /* For keeping track of system events. */
 #define BIT_ETH_START           BIT1
@@ -60,6 +68,7 @@ struct eth_manager_handle_s {
     esp_netif_t *eth_netif;
     esp_eth_handle_t eth_handle;
     EventGroupHandle_t eth_events;
+    SemaphoreHandle_t lock; /*!< Serializes config changes. */
 };
 static struct eth_manager_handle_s *handle = NULL;
 
@@ -97,6 +106,8 @@ static esp_err_t get_saved_config(struct eth_cfg *cfg)
         return result;
     }
 
+    WMNGR_METRIC_INC(nvs_reads);
+
     /* Make sure we know how to handle the stored configuration. */
     result = nvs_get_u32(handle, "version", &tmp);
     if (result != ESP_OK) {
@@ -245,6 +256,10 @@ static esp_err_t save_config(struct eth_cfg *cfg)
         goto on_exit;
     }
 
+    WMNGR_METRIC_INC(nvs_writes);
+    WMNGR_METRIC_ADD(nvs_bytes, 3 * sizeof(uint32_t)
+        + sizeof(cfg->ip_info) + sizeof(cfg->dns_info));
+
 on_exit:
     if (result != ESP_OK) {
         /* we do not want to leave a half-written config lying around. */
@@ -286,6 +301,7 @@ static esp_err_t start_eth(void)
 
     // Start the Ethernet driver state machine
     result = esp_eth_start(handle->eth_handle);
+    WMNGR_TRACE_CALL(wmngr_site_eth_start, result);
     if (result != ESP_OK) {
         ESP_LOGW(TAG, "Failed to start Ethernet. %s", esp_err_to_name(result));
     }
@@ -293,7 +309,7 @@ static esp_err_t start_eth(void)
     return result;
 }
 
-esp_err_t stop_eth(void)
+static esp_err_t stop_eth(void)
 {
     esp_err_t result = ESP_OK;
 
@@ -309,6 +325,7 @@ esp_err_t stop_eth(void)
 
     // Stop the Ethernet driver state machine
     result = esp_eth_stop(handle->eth_handle);
+    WMNGR_TRACE_CALL(wmngr_site_eth_stop, result);
     if (result != ESP_OK) {
         ESP_LOGW(TAG, "Failed to stop Ethernet. %s", esp_err_to_name(result));
     }
@@ -316,30 +333,53 @@ esp_err_t stop_eth(void)
     return result;
 }
 
-/* Helper function to set Ethernet configuration from struct eth_cfg. */
-static esp_err_t set_eth_cfg(struct eth_cfg *cfg)
+/*
+ * Helper function to apply the parts of an Ethernet configuration selected
+ * by mask. Parts not selected are expected to be active already.
+ */
+static esp_err_t apply_eth_cfg(struct eth_cfg *cfg, uint32_t mask)
 {
     unsigned int idx;
     esp_err_t result;
 
     ESP_LOGD(TAG, "[%s] Called.", __FUNCTION__);
 
+    result = ESP_OK;
+
     if (cfg->is_disabled)
     {
-        // Todo disable ethernet interface
-        ESP_LOGI(TAG, "Disabling Ethernet interface.");
-        result = stop_eth();
+        if (mask & ETH_CFG_DISABLED) {
+            ESP_LOGI(TAG, "Disabling Ethernet interface.");
+            result = stop_eth();
+        }
         return result; // no need to continue
     }
 
-    if (cfg->is_static) {
+    /* (Re-)enabling the interface needs the complete config. */
+    if (mask & ETH_CFG_DISABLED) {
+        mask = ETH_CFG_ALL;
+    }
+
+    if (!(mask & ETH_CFG_IP)) {
+        ESP_LOGD(TAG, "Keeping IP configuration.");
+    }
+    else if (cfg->is_static) {
         (void)esp_netif_dhcpc_stop(handle->eth_netif);
 
         result = esp_netif_set_ip_info(handle->eth_netif, &cfg->ip_info);
         if (result != ESP_OK) {
             ESP_LOGE(TAG, "esp_netif_set_ip_info() STA: %s", esp_err_to_name(result));
         }
+    }
+    else {
+        result = esp_netif_dhcpc_start(handle->eth_netif);
+        if (ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED == result) {
+            result = ESP_OK;
+            ESP_LOGD(TAG, "DHCP already started.");
+        }
+    }
 
+    if (cfg->is_static && (mask & (ETH_CFG_IP | ETH_CFG_DNS))) {
         for (idx = 0; idx < ARRAY_SIZE(cfg->dns_info); ++idx) {
             if (ip_addr_isany_val(cfg->dns_info[idx].ip)) {
                 continue;
@@ -353,21 +393,57 @@ static esp_err_t set_eth_cfg(struct eth_cfg *cfg)
             }
         }
     }
-    else {
-        result = esp_netif_dhcpc_start(handle->eth_netif);
-        if (ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED == result) {
-            result = ESP_OK;
-            ESP_LOGD(TAG, "DHCP already started.");
-        }
-    }
 
-    // Enable ethernet interface
-    ESP_LOGI(TAG, "Enabling Ethernet interface.");
-    result = start_eth();
+    if (mask & ETH_CFG_DISABLED) {
+        // Enable ethernet interface
+        ESP_LOGI(TAG, "Enabling Ethernet interface.");
+        result = start_eth();
+    }
 
     return result;
 }
 
+/* Helper function to set Ethernet configuration from struct eth_cfg. */
+static esp_err_t set_eth_cfg(struct eth_cfg *cfg)
+{
+    return apply_eth_cfg(cfg, ETH_CFG_ALL);
+}
+
+/*
+ * Copy the fields selected by mask from patch to cfg. Returns the parts
+ * that actually changed.
+ */
+static uint32_t eth_cfg_patch(struct eth_cfg *cfg, const struct eth_cfg *patch,
+                              uint32_t mask)
+{
+    uint32_t changed;
+
+    changed = 0;
+
+    if ((mask & ETH_CFG_DISABLED) && cfg->is_disabled != patch->is_disabled) {
+        cfg->is_disabled = patch->is_disabled;
+        changed |= ETH_CFG_DISABLED;
+    }
+
+    if ((mask & ETH_CFG_IP)
+        && (cfg->is_static != patch->is_static
+            || memcmp(&cfg->ip_info, &patch->ip_info, sizeof(cfg->ip_info))))
+    {
+        cfg->is_static = patch->is_static;
+        memcpy(&cfg->ip_info, &patch->ip_info, sizeof(cfg->ip_info));
+        changed |= ETH_CFG_IP;
+    }
+
+    if ((mask & ETH_CFG_DNS)
+        && memcmp(cfg->dns_info, patch->dns_info, sizeof(cfg->dns_info)))
+    {
+        memcpy(cfg->dns_info, patch->dns_info, sizeof(cfg->dns_info));
+        changed |= ETH_CFG_DNS;
+    }
+
+    return changed;
+}
+
 bool cfgs_are_equal(struct eth_cfg *a, struct eth_cfg *b)
 {
     unsigned int idx;
@@ -506,11 +582,21 @@ on_exit:
 static void eth_event_handler(void *esp_netif, esp_event_base_t event_base,
     int32_t event_id, void *event_data)
 {
+    /* IP events of the WiFi interfaces get traced by the WiFi Manager. */
+    if (ETH_EVENT == event_base) {
+        WMNGR_TRACE_EVENT(wmngr_trace_base_eth, event_id);
+    } else if (IP_EVENT_ETH_GOT_IP == event_id
+        || IP_EVENT_ETH_LOST_IP == event_id)
+    {
+        WMNGR_TRACE_EVENT(wmngr_trace_base_ip, event_id);
+    }
 
     if (ETH_EVENT == event_base) {
         switch (event_id)
         {
         case ETHERNET_EVENT_CONNECTED:
+            WMNGR_METRIC_INC(eth_link_up);
+            wmngr_status_eth_link(true);
             xEventGroupSetBits(handle->eth_events, BIT_ETH_CONNECTED);
 #if ETH_USE_IPV6
             esp_netif_create_ip6_linklocal(esp_netif);
@@ -518,15 +604,17 @@ static void eth_event_handler(void *esp_netif, esp_event_base_t event_base,
             if (LOG_LOCAL_LEVEL >= ESP_LOG_INFO)
             {
                 uint8_t mac_addr[6] = {0};
-                /* we can get the ethernet driver handle from event data */
-                esp_eth_handle_t eth_handle = *(esp_eth_handle_t *)event_data;
-                esp_eth_ioctl(eth_handle, ETH_CMD_G_MAC_ADDR, &mac_addr[0]);
+                /* Use our own driver handle, the one in the event data may
+                 * come from a replayed recording. */
+                esp_eth_ioctl(handle->eth_handle, ETH_CMD_G_MAC_ADDR, &mac_addr[0]);
                 ESP_LOGI(TAG, "Ethernet Link Up. HW Addr %02x:%02x:%02x:%02x:%02x:%02x",
                     mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
             }
             break;
         case ETHERNET_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "Ethernet Link Down");
+            WMNGR_METRIC_INC(eth_link_down);
+            wmngr_status_eth_link(false);
             xEventGroupClearBits(handle->eth_events, BIT_ETH_CONNECTED);
             break;
         case ETHERNET_EVENT_START:
@@ -542,18 +630,24 @@ static void eth_event_handler(void *esp_netif, esp_event_base_t event_base,
         }
     }
 
-    // if (IP_EVENT == event_base) {
-    //     switch (event_id) {
-    //     case IP_EVENT_STA_GOT_IP:
-    //         xEventGroupSetBits(handle->eth_events, BIT_ETH_GOT_IP);
-    //         break;
-    //     case IP_EVENT_STA_LOST_IP:
-    //         xEventGroupClearBits(handle->eth_events, BIT_ETH_GOT_IP);
-    //         break;
-    //     default:
-    //         break;
-    //     }
-    // }
+    if (IP_EVENT == event_base) {
+        switch (event_id) {
+        case IP_EVENT_ETH_GOT_IP:
+            if (((ip_event_got_ip_t *)event_data)->esp_netif != esp_netif) {
+                break;
+            }
+            WMNGR_METRIC_INC(eth_got_ip);
+            wmngr_status_eth_ip(&((ip_event_got_ip_t *)event_data)->ip_info);
+            xEventGroupSetBits(handle->eth_events, BIT_ETH_GOT_IP);
+            break;
+        case IP_EVENT_ETH_LOST_IP:
+            wmngr_status_eth_ip(NULL);
+            xEventGroupClearBits(handle->eth_events, BIT_ETH_GOT_IP);
+            break;
+        default:
+            break;
+        }
+    }
 }
 
 
@@ -578,7 +672,7 @@ esp_err_t eth_manager_init(esp_eth_handle_t eth_handle)
         ESP_LOGE(TAG, "Ethernet Manager already initialized.");
         return ESP_ERR_INVALID_STATE;
     }
-    handle = calloc(1, sizeof(*handle));
+    handle = WMNGR_CALLOC(eth, 1, sizeof(*handle));
     if (NULL == handle) {
         result = ESP_ERR_NO_MEM;
         goto on_exit;
@@ -587,14 +681,20 @@ esp_err_t eth_manager_init(esp_eth_handle_t eth_handle)
     kref_init(&(handle->ref_cnt)); // initialises ref_cnt to 1
     handle->eth_handle = eth_handle;
 
-    handle->eth_events = xEventGroupCreate();
+    WMNGR_MEM_TRACK(rtos, handle->eth_events = xEventGroupCreate());
     if (NULL == handle->eth_events) {
         result = ESP_ERR_NO_MEM;
         goto on_exit;
     }
 
+    WMNGR_MEM_TRACK(rtos, handle->lock = xSemaphoreCreateMutex());
+    if (NULL == handle->lock) {
+        result = ESP_ERR_NO_MEM;
+        goto on_exit;
+    }
+
     esp_netif_config_t cfg = ESP_NETIF_DEFAULT_ETH();
-    handle->eth_netif = esp_netif_new(&cfg);
+    WMNGR_MEM_TRACK(netif, handle->eth_netif = esp_netif_new(&cfg));
     if (NULL == handle->eth_netif)
     {
         goto on_exit;
@@ -607,7 +707,9 @@ esp_err_t eth_manager_init(esp_eth_handle_t eth_handle)
     // }
 
     /* attach Ethernet driver to TCP/IP stack */
-    result = esp_netif_attach(handle->eth_netif, esp_eth_new_netif_glue(handle->eth_handle));
+    esp_eth_netif_glue_handle_t glue;
+    WMNGR_MEM_TRACK(eth, glue = esp_eth_new_netif_glue(handle->eth_handle));
+    result = esp_netif_attach(handle->eth_netif, glue);
     if (ESP_OK != result)
     {
         goto on_exit;
@@ -622,6 +724,17 @@ esp_err_t eth_manager_init(esp_eth_handle_t eth_handle)
     {
         goto on_exit;
     }
+    WMNGR_EVREC_HANDLER(ETH_EVENT, &eth_event_handler, handle->eth_netif);
+    result = esp_event_handler_instance_register(IP_EVENT,
+        ESP_EVENT_ANY_ID,
+        &eth_event_handler,
+        handle->eth_netif,
+        NULL);
+    if (ESP_OK != result)
+    {
+        goto on_exit;
+    }
+    WMNGR_EVREC_HANDLER(IP_EVENT, &eth_event_handler, handle->eth_netif);
 
     // Load the saved configuration from NVS
     struct eth_cfg cfg_state;
@@ -642,36 +755,169 @@ on_exit:
         ESP_LOGW(TAG, "Failed to start Ethernet. %s", esp_err_to_name(result));
         if (NULL != handle) {
             if (handle->eth_events != NULL) {
-                vEventGroupDelete(handle->eth_events);
+                WMNGR_MEM_TRACK(rtos, vEventGroupDelete(handle->eth_events));
                 handle->eth_events = NULL;
             }
-            free(handle);
+            if (handle->lock != NULL) {
+                WMNGR_MEM_TRACK(rtos, vSemaphoreDelete(handle->lock));
+                handle->lock = NULL;
+            }
+            WMNGR_FREE(handle);
             handle = NULL;
         }
     }
     return result;
 }
 
+/* Take the config lock, fails if the manager is not initialized. */
+static esp_err_t eth_lock(TickType_t timeout)
+{
+    if (NULL == handle || NULL == handle->lock) {
+        ESP_LOGE(TAG, "Ethernet Manager not initialized.");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (xSemaphoreTake(handle->lock, timeout) != pdTRUE) {
+        ESP_LOGE(TAG, "[%s] Error taking mutex.", __FUNCTION__);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
 /** Set a new Network Manager configuration.
  *
  * @param[in] new New WiFi Manager configuration to be set.
+ * @param[in] timeout Ticks to wait for the Ethernet Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK if config was set, ESP_ERR_* otherwise.
  */
-esp_err_t eth_manager_set_eth_cfg(struct eth_cfg *new_cfg)
+esp_err_t eth_manager_set_eth_cfg_ex(struct eth_cfg *new_cfg,
+                                     TickType_t timeout)
 {
+    esp_err_t result;
+
     // TODO: make this use the asynchronous mechanism, just hacked for now
+
+    result = eth_lock(timeout);
+    if (result != ESP_OK) {
+        return result;
+    }
+
     save_config(new_cfg);
-    return set_eth_cfg(new_cfg);
+
+    result = set_eth_cfg(new_cfg);
+    if (result != ESP_OK) {
+        wmngr_status_error(result);
+    }
+
+    xSemaphoreGive(handle->lock);
+
+    return result;
+}
+
+/** Same as #eth_manager_set_eth_cfg_ex with the default timeout.
+ */
+esp_err_t eth_manager_set_eth_cfg(struct eth_cfg *new_cfg)
+{
+    return eth_manager_set_eth_cfg_ex(new_cfg, API_TIMEOUT);
+}
+
+/** Change selected fields of the Ethernet configuration.
+ *
+ * Copies the fields selected by field_mask from patch into the saved
+ * configuration, stores the result and applies only the changed parts,
+ * e.g. changing the DNS servers does not restart the interface.
+ *
+ * @param[in] patch Configuration holding the new field values.
+ * @param[in] field_mask ETH_CFG_* bits selecting the fields to change.
+ * @param[in] timeout Ticks to wait for the Ethernet Manager's lock, 0 to
+ *            try once.
+ * @return ESP_OK if config was set or nothing changed, ESP_ERR_* otherwise.
+ */
+esp_err_t eth_manager_update_eth_cfg_ex(const struct eth_cfg *patch,
+                                        uint32_t field_mask,
+                                        TickType_t timeout)
+{
+    struct eth_cfg cfg;
+    uint32_t changed;
+    esp_err_t result;
+
+    if (patch == NULL || field_mask == 0 || (field_mask & ~ETH_CFG_ALL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    result = eth_lock(timeout);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    result = get_saved_or_default_config(&cfg);
+    if (result != ESP_OK) {
+        goto on_exit;
+    }
+
+    changed = eth_cfg_patch(&cfg, patch, field_mask);
+    if (changed == 0) {
+        goto on_exit;
+    }
+
+    cfg.is_default = false;
+    save_config(&cfg);
+
+    result = apply_eth_cfg(&cfg, changed);
+    if (result != ESP_OK) {
+        wmngr_status_error(result);
+    }
+
+on_exit:
+    xSemaphoreGive(handle->lock);
+
+    return result;
+}
+
+/** Same as #eth_manager_update_eth_cfg_ex with the default timeout.
+ */
+esp_err_t eth_manager_update_eth_cfg(const struct eth_cfg *patch,
+                                     uint32_t field_mask)
+{
+    return eth_manager_update_eth_cfg_ex(patch, field_mask, API_TIMEOUT);
 }
 
 /**
  * @brief Get the current Network Manager configuration.
  * @param[out] new_cfg Pointer to the configuration structure to be filled.
+ * @param[in] timeout Ticks to wait for the Ethernet Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK if config was set, ESP_ERR_* otherwise.
  */
+esp_err_t eth_manager_get_eth_cfg_ex(struct eth_cfg *new_cfg,
+                                     TickType_t timeout)
+{
+    esp_err_t result;
+
+    /* The saved config can be read before the manager is initialized. */
+    if (NULL == handle) {
+        return get_saved_or_default_config(new_cfg);
+    }
+
+    result = eth_lock(timeout);
+    if (result != ESP_OK) {
+        return result;
+    }
+
+    result = get_saved_or_default_config(new_cfg);
+
+    xSemaphoreGive(handle->lock);
+
+    return result;
+}
+
+/** Same as #eth_manager_get_eth_cfg_ex with the default timeout.
+ */
 esp_err_t eth_manager_get_eth_cfg(struct eth_cfg *new_cfg)
 {
-    return get_saved_or_default_config(new_cfg);
+    return eth_manager_get_eth_cfg_ex(new_cfg, API_TIMEOUT);
 }
 
 /** Query current connection status.
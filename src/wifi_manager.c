@@ -44,18 +44,53 @@
 
 #include "kutils.h"
 #include "kref.h"
+#include "wmngr_timeline.h"
+#include "wmngr_metrics.h"
+#include "wmngr_trace.h"
+#include "wmngr_lock.h"
+#include "wmngr_link.h"
+#include "wmngr_mem.h"
+#include "wmngr_cfg.h"
+#include "wmngr_roam.h"
+#include "wmngr_chan.h"
+#include "wmngr_ap.h"
+#include "wmngr_ps.h"
+#include "wmngr_tune.h"
+#include "wmngr_hidden.h"
+#include "wmngr_status.h"
+#include "wmngr_evrec.h"
 
 static const char *TAG = "wifimngr";
 
 #define WMNGR_NAMESPACE "esp_wmngr"
-#define NVS_CFG_VER     1
+#define NVS_CFG_VER     2
 
 #define MAX_AP_CLIENTS  3
 #define MAX_NUM_APS     32
 #define SCAN_TIMEOUT    (60 * 1000 / portTICK_PERIOD_MS)
 #define CFG_TIMEOUT     (60 * 1000 / portTICK_PERIOD_MS)
+
+#if defined(CONFIG_WMNGR_ROAMING)
+#define ROAM_NR_TIMEOUT (1000 / portTICK_PERIOD_MS)
+/* Reassociation to the AP picked for roaming. */
+#define ROAM_TIMEOUT    (5 * 1000 / portTICK_PERIOD_MS)
+/* AP acting on our BSS transition query. */
+#define ROAM_QUERY_TIMEOUT  (1000 / portTICK_PERIOD_MS)
+#define ROAM_BTM_GRACE  (CONFIG_WMNGR_ROAM_BTM_GRACE / portTICK_PERIOD_MS)
+#endif
 #define CFG_TICKS       (1000 / portTICK_PERIOD_MS)
 #define CFG_DELAY       (100 / portTICK_PERIOD_MS)
+/* Lock timeout of the API functions without _ex suffix. */
+#define API_TIMEOUT     (CONFIG_WMNGR_API_TIMEOUT / portTICK_PERIOD_MS)
+
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+#define AP_OFF_DELAY    (CONFIG_WMNGR_AP_OFF_DELAY * 1000 / portTICK_PERIOD_MS)
+#endif
+
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+/* Scan data older than this is not used for picking the AP channel. */
+#define CHAN_SCAN_AGE   (5 * 60 * 1000 / portTICK_PERIOD_MS)
+#endif
 
 struct scan_data_ref {
     struct kref ref_cnt;
@@ -63,15 +98,49 @@ struct scan_data_ref {
     struct scan_data data;
 };
 
-/* This holds all the state and configuration data needed at runtime. */
+struct cfg_data_ref {
+    struct kref ref_cnt;
+    struct wifi_cfg cfg;
+};
+
+/*
+ * This holds all the state and configuration data needed at runtime. It is
+ * passed to every internal function, the API works on default_state.
+ */
 struct wifi_cfg_state {
     SemaphoreHandle_t lock;
+    portMUX_TYPE cfg_ref_lock; /* Only guards swapping and grabbing cfg_ref. */
+    EventGroupHandle_t events; /* For keeping track of system events. */
+    TimerHandle_t timer;
+    esp_netif_t *sta_netif;
+    esp_netif_t *ap_netif;
     TickType_t cfg_timestamp; /* Timestamp of last config change. */
+    TickType_t scan_timestamp; /* Timestamp of last scan start. */
     enum wmngr_state state;
     struct wifi_cfg saved; /* Active config when _set_cfg() was last called. */
     struct wifi_cfg current; /* Config that is currently being applied. */
     struct wifi_cfg new; /* Config last set, might not have been applied yet.*/
     struct scan_data_ref *scan_ref; /* Pointer to current AP scan data. */
+    struct cfg_data_ref *cfg_ref; /* Published version of current. */
+    bool drv_synced; /* Driver's config matches current. */
+    bool connect_pending; /* Waiting for STA connection after set_wifi_cfg.*/
+    bool connect_fast; /* STA config was kept, PMK cache can be used. */
+    uint32_t update_mask; /* Parts changed by esp_wmngr_update_cfg(). */
+    bool lock_waiting; /* handle_wifi() failed to get the lock */
+    TickType_t lock_wait_start; /*    since this timestamp. */
+    TickType_t connect_timestamp; /* Timestamp of last connect attempt. */
+    uint32_t full_connects; /* Number and duration of connects with */
+    uint32_t full_connect_ms; /*    full handshake, for estimating savings. */
+#if defined(CONFIG_WMNGR_ROAMING)
+    struct wmngr_roam_ctx roam; /* State of the current roaming attempt. */
+#endif
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+    bool btm_supported; /* AP of the last connection supports BTM. */
+#endif
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+    bool ap_off; /* AP of an APSTA config has been switched off. */
+    TickType_t ap_timestamp; /* Start of current AP off delay. */
+#endif
 };
 
 const char *wmngr_state_names[wmngr_state_max] = {
@@ -85,10 +154,19 @@ const char *wmngr_state_names[wmngr_state_max] = {
     "WPS Active",
     "Connecting",
     "Disconnecting",
-    "Fall Back"
+    "Fall Back",
+    "Roaming"
 };
 
-static struct wifi_cfg_state cfg_state = {.state = wmngr_state_deinit};
+/*
+ * The only instance. The wmngr_* feature modules keep module state of
+ * their own and the driver and default netifs exist once per process,
+ * so a second instance could not run next to this one.
+ */
+static struct wifi_cfg_state default_state = {
+    .state = wmngr_state_deinit,
+    .cfg_ref_lock = portMUX_INITIALIZER_UNLOCKED,
+};
 
 /* For keeping track of system events. */
 #define BIT_TRIGGER             BIT0
@@ -103,18 +181,92 @@ static struct wifi_cfg_state cfg_state = {.state = wmngr_state_deinit};
 #define BIT_WPS_FAILED          BIT9
 #define BITS_WPS    (BIT_WPS_SUCCESS | BIT_WPS_FAILED)
 #define BIT_STOPPED             BIT10
-
-static esp_netif_t* sta_netif = NULL;
-static esp_netif_t* ap_netif = NULL;
-
-static EventGroupHandle_t wifi_events = NULL;
-
-static TimerHandle_t config_timer = NULL;
+#define BIT_ROAM                BIT11
+#define BIT_CHAN_SELECT         BIT12
+#define BIT_AP_REQUEST          BIT13
+#define BIT_SCAN_HIDDEN         BIT14
 
 static void handle_timer(TimerHandle_t timer);
 static void event_handler(void* args, esp_event_base_t base,
                           int32_t id, void* data);
 static esp_err_t get_saved_config(struct wifi_cfg *cfg);
+static esp_err_t get_wifi_cfg(struct wifi_cfg_state *cfg_state,
+                              struct wifi_cfg *cfg);
+
+/* Helper function to change cfg_state.state. Caller must hold the lock. */
+static void set_state(struct wifi_cfg_state *cfg_state, enum wmngr_state state)
+{
+    if(state != cfg_state->state){
+        WMNGR_TRACE_STATE(cfg_state->state, state);
+        cfg_state->state = state;
+        wmngr_status_wifi(state);
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+        if(state == wmngr_state_connected){
+            cfg_state->ap_timestamp = xTaskGetTickCount();
+        }
+#endif
+    }
+}
+
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+/*
+ * Switch the driver to STA mode once the STA has been connected for
+ * AP_OFF_DELAY, so the radio stops time-sharing with the AP's beacons.
+ * The config keeps its APSTA mode, so esp_wmngr_get_cfg() and the NVS
+ * are not affected. Returns the timer delay.
+ */
+static TickType_t ap_auto_off(struct wifi_cfg_state *cfg_state, TickType_t now)
+{
+    esp_err_t result;
+
+    if(cfg_state->ap_off || cfg_state->current.mode != WIFI_MODE_APSTA){
+        return 0;
+    }
+
+    if(!time_after(now, cfg_state->ap_timestamp + AP_OFF_DELAY)){
+        return CFG_TICKS;
+    }
+
+    ESP_LOGI(TAG, "[%s] STA connection stable, turning off AP.", __func__);
+    result = esp_wifi_set_mode(WIFI_MODE_STA);
+    WMNGR_TRACE_CALL(wmngr_site_set_mode, result);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] esp_wifi_set_mode(): %d %s",
+                 __func__, result, esp_err_to_name(result));
+        cfg_state->ap_timestamp = now;
+        return CFG_TICKS;
+    }
+
+    cfg_state->ap_off = true;
+
+    return 0;
+}
+
+/*
+ * Bring a switched off AP back and restart the off delay. The driver
+ * keeps the AP config while in STA mode, so restoring the mode is enough.
+ */
+static void ap_auto_on(struct wifi_cfg_state *cfg_state, TickType_t now)
+{
+    esp_err_t result;
+
+    cfg_state->ap_timestamp = now;
+    if(!cfg_state->ap_off){
+        return;
+    }
+
+    ESP_LOGI(TAG, "[%s] Turning AP back on.", __func__);
+    cfg_state->ap_off = false;
+
+    result = esp_wifi_set_mode(cfg_state->current.mode);
+    WMNGR_TRACE_CALL(wmngr_site_set_mode, result);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] esp_wifi_set_mode(): %d %s",
+                 __func__, result, esp_err_to_name(result));
+        cfg_state->drv_synced = false;
+    }
+}
+#endif
 
 /** Set configuration from compiled-in defaults.
  */
@@ -164,7 +316,166 @@ static void set_defaults(struct wifi_cfg *cfg)
         memcpy(cfg->ap.ap.ssid, "ESP WiFi Manager", len);
     }
     cfg->ap.ap.ssid_len = len;
+
+    len = strlen(CONFIG_WMNGR_COUNTRY);
+    if(len == 0 || len == 2){
+        memcpy(cfg->country, CONFIG_WMNGR_COUNTRY, len);
+    } else {
+        ESP_LOGE(TAG, "[%s] Invalid default country: %s. "
+                      "Using the driver's default instead.",
+                      __func__, CONFIG_WMNGR_COUNTRY);
+    }
+    cfg->chan_first = CONFIG_WMNGR_CHAN_FIRST;
+    cfg->chan_num = CONFIG_WMNGR_CHAN_NUM;
+}
+
+/*
+ * Apply the country and channel plan of cfg. The plan is clipped to the
+ * channels allowed in the country. The driver only scans the resulting
+ * channels and refuses to put the AP on any other.
+ */
+static esp_err_t set_country(const struct wifi_cfg *cfg)
+{
+    wifi_country_t country;
+    unsigned int first, last;
+    esp_err_t result;
+
+    /* An empty code restores the driver's default, which follows 802.11d. */
+    if(cfg->country[0] == '\0'){
+        result = esp_wifi_set_country_code("01", true);
+    } else {
+        result = esp_wifi_set_country_code(cfg->country, false);
+    }
+    if(result != ESP_OK || cfg->chan_first == 0){
+        goto on_exit;
+    }
+
+    result = esp_wifi_get_country(&country);
+    if(result != ESP_OK){
+        goto on_exit;
+    }
+
+    first = MAX(cfg->chan_first, country.schan);
+    last = MIN(cfg->chan_first + cfg->chan_num, country.schan + country.nchan);
+    if(first >= last){
+        ESP_LOGW(TAG, "[%s] No channel of the plan allowed in %.2s.",
+                 __func__, country.cc);
+        goto on_exit;
+    }
+
+    country.schan = first;
+    country.nchan = last - first;
+    country.policy = WIFI_COUNTRY_POLICY_MANUAL;
+    result = esp_wifi_set_country(&country);
+
+on_exit:
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Setting country failed: %d %s",
+                 __func__, result, esp_err_to_name(result));
+    } else {
+        ESP_LOGI(TAG, "[%s] Country %s, channels %u+%u.", __func__,
+                 (cfg->country[0] != '\0') ? cfg->country : "default",
+                 cfg->chan_first, cfg->chan_num);
+    }
+
+    return result;
+}
+
+/* Move a fixed AP channel into the channels allowed by the driver. */
+static void ap_chan_clip(wifi_ap_config_t *ap)
+{
+    wifi_country_t country;
+
+    if(ap->channel == 0
+       || esp_wifi_get_country(&country) != ESP_OK
+       || country.nchan == 0)
+    {
+        return;
+    }
+
+    if(ap->channel < country.schan
+       || ap->channel >= country.schan + country.nchan)
+    {
+        ESP_LOGW(TAG, "[%s] AP channel %u outside of channel plan, "
+                      "using %u.", __func__, ap->channel, country.schan);
+        ap->channel = country.schan;
+    }
+}
+
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+/*
+ * Check whether we get to choose the SoftAP channel of cfg. Channels set
+ * by the user are left alone, and when the STA connects in APSTA mode,
+ * the driver keeps the AP on the STA's channel.
+ */
+static bool ap_chan_auto(const struct wifi_cfg *cfg)
+{
+    return cfg->ap.ap.channel == 0
+           && (   cfg->mode == WIFI_MODE_AP
+               || (cfg->mode == WIFI_MODE_APSTA && !cfg->sta_connect));
+}
+
+/*
+ * Pick the SoftAP channel for cfg from the latest scan. Without recent
+ * scan data, request a scan and move the AP once it is done.
+ */
+static void ap_chan_select(struct wifi_cfg_state *cfg_state,
+                           const struct wifi_cfg *cfg, wifi_ap_config_t *ap)
+{
+    struct scan_data_ref *ref;
+    uint8_t chan;
+
+    if(!ap_chan_auto(cfg)){
+        return;
+    }
+
+    ref = cfg_state->scan_ref;
+    if(ref != NULL
+       && !time_after(xTaskGetTickCount(), ref->data.tstamp + CHAN_SCAN_AGE))
+    {
+        chan = wmngr_chan_survey(&ref->data);
+        if(chan != 0){
+            ap->channel = chan;
+        }
+    } else if(cfg->mode == WIFI_MODE_APSTA){
+        xEventGroupSetBits(cfg_state->events,
+                           (BIT_CHAN_SELECT | BIT_SCAN_START));
+    }
+}
+
+/* Move the running SoftAP to the least congested channel. */
+static void ap_chan_update(struct wifi_cfg_state *cfg_state)
+{
+    wifi_config_t ap_cfg;
+    esp_err_t result;
+    uint8_t chan;
+
+    xEventGroupClearBits(cfg_state->events, BIT_CHAN_SELECT);
+
+    if(cfg_state->scan_ref == NULL || !ap_chan_auto(&cfg_state->current)){
+        return;
+    }
+
+    chan = wmngr_chan_survey(&cfg_state->scan_ref->data);
+    if(chan == 0
+       || esp_wifi_get_config(WIFI_IF_AP, &ap_cfg) != ESP_OK
+       || ap_cfg.ap.channel == chan)
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG, "[%s] Moving AP from channel %u to %u.",
+             __func__, ap_cfg.ap.channel, chan);
+
+    ap_cfg.ap.channel = chan;
+    result = esp_wifi_set_config(WIFI_IF_AP, &ap_cfg);
+    WMNGR_TRACE_CALL(wmngr_site_set_ap, result);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] esp_wifi_set_config() AP: %d %s",
+                 __func__, result, esp_err_to_name(result));
+    }
 }
+#endif
 
 /* Free scan data, should only be called through kref_put(). */
 static void free_scan_data(struct kref *ref)
@@ -172,33 +483,239 @@ static void free_scan_data(struct kref *ref)
     struct scan_data_ref *data;
 
     data = container_of(ref, struct scan_data_ref, ref_cnt);
-    free(data->data.ap_records);
-    free(data);
+    WMNGR_FREE(data->data.ap_records);
+    WMNGR_FREE(data);
+}
+
+/* Free a config version, should only be called through kref_put(). */
+static void free_cfg_data(struct kref *ref)
+{
+    struct cfg_data_ref *data;
+
+    data = container_of(ref, struct cfg_data_ref, ref_cnt);
+    WMNGR_FREE(data);
+}
+
+/*
+ * Publish cfg_state.current as a new immutable config version, unless it
+ * matches the published one. Readers of the old version keep it until
+ * they drop their reference. Caller must hold the lock.
+ */
+static void cfg_publish(struct wifi_cfg_state *cfg_state)
+{
+    struct cfg_data_ref *old, *new;
+
+    old = cfg_state->cfg_ref;
+    if(old != NULL
+       && !memcmp(&(old->cfg), &cfg_state->current, sizeof(old->cfg)))
+    {
+        return;
+    }
+
+    new = WMNGR_CALLOC(cfg, 1, sizeof(*new));
+    if(new == NULL){
+        ESP_LOGE(TAG, "Out of memory publishing config");
+        return;
+    }
+
+    kref_init(&(new->ref_cnt));
+    memcpy(&(new->cfg), &cfg_state->current, sizeof(new->cfg));
+
+    portENTER_CRITICAL(&cfg_state->cfg_ref_lock);
+    cfg_state->cfg_ref = new;
+    portEXIT_CRITICAL(&cfg_state->cfg_ref_lock);
+
+    /* Drop the global reference to the old version. */
+    if(old != NULL){
+        kref_put(&(old->ref_cnt), free_cfg_data);
+    }
+}
+
+/*
+ * Make new scan data available. The new data set is assigned to the
+ * global pointer, which takes its own reference. The caller keeps its.
+ */
+static void scan_publish(struct wifi_cfg_state *cfg_state,
+                         struct scan_data_ref *new)
+{
+    struct scan_data_ref *old;
+
+    kref_get(&(new->ref_cnt));
+
+    old = cfg_state->scan_ref;
+    cfg_state->scan_ref = new;
+    wmngr_status_scan(new->data.num_records, new->data.tstamp);
+
+    if(old != NULL){
+        /*
+         * Drop global reference to old data set so it will be freed
+         * when the last connection using it gets closed.
+         */
+        esp_wmngr_put_scan(&(old->data));
+    }
+}
+
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+/*
+ * Probe for the STA's SSID if a scan found hidden networks but not the
+ * SSID itself. Hidden APs only answer probes naming their SSID. If they
+ * are all on the same channel, only that channel is probed.
+ */
+static void hidden_scan_start(struct wifi_cfg_state *cfg_state,
+                              const struct scan_data *data)
+{
+    wifi_scan_config_t scan_cfg;
+    wifi_sta_config_t *sta;
+    unsigned int idx;
+    esp_err_t result;
+    uint8_t chan;
+    bool multi;
+
+    sta = &(cfg_state->current.sta.sta);
+    if(sta->ssid[0] == '\0' || cfg_state->current.mode == WIFI_MODE_AP){
+        return;
+    }
+
+    chan = 0;
+    multi = false;
+    for(idx = 0; idx < data->num_records; ++idx){
+        if(!strncmp((const char *) data->ap_records[idx].ssid,
+                    (const char *) sta->ssid, sizeof(sta->ssid)))
+        {
+            return;
+        }
+
+        if(data->ap_records[idx].ssid[0] == '\0'){
+            multi |= (chan != 0 && chan != data->ap_records[idx].primary);
+            chan = data->ap_records[idx].primary;
+        }
+    }
+
+    ESP_LOGI(TAG, "[%s] Probing for hidden SSID on channel %u.",
+             __func__, multi ? 0 : chan);
+
+    memset(&scan_cfg, 0x0, sizeof(scan_cfg));
+    scan_cfg.ssid = sta->ssid;
+    scan_cfg.channel = multi ? 0 : chan;
+    scan_cfg.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+
+    cfg_state->scan_timestamp = xTaskGetTickCount();
+    result = esp_wifi_scan_start(&scan_cfg, false);
+    WMNGR_TRACE_CALL(wmngr_site_scan_start, result);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Starting directed scan failed.", __func__);
+        WMNGR_METRIC_INC(scans_failed);
+        return;
+    }
+
+    WMNGR_METRIC_INC(scans_started);
+    WMNGR_METRIC_INC(hidden_scans);
+    xEventGroupSetBits(cfg_state->events, (BIT_SCAN_HIDDEN | BIT_SCAN_RUNNING));
+}
+
+/*
+ * Remember the BSSIDs that answered the directed probe and publish a
+ * copy of the current scan data with their SSIDs filled in.
+ */
+static void hidden_scan_done(struct wifi_cfg_state *cfg_state)
+{
+    struct scan_data_ref *cur, *new;
+    wifi_ap_record_t *recs;
+    uint16_t num;
+
+    recs = NULL;
+    new = NULL;
+
+    if(esp_wifi_scan_get_ap_num(&num) != ESP_OK || num == 0){
+        goto on_exit;
+    }
+
+    num = MIN(num, MAX_NUM_APS);
+    recs = WMNGR_CALLOC(scan, num, sizeof(*recs));
+    if(recs == NULL){
+        goto on_exit;
+    }
+
+    if(esp_wifi_scan_get_ap_records(&num, recs) != ESP_OK
+       || wmngr_hidden_reveal(cfg_state->current.sta.sta.ssid, recs, num) == 0)
+    {
+        goto on_exit;
+    }
+
+    cur = cfg_state->scan_ref;
+    if(cur == NULL){
+        goto on_exit;
+    }
+
+    new = WMNGR_CALLOC(scan, 1, sizeof(*new));
+    if(new == NULL){
+        ESP_LOGE(TAG, "Out of memory creating scan data");
+        goto on_exit;
+    }
+
+    kref_init(&(new->ref_cnt));
+    new->data.ap_records = WMNGR_CALLOC(scan, cur->data.num_records,
+                                        sizeof(*(new->data.ap_records)));
+    if(new->data.ap_records == NULL){
+        ESP_LOGE(TAG, "Out of memory for copying records");
+        goto on_exit;
+    }
+
+    memcpy(new->data.ap_records, cur->data.ap_records,
+           cur->data.num_records * sizeof(*(new->data.ap_records)));
+    new->data.num_records = cur->data.num_records;
+    new->data.tstamp = cur->data.tstamp;
+    (void) wmngr_hidden_merge(new->data.ap_records, new->data.num_records);
+
+    scan_publish(cfg_state, new);
+
+on_exit:
+    xEventGroupClearBits(cfg_state->events,
+                         (BIT_SCAN_HIDDEN | BIT_SCAN_RUNNING | BIT_SCAN_DONE));
+    if(new != NULL){
+        esp_wmngr_put_scan(&(new->data));
+    }
+    WMNGR_FREE(recs);
 }
+#endif
 
 /** Fetch the latest AP scan data and make it available.
  * Fetch the latest set of AP scan results and make them available to the
  * users. The SCAN_RUNNING and SCAN_DONE flags will be cleared on success or
  * unrecoverable error.
  */
-static void wifi_scan_done(void)
+static void wifi_scan_done(struct wifi_cfg_state *cfg_state)
 {
     uint16_t num_aps;
-    struct scan_data_ref *old, *new;
+    struct scan_data_ref *new;
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+    unsigned int hidden;
+#endif
     esp_err_t result;
 
     result = ESP_OK;
     new = NULL;
 
     /* cgiWifiSetup() must have been called prior to this point. */
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->lock != NULL);
+
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+    if(xEventGroupGetBits(cfg_state->events) & BIT_SCAN_HIDDEN){
+        hidden_scan_done(cfg_state);
+        return;
+    }
+#endif
+
+    WMNGR_TL_MARK(wmngr_tl_scan_done);
 
     /* Fetch number of APs found. Bail out early if there is nothing to get. */
     result = esp_wifi_scan_get_ap_num(&num_aps);
     if(result != ESP_OK || num_aps == 0){
         /* Something went seriously wrong, no point in trying again. */
         ESP_LOGI(TAG, "Scan error or empty scan result");
-        xEventGroupClearBits(wifi_events, (BIT_SCAN_RUNNING | BIT_SCAN_DONE));
+        WMNGR_METRIC_SET(scan_last_aps, 0);
+        xEventGroupClearBits(cfg_state->events,
+                             (BIT_SCAN_RUNNING | BIT_SCAN_DONE));
         goto on_exit;
     }
 
@@ -213,14 +730,15 @@ static void wifi_scan_done(void)
     }
 
     /* Allocate and initialise memory for scan data and AP records. */
-    new = calloc(1, sizeof(*new));
+    new = WMNGR_CALLOC(scan, 1, sizeof(*new));
     if(new == NULL){
         ESP_LOGE(TAG, "Out of memory creating scan data");
         goto on_exit;
     }
 
     kref_init(&(new->ref_cnt)); // initialises ref_cnt to 1
-    new->data.ap_records = calloc(num_aps, sizeof(*(new->data.ap_records)));
+    new->data.ap_records = WMNGR_CALLOC(scan, num_aps,
+                                        sizeof(*(new->data.ap_records)));
     if(new->data.ap_records == NULL){
         ESP_LOGE(TAG, "Out of memory for fetching records");
         goto on_exit;
@@ -236,7 +754,7 @@ static void wifi_scan_done(void)
      * Scan data has either been fetched or lost at this point, so
      * clear flags irregardless of returned status.
      */
-    xEventGroupClearBits(wifi_events, (BIT_SCAN_RUNNING | BIT_SCAN_DONE));
+    xEventGroupClearBits(cfg_state->events, (BIT_SCAN_RUNNING | BIT_SCAN_DONE));
 
     if(result != ESP_OK){
         ESP_LOGE(TAG, "Error getting scan results");
@@ -244,24 +762,27 @@ static void wifi_scan_done(void)
     }
 
     ESP_LOGI(TAG, "Scan done: found %d APs", num_aps);
+    WMNGR_METRIC_ADD(scan_aps, new->data.num_records);
+    WMNGR_METRIC_SET(scan_last_aps, new->data.num_records);
 
-    /*
-     * Make new scan data available.
-     * The new data set will be assigned to the global pointer. Fetch
-     * another reference so it will not be freed on function exit.
-     */
-    kref_get(&(new->ref_cnt));
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+    /* Reveal hidden APs we have probed before right away. */
+    hidden = wmngr_hidden_merge(new->data.ap_records, new->data.num_records);
+#endif
 
-    old = cfg_state.scan_ref;
-    cfg_state.scan_ref = new;
+    scan_publish(cfg_state, new);
 
-    if(old != NULL){
-        /*
-         * Drop global reference to old data set so it will be freed
-         * when the last connection using it gets closed.
-         */
-        esp_wmngr_put_scan(&(old->data));
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+    if(xEventGroupGetBits(cfg_state->events) & BIT_CHAN_SELECT){
+        ap_chan_update(cfg_state);
+    }
+#endif
+
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+    if(hidden > 0){
+        hidden_scan_start(cfg_state, &(new->data));
     }
+#endif
 
 on_exit:
     /* Drop one reference to the new scan data. */
@@ -272,7 +793,7 @@ on_exit:
 
 /** Start AP scan.
  */
-static void wifi_scan_start(void)
+static void wifi_scan_start(struct wifi_cfg_state *cfg_state)
 {
     wifi_scan_config_t scan_cfg;
     EventBits_t events;
@@ -285,14 +806,14 @@ static void wifi_scan_start(void)
      * will be kept set and the scan will start once the WiFi config has
      * settled down again.
      */
-    if(cfg_state.state > wmngr_state_idle){
+    if(cfg_state->state > wmngr_state_idle){
         ESP_LOGI(TAG, "[%s] WiFi connecting, not starting scan.",
                  __func__);
         goto on_exit;
     }
 
     /* WiFi config is in a stable state, clear the SCAN_START bit. */
-    xEventGroupClearBits(wifi_events, BIT_SCAN_START);
+    xEventGroupClearBits(cfg_state->events, BIT_SCAN_START);
 
     /* Check that we are in a suitable mode for scanning. */
     result =  esp_wifi_get_mode(&mode);
@@ -306,7 +827,7 @@ static void wifi_scan_start(void)
         goto on_exit;
     }
 
-    events = xEventGroupGetBits(wifi_events);
+    events = xEventGroupGetBits(cfg_state->events);
 
     /* Finally, start a scan. Unless there is one running already. */
     if(!(events & (BIT_SCAN_RUNNING | BIT_SCAN_DONE))){
@@ -316,13 +837,20 @@ static void wifi_scan_start(void)
         scan_cfg.show_hidden = true;
         scan_cfg.scan_type = WIFI_SCAN_TYPE_ACTIVE;
 
-        xEventGroupSetBits(wifi_events, BIT_SCAN_START);
+        xEventGroupSetBits(cfg_state->events, BIT_SCAN_START);
+        cfg_state->scan_timestamp = xTaskGetTickCount();
         result = esp_wifi_scan_start(&scan_cfg, false);
+        WMNGR_TRACE_CALL(wmngr_site_scan_start, result);
         if(result == ESP_OK){
             ESP_LOGI(TAG, "[%s] Scan started.", __func__);
-            xEventGroupSetBits(wifi_events, BIT_SCAN_RUNNING);
+            WMNGR_METRIC_INC(scans_started);
+            xEventGroupSetBits(cfg_state->events, BIT_SCAN_RUNNING);
+            if(events & BIT_STA_CONNECTED){
+                WMNGR_TL_MARK(wmngr_tl_scan_start);
+            }
         } else {
             ESP_LOGE(TAG, "[%s] Starting AP scan failed.", __func__);
+            WMNGR_METRIC_INC(scans_failed);
         }
     } else {
         ESP_LOGI(TAG, "[%s] Scan aleady running.", __func__);
@@ -342,7 +870,7 @@ static esp_err_t get_saved_config(struct wifi_cfg *cfg)
 {
     nvs_handle handle;
     size_t len;
-    uint32_t tmp;
+    uint32_t version, tmp;
     esp_err_t result;
 
     result = ESP_OK;
@@ -355,13 +883,15 @@ static esp_err_t get_saved_config(struct wifi_cfg *cfg)
         return result;
     }
 
+    WMNGR_METRIC_INC(nvs_reads);
+
     /* Make sure we know how to handle the stored configuration. */
-    result = nvs_get_u32(handle, "version", &tmp);
+    result = nvs_get_u32(handle, "version", &version);
     if(result != ESP_OK){
         goto on_exit;
     }
 
-    if(tmp > NVS_CFG_VER){
+    if(version > NVS_CFG_VER){
         result = ESP_ERR_INVALID_VERSION;
         goto on_exit;
     }
@@ -385,6 +915,27 @@ static esp_err_t get_saved_config(struct wifi_cfg *cfg)
     }
     cfg->sta_connect = (bool) tmp;
 
+    /* Version 1 configs had no channel plan, keep the driver's default. */
+    if(version >= 2){
+        len = sizeof(cfg->country);
+        result = nvs_get_str(handle, "country", cfg->country, &len);
+        if(result != ESP_OK){
+            goto on_exit;
+        }
+
+        result = nvs_get_u32(handle, "chan_first", &tmp);
+        if(result != ESP_OK){
+            goto on_exit;
+        }
+        cfg->chan_first = (uint8_t) tmp;
+
+        result = nvs_get_u32(handle, "chan_num", &tmp);
+        if(result != ESP_OK){
+            goto on_exit;
+        }
+        cfg->chan_num = (uint8_t) tmp;
+    }
+
     /*
      * The esp-idf types are stored as binary blobs. This is problematic
      * because their memory layout and padding might change between esp-idf
@@ -530,6 +1081,21 @@ static esp_err_t save_config(struct wifi_cfg *cfg)
         goto on_exit;
     }
 
+    result = nvs_set_str(handle, "country", cfg->country);
+    if(result != ESP_OK){
+        goto on_exit;
+    }
+
+    result = nvs_set_u32(handle, "chan_first", cfg->chan_first);
+    if(result != ESP_OK){
+        goto on_exit;
+    }
+
+    result = nvs_set_u32(handle, "chan_num", cfg->chan_num);
+    if(result != ESP_OK){
+        goto on_exit;
+    }
+
     /* Store the esp-idf types as blobs. */
     /* FIXME: we should also store them component-wise. */
     result = nvs_set_blob(handle, "ap", &(cfg->ap), sizeof(cfg->ap));
@@ -560,6 +1126,14 @@ static esp_err_t save_config(struct wifi_cfg *cfg)
         goto on_exit;
     }
 
+    WMNGR_METRIC_INC(nvs_writes);
+    WMNGR_METRIC_ADD(nvs_bytes, 6 * sizeof(uint32_t)
+                                + strlen(cfg->country) + 1
+                                + sizeof(cfg->ap) + sizeof(cfg->sta)
+                                + sizeof(cfg->ap_ip_info)
+                                + sizeof(cfg->sta_ip_info)
+                                + sizeof(cfg->sta_dns_info));
+
 on_exit:
     if(result != ESP_OK){
         /* we do not want to leave a half-written config lying around. */
@@ -573,7 +1147,7 @@ on_exit:
     return result;
 }
 
-static esp_err_t load_config(void)
+static esp_err_t load_config(struct wifi_cfg_state *cfg_state)
 {
     esp_err_t result;
 
@@ -581,80 +1155,155 @@ static esp_err_t load_config(void)
      * Restore saved WiFi config or fall back to compiled-in defaults.
      * Setting state to update will trigger applying this config.
      */
-    result = get_saved_config(&cfg_state.new);
+    result = get_saved_config(&cfg_state->new);
     if(result != ESP_OK){
         ESP_LOGI(TAG, "[%s] No saved config found, setting defaults",
                  __func__);
-        set_defaults(&cfg_state.new);
+        set_defaults(&cfg_state->new);
     }
 
     /* Any config read from NVS or restored from defaults should be valid. */
-    cfg_state.new.is_valid = true;
+    cfg_state->new.is_valid = true;
 
     /* Make sure we do not fall back to defaults if configured AP is down. */
-    memcpy(&cfg_state.saved, &cfg_state.new, sizeof(cfg_state.saved));
-    memcpy(&cfg_state.current, &cfg_state.new, sizeof(cfg_state.current));
+    memcpy(&cfg_state->saved, &cfg_state->new, sizeof(cfg_state->saved));
+    memcpy(&cfg_state->current, &cfg_state->new, sizeof(cfg_state->current));
+    cfg_publish(cfg_state);
 
     return ESP_OK;
 }
 
 /* Helper function to check if WiFi is connected in station mode. */
-static bool sta_connected(void)
+static bool sta_connected(struct wifi_cfg_state *cfg_state)
 {
     EventBits_t events;
 
-    events = xEventGroupGetBits(wifi_events);
+    events = xEventGroupGetBits(cfg_state->events);
 
     return !!(events & BIT_STA_CONNECTED);
 }
 
+/*
+ * Parts of the driver's config that applying cfg has to touch. Restoring
+ * the driver defaults or setting the STA config flushes the supplicant's
+ * PMK cache, so a reconnect needs the full 4-way handshake or SAE
+ * exchange. If we know what the driver is running, only touch the parts
+ * that actually changed, or at least those a partial update asked for.
+ */
+static uint32_t cfg_changes(struct wifi_cfg_state *cfg_state,
+                            const struct wifi_cfg *cfg)
+{
+    if(!cfg_state->drv_synced){
+        return WMNGR_CFG_ALL;
+    }
+
+#if defined(CONFIG_WMNGR_FAST_RECONNECT)
+    return wmngr_cfg_diff(cfg, &cfg_state->current);
+#else
+    return (cfg_state->update_mask != 0) ? cfg_state->update_mask
+                                        : WMNGR_CFG_ALL;
+#endif
+}
+
 /* Helper function to set WiFi configuration from struct wifi_cfg. */
-static esp_err_t set_wifi_cfg(struct wifi_cfg *cfg)
+static esp_err_t set_wifi_cfg(struct wifi_cfg_state *cfg_state,
+                              struct wifi_cfg *cfg)
 {
+    wifi_config_t ap_cfg, sta_cfg;
+    uint32_t changes;
     unsigned int idx;
     esp_err_t result;
 
     ESP_LOGD(TAG, "[%s] Called.", __FUNCTION__);
+    WMNGR_TL_MARK(wmngr_tl_cfg_begin);
 
     /*
-     * FIXME: we should check for errors. OTOH, this is also used
-     *        for the fall-back mechanism, so aborting on error is
-     *        probably a bad idea.
+     * Errors applying the AP or STA config abort the update and leave
+     * drv_synced cleared, so the caller can fall back. Other errors are
+     * only logged.
      */
 
-    memmove(&cfg_state.current, cfg, sizeof(*cfg));
+    cfg->ap.ap.max_connection = WMNGR_AP_MAX_CLIENTS(MAX_AP_CLIENTS);
 
-    result = esp_wifi_restore();
-    if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] esp_wifi_restore(): %d %s",
-                 __func__, result, esp_err_to_name(result));
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+    /* Let the driver match the current config again before comparing. */
+    ap_auto_on(cfg_state, xTaskGetTickCount());
+#endif
+
+    changes = cfg_changes(cfg_state, cfg);
+    cfg_state->update_mask = 0;
+
+#if defined(CONFIG_WMNGR_TUNER)
+    if(wmngr_cfg_diff(cfg, &cfg_state->current) & WMNGR_CFG_STA){
+        WMNGR_TUNE_NEW_AP(NULL);
     }
+#endif
 
-    result = esp_wifi_set_mode(cfg->mode);
-    if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] esp_wifi_set_mode(): %d %s",
-                 __func__, result, esp_err_to_name(result));
+    memmove(&cfg_state->current, cfg, sizeof(*cfg));
+    cfg_publish(cfg_state);
+    cfg_state->drv_synced = false;
+    cfg_state->connect_fast = false;
+
+    if(changes == WMNGR_CFG_ALL){
+        result = esp_wifi_restore();
+        WMNGR_TRACE_CALL(wmngr_site_restore, result);
+        if(result != ESP_OK){
+            ESP_LOGE(TAG, "[%s] esp_wifi_restore(): %d %s",
+                     __func__, result, esp_err_to_name(result));
+        }
+        WMNGR_TUNE_RESTORED();
     }
 
-    if(cfg->mode == WIFI_MODE_APSTA || cfg->mode == WIFI_MODE_AP){
-        cfg->ap.ap.max_connection = MAX_AP_CLIENTS;
-        result = esp_wifi_set_config(WIFI_IF_AP, &(cfg->ap));
+    if(changes & WMNGR_CFG_MODE){
+        result = esp_wifi_set_mode(cfg->mode);
+        WMNGR_TRACE_CALL(wmngr_site_set_mode, result);
         if(result != ESP_OK){
-            ESP_LOGE(TAG, "[%s] esp_wifi_set_config() AP: %d %s",
+            ESP_LOGE(TAG, "[%s] esp_wifi_set_mode(): %d %s",
                      __func__, result, esp_err_to_name(result));
         }
     }
 
-    if(cfg->mode == WIFI_MODE_APSTA || cfg->mode == WIFI_MODE_STA){
-        result = esp_wifi_set_config(WIFI_IF_STA, &(cfg->sta));
+    if(changes & WMNGR_CFG_COUNTRY){
+        (void) set_country(cfg);
+    }
+
+    if((changes & (WMNGR_CFG_MODE | WMNGR_CFG_AP | WMNGR_CFG_COUNTRY))
+       && (cfg->mode == WIFI_MODE_APSTA || cfg->mode == WIFI_MODE_AP))
+    {
+        memcpy(&ap_cfg, &(cfg->ap), sizeof(ap_cfg));
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+        ap_chan_select(cfg_state, cfg, &(ap_cfg.ap));
+#endif
+        ap_chan_clip(&(ap_cfg.ap));
+        result = esp_wifi_set_config(WIFI_IF_AP, &ap_cfg);
+        WMNGR_TRACE_CALL(wmngr_site_set_ap, result);
         if(result != ESP_OK){
-            ESP_LOGE(TAG, "[%s] esp_wifi_set_config() STA: %d %s",
+            ESP_LOGE(TAG, "[%s] esp_wifi_set_config() AP: %d %s",
                      __func__, result, esp_err_to_name(result));
+            goto on_exit;
+        }
+    }
+
+    if(cfg->mode == WIFI_MODE_APSTA || cfg->mode == WIFI_MODE_STA){
+        cfg_state->connect_fast = !(changes & (WMNGR_CFG_MODE | WMNGR_CFG_STA));
+        if(!cfg_state->connect_fast){
+            memcpy(&sta_cfg, &(cfg->sta), sizeof(sta_cfg));
+            WMNGR_ROAM_PREPARE_STA(&(sta_cfg.sta));
+            WMNGR_HIDDEN_PREPARE_STA(&(sta_cfg.sta));
+            result = esp_wifi_set_config(WIFI_IF_STA, &sta_cfg);
+            WMNGR_TRACE_CALL(wmngr_site_set_sta, result);
+            if(result != ESP_OK){
+                ESP_LOGE(TAG, "[%s] esp_wifi_set_config() STA: %d %s",
+                         __func__, result, esp_err_to_name(result));
+                goto on_exit;
+            }
         }
         if(cfg->sta_static){
-            (void) esp_netif_dhcpc_stop(sta_netif);
+            (void) esp_netif_dhcpc_stop(cfg_state->sta_netif);
 
-            result = esp_netif_set_ip_info(sta_netif, &cfg->sta_ip_info);
+            result = esp_netif_set_ip_info(cfg_state->sta_netif,
+                                           &cfg->sta_ip_info);
+            WMNGR_TRACE_CALL(wmngr_site_set_ip, result);
             if(result != ESP_OK){
                 ESP_LOGE(TAG, "[%s] esp_netif_set_ip_info() STA: %d %s",
                         __func__, result, esp_err_to_name(result));
@@ -665,7 +1314,7 @@ static esp_err_t set_wifi_cfg(struct wifi_cfg *cfg)
                     continue;
                 }
 
-                result = esp_netif_set_dns_info(sta_netif,
+                result = esp_netif_set_dns_info(cfg_state->sta_netif,
                                                 idx,
                                                 &(cfg->sta_dns_info[idx]));
                 if(result != ESP_OK){
@@ -674,92 +1323,131 @@ static esp_err_t set_wifi_cfg(struct wifi_cfg *cfg)
                 }
             }
         } else {
-            (void) esp_netif_dhcpc_start(sta_netif);
+            (void) esp_netif_dhcpc_start(cfg_state->sta_netif);
         }
     }
 
     result = esp_wifi_start();
+    WMNGR_TRACE_CALL(wmngr_site_wifi_start, result);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] esp_wifi_start(): %d %s",
                  __func__, result, esp_err_to_name(result));
+        goto on_exit;
+    }
+    WMNGR_TL_MARK(wmngr_tl_wifi_start);
+
+    cfg_state->drv_synced = true;
+
+    if(!cfg->sta_connect && (changes & WMNGR_CFG_STA_CONNECT)){
+        (void) esp_wifi_disconnect();
     }
 
     if(cfg->sta_connect
-       && (   cfg->mode == WIFI_MODE_STA
-           || cfg->mode == WIFI_MODE_APSTA))
+       && cfg_state->connect_fast
+       && (xEventGroupGetBits(cfg_state->events) & BIT_STA_CONNECTED))
     {
+        /* Config did not touch the STA, keep the existing connection. */
+        ESP_LOGD(TAG, "[%s] STA still connected.", __func__);
+    } else if(cfg->sta_connect
+              && (   cfg->mode == WIFI_MODE_STA
+                  || cfg->mode == WIFI_MODE_APSTA))
+    {
+        WMNGR_TUNE_PREPARE();
+        cfg_state->connect_timestamp = xTaskGetTickCount();
+        cfg_state->connect_pending = true;
         result = esp_wifi_connect();
+        WMNGR_TRACE_CALL(wmngr_site_connect, result);
         if(result != ESP_OK){
             ESP_LOGE(TAG, "[%s] esp_wifi_connect(): %d %s",
                      __func__, result, esp_err_to_name(result));
         }
     }
 
+on_exit:
+    WMNGR_TL_MARK(wmngr_tl_cfg_end);
+
+    if(result != ESP_OK){
+        wmngr_status_error(result);
+    }
+
     return result;
 }
 
 static bool cfgs_are_equal(struct wifi_cfg *a, struct wifi_cfg *b)
 {
-    unsigned int idx;
-    bool result;
-
-    result = false;
-
-    /*
-     * Do some naive checks to see if the new configuration is an actual
-     * change. Should be more thorough by actually comparing the elements.
-     */
-    if(a->mode != b->mode){
-        goto on_exit;
-    }
-
-    if(a->mode == WIFI_MODE_AP || a->mode == WIFI_MODE_APSTA){
-        if(!ip4_addr_cmp(&(a->ap_ip_info.ip), &(b->ap_ip_info.ip))){
-            goto on_exit;
-        }
-
-        if(memcmp(&(a->ap), &(b->ap), sizeof(a->ap))){
-            goto on_exit;
-        }
-    }
+    return wmngr_cfg_diff(a, b) == 0;
+}
 
-    if((a->mode == WIFI_MODE_STA || a->mode == WIFI_MODE_APSTA)
-       && memcmp(&(a->sta), &(b->sta), sizeof(a->sta)))
-    {
-        goto on_exit;
-    }
+/* Check the parts of a config the driver does not check for us. */
+static bool cfg_valid(const struct wifi_cfg *cfg)
+{
+    return strnlen(cfg->country, sizeof(cfg->country)) != 1
+           && cfg->country[sizeof(cfg->country) - 1] == '\0'
+           && cfg->chan_first <= WMNGR_CHAN_NUM
+           && (cfg->chan_first == 0 || cfg->chan_num != 0)
+           && cfg->chan_first + cfg->chan_num <= WMNGR_CHAN_NUM + 1;
+}
 
-    if(a->sta_connect != b->sta_connect){
-        goto on_exit;
-    }
+/*
+ * Queue a config to be applied. Mask holds the parts that differ from the
+ * current config if known, 0 otherwise. Caller must hold the lock and
+ * have made sure we are in a stable state.
+ */
+static esp_err_t queue_cfg(struct wifi_cfg_state *cfg_state,
+                           const struct wifi_cfg *new, uint32_t mask)
+{
+    esp_err_t result;
 
-    if(a->sta_static != b->sta_static){
+    /* Save current configuration for fall-back. */
+    result = get_wifi_cfg(cfg_state, &(cfg_state->saved));
+    if(result != ESP_OK){
+        ESP_LOGI(TAG, "[%s] Error fetching current WiFi config.",
+                 __func__);
         goto on_exit;
     }
 
-    if(a->sta_static){
-        if(!ip4_addr_cmp(&(a->sta_ip_info.ip), &(b->sta_ip_info.ip))){
-            goto on_exit;
-        }
-
-        if(!ip4_addr_cmp(&(a->sta_ip_info.netmask), &(b->sta_ip_info.netmask))){
-            goto on_exit;
-        }
-
-        if(!ip4_addr_cmp(&(a->sta_ip_info.gw), &(b->sta_ip_info.gw))){
-            goto on_exit;
+    /*
+     * Always save new config if WiFi Manager is stopped or the caller
+     * told us what changed. Otherwise check first if it is an actual
+     * configuration change.
+     */
+    if(cfg_state->state == wmngr_state_stopped
+       || mask != 0
+       || !cfgs_are_equal((struct wifi_cfg *) new, &(cfg_state->saved)))
+    {
+        memmove(&(cfg_state->new), new, sizeof(cfg_state->new));
+        cfg_state->new.is_default = false;
+        cfg_state->new.is_valid = false;
+        /*
+         * A config set while stopped may not have been applied yet, so
+         * the parts to touch are all that differ from what is running.
+         */
+        cfg_state->update_mask = 0;
+        if(mask != 0){
+            cfg_state->update_mask = mask
+                                     | wmngr_cfg_diff(new, &cfg_state->current);
         }
 
-        for(idx = 0; idx < ARRAY_SIZE(a->sta_dns_info); ++idx){
-            if(!ip_addr_cmp(&(a->sta_dns_info[idx].ip),
-                            &(b->sta_dns_info[idx].ip)))
+        /*
+         * Trigger an asynchronous update if WiFi Manager is not currently
+         * stopped. Otherwise it will be applied once #esp_wmngr_start()
+         * gets called.
+         * This gives the httpd some time to send out the reply before possibly
+         * tearing down the connection.
+         */
+        if(cfg_state->state != wmngr_state_stopped){
+            set_state(cfg_state, wmngr_state_update);
+            if(xTimerChangePeriod(cfg_state->timer, CFG_DELAY, CFG_DELAY)
+               != pdPASS)
             {
+                set_state(cfg_state, wmngr_state_failed);
+                result = ESP_ERR_TIMEOUT;
                 goto on_exit;
             }
         }
     }
 
-    result = true;
+    result = ESP_OK;
 
 on_exit:
     return result;
@@ -769,7 +1457,8 @@ on_exit:
  * Helper to fetch current WiFi configuration from the system and store it in
  * a wifi_cfg struct.
  */
-static esp_err_t get_wifi_cfg(struct wifi_cfg *cfg)
+static esp_err_t get_wifi_cfg(struct wifi_cfg_state *cfg_state,
+                              struct wifi_cfg *cfg)
 {
     esp_netif_dhcp_status_t dhcp_status;
     unsigned int idx;
@@ -781,25 +1470,56 @@ static esp_err_t get_wifi_cfg(struct wifi_cfg *cfg)
     /*
      * Unless we are currently connected, we can not know for sure if
      * esp_wifi_connect() has been called. If we are not connected, we just
-     * take the value from cfg_state.current.
+     * take the value from cfg_state->current.
      */
-    if(sta_connected() || cfg_state.current.sta_connect){
+    if(sta_connected(cfg_state) || cfg_state->current.sta_connect){
         cfg->sta_connect = true;
     }
 
+    /* The driver reports the clipped plan, take what we asked for. */
+    memcpy(cfg->country, cfg_state->current.country, sizeof(cfg->country));
+    cfg->chan_first = cfg_state->current.chan_first;
+    cfg->chan_num = cfg_state->current.chan_num;
+
     result = esp_wifi_get_mode(&(cfg->mode));
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] Error fetching WiFi mode.", __func__);
         goto on_exit;
     }
 
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+    /*
+     * The driver runs in STA mode while the AP is switched off. Falling
+     * back to that would leave the device without its AP for good.
+     */
+    if(cfg_state->ap_off){
+        cfg->mode = cfg_state->current.mode;
+    }
+#endif
+
     result = esp_wifi_get_config(WIFI_IF_STA, &(cfg->sta));
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] Error fetching STA config.", __func__);
         goto on_exit;
     }
 
-    result = esp_netif_dhcpc_get_status(sta_netif, &dhcp_status);
+    /*
+     * Roaming and hidden SSID probing pin BSSID, channel and scan method
+     * and the roaming options only get enabled in the driver's copy of
+     * the STA config.
+     * Report them as the manager set them, or a fall-back would keep the
+     * pin forever and save it to the NVS.
+     */
+    cfg->sta.sta.bssid_set = cfg_state->current.sta.sta.bssid_set;
+    memcpy(cfg->sta.sta.bssid, cfg_state->current.sta.sta.bssid,
+           sizeof(cfg->sta.sta.bssid));
+    cfg->sta.sta.channel = cfg_state->current.sta.sta.channel;
+    cfg->sta.sta.scan_method = cfg_state->current.sta.sta.scan_method;
+    cfg->sta.sta.rm_enabled = cfg_state->current.sta.sta.rm_enabled;
+    cfg->sta.sta.btm_enabled = cfg_state->current.sta.sta.btm_enabled;
+    cfg->sta.sta.ft_enabled = cfg_state->current.sta.sta.ft_enabled;
+
+    result = esp_netif_dhcpc_get_status(cfg_state->sta_netif, &dhcp_status);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] Error fetching DHCP status.", __func__);
         goto on_exit;
@@ -808,7 +1528,7 @@ static esp_err_t get_wifi_cfg(struct wifi_cfg *cfg)
     if(dhcp_status == ESP_NETIF_DHCP_STOPPED){
         cfg->sta_static = 1;
 
-        result = esp_netif_get_ip_info(sta_netif, &cfg->sta_ip_info);
+        result = esp_netif_get_ip_info(cfg_state->sta_netif, &cfg->sta_ip_info);
         if(result != ESP_OK){
             ESP_LOGE(TAG, "[%s] esp_netif_get_ip_info() STA: %d %s",
                     __func__, result, esp_err_to_name(result));
@@ -816,7 +1536,7 @@ static esp_err_t get_wifi_cfg(struct wifi_cfg *cfg)
         }
 
         for(idx = 0; idx < ARRAY_SIZE(cfg->sta_dns_info); ++idx){
-            result = esp_netif_get_dns_info(sta_netif,
+            result = esp_netif_get_dns_info(cfg_state->sta_netif,
                                             idx,
                                             &(cfg->sta_dns_info[idx]));
             if(result != ESP_OK){
@@ -834,58 +1554,455 @@ static esp_err_t get_wifi_cfg(struct wifi_cfg *cfg)
         goto on_exit;
     }
 
-    result = esp_netif_get_ip_info(ap_netif, &cfg->ap_ip_info);
-    if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] esp_netif_get_ip_info() AP: %d %s",
-                __func__, result, esp_err_to_name(result));
-        goto on_exit;
+    result = esp_netif_get_ip_info(cfg_state->ap_netif, &cfg->ap_ip_info);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] esp_netif_get_ip_info() AP: %d %s",
+                __func__, result, esp_err_to_name(result));
+        goto on_exit;
+    }
+
+    cfg->is_valid = true;
+
+on_exit:
+    return result;
+}
+
+/* Patch the current config and queue it, see #esp_wmngr_update_cfg_ex. */
+static esp_err_t update_cfg(struct wifi_cfg_state *cfg_state,
+                            const struct wifi_cfg *patch,
+                            uint32_t field_mask, TickType_t timeout)
+{
+    struct wifi_cfg cfg;
+    const struct wifi_cfg *base;
+    uint32_t parts;
+    esp_err_t result;
+
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
+
+    if(patch == NULL || field_mask == 0
+       || (field_mask & ~WMNGR_CFG_FIELDS))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_update_cfg)
+       != pdTRUE)
+    {
+        ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    if(cfg_state->state > wmngr_state_idle){
+        ESP_LOGI(TAG, "[%s] WiFi change in progress.", __func__);
+        result = ESP_ERR_INVALID_STATE;
+        goto on_exit;
+    }
+
+    /* While stopped, the last config set has not been applied yet. */
+    base = (cfg_state->state == wmngr_state_stopped) ? &cfg_state->new
+                                                      : &cfg_state->current;
+    memcpy(&cfg, base, sizeof(cfg));
+    parts = wmngr_cfg_patch(&cfg, patch, field_mask);
+
+    if(!cfg_valid(&cfg)){
+        ESP_LOGE(TAG, "[%s] Invalid country or channel plan.", __func__);
+        result = ESP_ERR_INVALID_ARG;
+        goto on_exit;
+    }
+
+    if(!memcmp(&cfg, base, sizeof(cfg))){
+        result = ESP_OK;
+        goto on_exit;
+    }
+
+    result = queue_cfg(cfg_state, &cfg, parts);
+
+on_exit:
+    WMNGR_LOCK_GIVE(cfg_state->lock);
+    return result;
+}
+
+/* Helper function to update the STA connect setting of the current config */
+static esp_err_t set_connect(struct wifi_cfg_state *cfg_state,
+                             bool connect, TickType_t timeout)
+{
+    struct cfg_data_ref *ref;
+    struct wifi_cfg patch;
+    EventBits_t events;
+    wifi_mode_t mode;
+    esp_err_t result;
+
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
+
+    /* Abort if wifi manager has been stopped. */
+    events = xEventGroupGetBits(cfg_state->events);
+    if(events & BIT_STOPPED){
+        result = ESP_ERR_INVALID_STATE;
+        goto on_exit;
+    }
+
+    portENTER_CRITICAL(&cfg_state->cfg_ref_lock);
+    ref = cfg_state->cfg_ref;
+    mode = (ref != NULL) ? ref->cfg.mode : WIFI_MODE_NULL;
+    portEXIT_CRITICAL(&cfg_state->cfg_ref_lock);
+
+    if(ref == NULL){
+        result = ESP_ERR_INVALID_STATE;
+        goto on_exit;
+    }
+
+    if(mode != WIFI_MODE_APSTA && mode != WIFI_MODE_STA){
+        result = ESP_ERR_INVALID_STATE;
+        goto on_exit;
+    }
+
+    memset(&patch, 0x0, sizeof(patch));
+    patch.sta_connect = connect;
+
+    result = update_cfg(cfg_state, &patch, WMNGR_CFG_STA_CONNECT, timeout);
+
+on_exit:
+    return result;
+}
+
+#if defined(CONFIG_WMNGR_ROAMING)
+/*
+ * Called by the roaming policy when the link has been weak for a while
+ * and when a neighbor report arrives. Runs in the link monitor's timer
+ * callback or the supplicant task, so must not block.
+ */
+static void roam_trigger(void *arg)
+{
+    struct wifi_cfg_state *cfg_state = arg;
+
+    xEventGroupSetBits(cfg_state->events, BIT_ROAM);
+#if defined(CONFIG_WMNGR_TASK)
+    xEventGroupSetBits(cfg_state->events, BIT_TRIGGER);
+#else
+    (void) xTimerChangePeriod(cfg_state->timer, CFG_DELAY, 0);
+#endif
+}
+
+/*
+ * Start a scan for APs with the current SSID, limited to the next
+ * channel from the neighbor report if we got one.
+ */
+static esp_err_t roam_scan_start(struct wifi_cfg_state *cfg_state)
+{
+    struct wmngr_roam_ctx *ctx;
+    wifi_scan_config_t scan_cfg;
+    esp_err_t result;
+
+    ctx = &cfg_state->roam;
+
+    memset(&scan_cfg, 0x0, sizeof(scan_cfg));
+    scan_cfg.ssid = cfg_state->current.sta.sta.ssid;
+    scan_cfg.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+    if(ctx->chan_idx < ctx->num_chans){
+        scan_cfg.channel = ctx->chans[ctx->chan_idx];
+    }
+
+    cfg_state->scan_timestamp = xTaskGetTickCount();
+    result = esp_wifi_scan_start(&scan_cfg, false);
+    WMNGR_TRACE_CALL(wmngr_site_scan_start, result);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Starting roaming scan failed.", __func__);
+        WMNGR_METRIC_INC(scans_failed);
+        return result;
+    }
+
+    WMNGR_METRIC_INC(scans_started);
+    xEventGroupSetBits(cfg_state->events, BIT_SCAN_RUNNING);
+
+    return ESP_OK;
+}
+
+/*
+ * Merge the results of a roaming scan into the candidates. We fetch
+ * them ourselves, so they are not published as scan data.
+ */
+static void roam_scan_collect(struct wifi_cfg_state *cfg_state)
+{
+    wifi_ap_record_t *recs;
+    uint16_t num;
+
+    recs = NULL;
+    if(esp_wifi_scan_get_ap_num(&num) != ESP_OK || num == 0){
+        goto on_exit;
+    }
+
+    num = MIN(num, MAX_NUM_APS);
+    recs = WMNGR_CALLOC(scan, num, sizeof(*recs));
+    if(recs == NULL){
+        goto on_exit;
+    }
+
+    if(esp_wifi_scan_get_ap_records(&num, recs) == ESP_OK){
+        wmngr_roam_collect(&cfg_state->roam, recs, num);
+    }
+
+on_exit:
+    xEventGroupClearBits(cfg_state->events, (BIT_SCAN_RUNNING | BIT_SCAN_DONE));
+    WMNGR_FREE(recs);
+}
+
+/*
+ * Reassociate to the chosen AP. If the AP supports BSS transition
+ * management, ask it to move us first. The supplicant then keeps its
+ * state and can use an 802.11r fast transition. Otherwise pin the BSSID
+ * in the driver's STA config, which means a full reconnect. The manager's
+ * current config stays untouched, so the next regular reconnect lets the
+ * driver choose freely again.
+ */
+static esp_err_t roam_reassociate(struct wifi_cfg_state *cfg_state,
+                                  bool query)
+{
+    struct wmngr_roam_ctx *ctx;
+    wifi_ap_record_t *best;
+    wifi_config_t sta_cfg;
+    esp_err_t result;
+
+    ctx = &cfg_state->roam;
+    best = &ctx->best;
+
+    if(query && wmngr_roam_request_transition() == ESP_OK){
+        ESP_LOGI(TAG, "[%s] Asked AP for a transition.", __func__);
+        ctx->flags |= WMNGR_ROAM_QUERY;
+        return ESP_OK;
+    }
+
+    ctx->flags &= ~WMNGR_ROAM_QUERY;
+
+    ESP_LOGI(TAG, "[%s] Roaming to %02x:%02x:%02x:%02x:%02x:%02x on "
+                  "channel %u at %d dBm.", __func__,
+             best->bssid[0], best->bssid[1], best->bssid[2],
+             best->bssid[3], best->bssid[4], best->bssid[5],
+             best->primary, best->rssi);
+
+    memcpy(&sta_cfg, &cfg_state->current.sta, sizeof(sta_cfg));
+    WMNGR_ROAM_PREPARE_STA(&sta_cfg.sta);
+    sta_cfg.sta.bssid_set = true;
+    memcpy(sta_cfg.sta.bssid, best->bssid, sizeof(sta_cfg.sta.bssid));
+    sta_cfg.sta.channel = best->primary;
+
+    (void) esp_wifi_disconnect();
+    xEventGroupClearBits(cfg_state->events, BIT_STA_CONNECTED | BIT_STA_GOT_IP);
+
+    cfg_state->drv_synced = false;
+    result = esp_wifi_set_config(WIFI_IF_STA, &sta_cfg);
+    WMNGR_TRACE_CALL(wmngr_site_set_sta, result);
+    if(result == ESP_OK){
+        WMNGR_TUNE_PREPARE();
+        result = esp_wifi_connect();
+        WMNGR_TRACE_CALL(wmngr_site_connect, result);
+    }
+
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Reassociation failed: %s",
+                 __func__, esp_err_to_name(result));
+    }
+
+    return result;
+}
+
+/*
+ * Start roaming away from the current AP. Prefers asking the AP for its
+ * neighbors over scanning all channels. Returns false if roaming is not
+ * possible right now.
+ */
+static bool roam_begin(struct wifi_cfg_state *cfg_state, TickType_t now)
+{
+    struct wmngr_roam_ctx *ctx;
+    wifi_ap_record_t ap_info;
+    EventBits_t events;
+
+    ctx = &cfg_state->roam;
+
+    /* Do not interfere with a user triggered scan. */
+    events = xEventGroupGetBits(cfg_state->events);
+    if(events & (BIT_SCAN_START | BIT_SCAN_RUNNING | BIT_SCAN_DONE)){
+        ESP_LOGI(TAG, "[%s] Scan pending, not roaming.", __func__);
+        return false;
+    }
+
+    if(esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK){
+        return false;
+    }
+
+    memset(ctx, 0x0, sizeof(*ctx));
+    ctx->start = now;
+    memcpy(ctx->cur_bssid, ap_info.bssid, sizeof(ctx->cur_bssid));
+    ctx->cur_rssi = ap_info.rssi;
+
+    if(wmngr_roam_request_neighbors() == ESP_OK){
+        ctx->phase = wmngr_roam_neighbors;
+    } else if(roam_scan_start(cfg_state) == ESP_OK){
+        ctx->phase = wmngr_roam_scan;
+    } else {
+        return false;
     }
 
-    cfg->is_valid = true;
+    set_state(cfg_state, wmngr_state_roaming);
 
-on_exit:
-    return result;
+    return true;
 }
 
-/* Helper function to update the STA connect setting of the current config */
-static esp_err_t set_connect(bool connect)
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+/*
+ * The link went down while connected. With BSS transition management
+ * enabled this may be the supplicant following a transition request
+ * from the AP, so give it a moment to reconnect before re-applying
+ * the config.
+ */
+static void roam_btm_begin(struct wifi_cfg_state *cfg_state, TickType_t now)
 {
-    struct wifi_cfg cfg;
-    EventBits_t events;
-    esp_err_t result;
+    struct wmngr_roam_ctx *ctx;
+    struct wmngr_link_stats link;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    ctx = &cfg_state->roam;
 
-    /* Abort if wifi manager has been stopped. */
-    events = xEventGroupGetBits(wifi_events);
-    if(events & BIT_STOPPED){
-        result = ESP_ERR_INVALID_STATE;
-        goto on_exit;
-    }
+    memset(ctx, 0x0, sizeof(*ctx));
+    ctx->start = now;
+    ctx->phase = wmngr_roam_btm;
+    ctx->flags = WMNGR_ROAM_BTM;
 
-    result = esp_wmngr_get_cfg(&cfg);
-    if(result != ESP_OK){
-        goto on_exit;
+    if(esp_wmngr_get_link_stats(&link) == ESP_OK){
+        ctx->cur_rssi = link.rssi_last;
     }
 
-    if(cfg.mode != WIFI_MODE_APSTA && cfg.mode != WIFI_MODE_STA){
-        result = ESP_ERR_INVALID_STATE;
-        goto on_exit;
+    set_state(cfg_state, wmngr_state_roaming);
+}
+#endif
+
+/* State machine part for wmngr_state_roaming, returns the timer delay. */
+static TickType_t handle_roaming(struct wifi_cfg_state *cfg_state,
+                                 EventBits_t events, bool connected,
+                                 TickType_t now)
+{
+    struct wmngr_roam_ctx *ctx;
+    wifi_ap_record_t ap_info;
+    bool timeout;
+    uint32_t ms;
+    int num;
+
+    ctx = &cfg_state->roam;
+    ms = (now - ctx->start) * portTICK_PERIOD_MS;
+    timeout = time_after(now, ctx->start + CFG_TIMEOUT);
+
+    switch(ctx->phase){
+    case wmngr_roam_neighbors:
+        num = wmngr_roam_get_neighbors(ctx->chans, ARRAY_SIZE(ctx->chans));
+        if(num < 0 && !time_after(now, ctx->start + ROAM_NR_TIMEOUT)){
+            return CFG_DELAY;
+        }
+
+        /* Scan the neighbors' channels, all channels if there are none. */
+        if(num > 0){
+            ctx->num_chans = num;
+            ctx->flags |= WMNGR_ROAM_NEIGHBOR;
+        }
+
+        if(roam_scan_start(cfg_state) == ESP_OK){
+            ctx->phase = wmngr_roam_scan;
+            return CFG_TICKS;
+        }
+
+        wmngr_roam_done(ctx, false, 0, ms);
+        break;
+    case wmngr_roam_scan:
+        if(events & BIT_SCAN_DONE){
+            roam_scan_collect(cfg_state);
+
+            if(++ctx->chan_idx < ctx->num_chans
+               && roam_scan_start(cfg_state) == ESP_OK)
+            {
+                return CFG_TICKS;
+            }
+
+            if(wmngr_roam_pick(ctx)){
+                if(roam_reassociate(cfg_state, true) == ESP_OK){
+                    ctx->reassoc_start = now;
+                    ctx->phase = wmngr_roam_reassoc;
+                    return CFG_TICKS;
+                }
+                wmngr_roam_done(ctx, false, 0, ms);
+            }
+        } else if(timeout){
+            ESP_LOGW(TAG, "[%s] Roaming scan timed out.", __func__);
+            (void) esp_wifi_scan_stop();
+            xEventGroupClearBits(cfg_state->events,
+                                 (BIT_SCAN_RUNNING | BIT_SCAN_DONE));
+            wmngr_roam_done(ctx, false, 0, ms);
+        } else {
+            return CFG_TICKS;
+        }
+        break;
+    case wmngr_roam_reassoc:
+    case wmngr_roam_btm:
+        if(connected && esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK){
+            memset(&ap_info, 0x0, sizeof(ap_info));
+        }
+
+        /* Still on the old AP, it ignored our query. Move by ourselves. */
+        if(connected && (ctx->flags & WMNGR_ROAM_QUERY)
+           && !memcmp(ap_info.bssid, ctx->cur_bssid, sizeof(ctx->cur_bssid)))
+        {
+            if(!time_after(now, ctx->reassoc_start + ROAM_QUERY_TIMEOUT)){
+                return CFG_DELAY;
+            }
+
+            ESP_LOGI(TAG, "[%s] No transition from AP.", __func__);
+            if(roam_reassociate(cfg_state, false) == ESP_OK){
+                ctx->reassoc_start = now;
+                return CFG_DELAY;
+            }
+            wmngr_roam_done(ctx, false, 0, ms);
+            connected = sta_connected(cfg_state);
+        } else if(connected){
+            /* The AP may have sent us somewhere else than our pick. */
+            if(ctx->flags & WMNGR_ROAM_QUERY){
+                ctx->best.primary = ap_info.primary;
+            }
+
+            ESP_LOGI(TAG, "[%s] Roamed in %" PRIu32 " ms.", __func__, ms);
+            wmngr_roam_done(ctx, true, ap_info.rssi, ms);
+        } else if(ctx->phase == wmngr_roam_reassoc
+                  && time_after(now, ctx->reassoc_start + ROAM_TIMEOUT))
+        {
+            /* New AP did not work out, re-apply the unpinned config. */
+            ESP_LOGW(TAG, "[%s] Reassociation timed out.", __func__);
+            wmngr_roam_done(ctx, false, 0, ms);
+        } else if(ctx->phase == wmngr_roam_btm
+                  && time_after(now, ctx->start + ROAM_BTM_GRACE))
+        {
+            ESP_LOGI(TAG, "[%s] No transition, connection lost.", __func__);
+        } else {
+            return CFG_DELAY;
+        }
+        break;
     }
 
-    cfg.sta_connect = connect;
+    /* Leaving the roaming state. */
+    if(connected){
+        set_state(cfg_state, wmngr_state_connected);
+        return 0;
+    }
 
-    result = esp_wmngr_set_cfg(&cfg);
+    ESP_LOGI(TAG, "[%s] Connection to AP lost, retrying.", __func__);
+    WMNGR_METRIC_INC(reconnects);
+    memcpy(&cfg_state->new, &cfg_state->current, sizeof(cfg_state->new));
+    set_state(cfg_state, wmngr_state_update);
 
-on_exit:
-    return result;
+    return CFG_DELAY;
 }
+#endif /* defined(CONFIG_WMNGR_ROAMING) */
 
 /*
- * This function is called from the config_timer and handles all WiFi
- * configuration changes. It takes its information from the global
- * cfg_state struct and tries to set the WiFi configuration to the one
+ * This function is called from the config timer and handles all WiFi
+ * configuration changes. It takes its information from the cfg_state
+ * struct passed in and tries to set the WiFi configuration to the one
  * found in the "new" member. If things go wrong, it will try to fall
  * back to the configuration found in "saved". This should minimise
  * the risk of users locking themselves out of the device by setting
@@ -898,11 +2015,11 @@ on_exit:
  * mutex and then checking that cfg_state.state is in a stable state.
  * To set a new configuration, just store the current config to .saved,
  * update .new to the desired config, set .state to wmngr_state_update
- * and start the config_timer.
+ * and start the config timer.
  * To connect to an AP with WPS, save the current state, set .state
- * to wmngr_state_wps_start and start the config_timer.
+ * to wmngr_state_wps_start and start the config timer.
  */
-static void handle_wifi(TimerHandle_t timer)
+static void handle_wifi(struct wifi_cfg_state *cfg_state)
 {
     bool connected;
     wifi_mode_t mode;
@@ -912,15 +2029,25 @@ static void handle_wifi(TimerHandle_t timer)
     esp_err_t result;
 
     ESP_LOGD(TAG, "[%s] Called. State: %s",
-             __func__, wmngr_state_names[cfg_state.state]);
+             __func__, wmngr_state_names[cfg_state->state]);
+    WMNGR_METRIC_INC(handle_calls);
 
     /*
      * If we can not get the config state lock, we try to reschedule the
      * timer. If that also fails, we are SOL...
      * Maybe we should trigger a reboot.
      */
-    if(xSemaphoreTake(cfg_state.lock, 0) != pdTRUE){
-        if(xTimerChangePeriod(config_timer, CFG_DELAY, CFG_DELAY) != pdPASS){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, 0,
+                       wmngr_lock_handle + cfg_state->state) != pdTRUE){
+        WMNGR_METRIC_INC(lock_failures);
+        if(!cfg_state->lock_waiting){
+            cfg_state->lock_waiting = true;
+            cfg_state->lock_wait_start = xTaskGetTickCount();
+        }
+
+        if(xTimerChangePeriod(cfg_state->timer, CFG_DELAY, CFG_DELAY)
+           != pdPASS)
+        {
             ESP_LOGE(TAG, "[%s] Failure to get config lock and change timer.",
                      __func__);
             /* FIXME: should we restart the device? */
@@ -928,79 +2055,96 @@ static void handle_wifi(TimerHandle_t timer)
         return;
     }
 
+    if(cfg_state->lock_waiting){
+        cfg_state->lock_waiting = false;
+        WMNGR_METRIC_ADD(lock_wait_ms,
+                         (xTaskGetTickCount() - cfg_state->lock_wait_start)
+                         * portTICK_PERIOD_MS);
+    }
+
     /* If delay gets set later, the timer will be re-scheduled on exit. */
     delay = 0;
 
     /* Abort and stop timer if wifi manager has been stopped. */
-    events = xEventGroupGetBits(wifi_events);
+    events = xEventGroupGetBits(cfg_state->events);
     if(events & BIT_STOPPED){
-        (void) xTimerStop(config_timer, CFG_TICKS);
+        (void) xTimerStop(cfg_state->timer, CFG_TICKS);
         goto on_exit;
     }
 
     /* Gather various information about the current system state. */
-    connected = sta_connected();
+    connected = sta_connected(cfg_state);
     now = xTaskGetTickCount();
 
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+    if(events & BIT_AP_REQUEST){
+        xEventGroupClearBits(cfg_state->events, BIT_AP_REQUEST);
+        ap_auto_on(cfg_state, now);
+    }
+#endif
+
     result = esp_wifi_get_mode(&mode);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] Error fetching WiFi mode.", __func__);
-        cfg_state.state = wmngr_state_failed;
+        set_state(cfg_state, wmngr_state_failed);
         goto on_exit;
     }
 
-    switch(cfg_state.state){
+    switch(cfg_state->state){
     case wmngr_state_wps_start:
         ESP_LOGI(TAG, "[%s] Starting WPS.", __func__);
         /*
          * Try connecting to AP with WPS. First, tear down any connection
          * we might currently have.
          */
-        result = get_wifi_cfg(&cfg_state.new);
+        result = get_wifi_cfg(cfg_state, &cfg_state->new);
         if(result != ESP_OK){
             ESP_LOGE(TAG, "[%s] WPS start: Error getting current config.",
                      __func__);
-            cfg_state.state = wmngr_state_fallback;
+            set_state(cfg_state, wmngr_state_fallback);
             delay = CFG_DELAY;
             goto on_exit;
         }
 
-        memset(&cfg_state.new.sta, 0x0, sizeof(cfg_state.new.sta));
-        cfg_state.new.mode = WIFI_MODE_APSTA;
-        cfg_state.new.sta_connect = false;
+        memset(&cfg_state->new.sta, 0x0, sizeof(cfg_state->new.sta));
+        cfg_state->new.mode = WIFI_MODE_APSTA;
+        cfg_state->new.sta_connect = false;
 
-        result = set_wifi_cfg(&cfg_state.new);
+        result = set_wifi_cfg(cfg_state, &cfg_state->new);
         if(result != ESP_OK){
             ESP_LOGE(TAG, "[%s] WPS start: Error setting temp config.",
                      __func__);
-            cfg_state.state = wmngr_state_fallback;
+            set_state(cfg_state, wmngr_state_fallback);
             delay = CFG_DELAY;
             goto on_exit;
         }
 
         /* Clear previous results and start WPS. */
-        xEventGroupClearBits(wifi_events, BITS_WPS);
+        xEventGroupClearBits(cfg_state->events, BITS_WPS);
+        cfg_state->drv_synced = false;
         result = esp_wifi_wps_enable(&config);
+        WMNGR_TRACE_CALL(wmngr_site_wps_enable, result);
         if(result != ESP_OK){
             ESP_LOGE(TAG, "[%s] esp_wifi_wps_enable() failed: %d %s",
                      __func__, result, esp_err_to_name(result));
-            cfg_state.state = wmngr_state_fallback;
+            set_state(cfg_state, wmngr_state_fallback);
             delay = CFG_DELAY;
             goto on_exit;
         }
 
         result = esp_wifi_wps_start(0);
+        WMNGR_TRACE_CALL(wmngr_site_wps_start, result);
         if(result != ESP_OK){
             ESP_LOGE(TAG, "[%s] esp_wifi_wps_start() failed: %d %s",
                      __func__, result, esp_err_to_name(result));
-            cfg_state.state = wmngr_state_fallback;
+            set_state(cfg_state, wmngr_state_fallback);
             delay = CFG_DELAY;
             goto on_exit;
         }
 
         /* WPS is running, set time stamp and transition to next state. */
-        cfg_state.cfg_timestamp = now;
-        cfg_state.state = wmngr_state_wps_active;
+        cfg_state->cfg_timestamp = now;
+        set_state(cfg_state, wmngr_state_wps_active);
         delay = CFG_TICKS;
         break;
     case wmngr_state_wps_active:
@@ -1011,6 +2155,8 @@ static void handle_wifi(TimerHandle_t timer)
              * to connect to the AP by transitioning to the updating state.
              */
             ESP_LOGI(TAG, "[%s] WPS success.", __func__);
+            WMNGR_TL_MARK(wmngr_tl_wps_done);
+            WMNGR_METRIC_INC(wps_success);
             result = esp_wifi_wps_disable();
             if(result != ESP_OK){
                 ESP_LOGE(TAG, "[%s] wifi wps disable: %d %s",
@@ -1021,17 +2167,23 @@ static void handle_wifi(TimerHandle_t timer)
              * Get received STA config, then force APSTA mode, set
              * connect flag and trigger update.
              */
-            get_wifi_cfg(&cfg_state.new);
-            cfg_state.new.mode = WIFI_MODE_APSTA;
-            cfg_state.new.sta_connect = true;
-            cfg_state.state = wmngr_state_update;
+            get_wifi_cfg(cfg_state, &cfg_state->new);
+            cfg_state->new.mode = WIFI_MODE_APSTA;
+            cfg_state->new.sta_connect = true;
+            set_state(cfg_state, wmngr_state_update);
             delay = CFG_DELAY;
-        } else if(time_after(now, (cfg_state.cfg_timestamp + CFG_TIMEOUT))
+        } else if(time_after(now, (cfg_state->cfg_timestamp + CFG_TIMEOUT))
                   || (events & BIT_WPS_FAILED))
         {
             /* Failure or timeout. Trigger fall-back to the previous config. */
             ESP_LOGI(TAG, "[%s] WPS failed, restoring saved config.",
                      __func__);
+            WMNGR_TL_MARK(wmngr_tl_wps_done);
+            if(events & BIT_WPS_FAILED){
+                WMNGR_METRIC_INC(wps_failed);
+            } else {
+                WMNGR_METRIC_INC(wps_timeout);
+            }
 
             result = esp_wifi_wps_disable();
             if(result != ESP_OK){
@@ -1039,7 +2191,7 @@ static void handle_wifi(TimerHandle_t timer)
                         __func__, result, esp_err_to_name(result));
             }
 
-            cfg_state.state = wmngr_state_fallback;
+            set_state(cfg_state, wmngr_state_fallback);
             delay = CFG_DELAY;
         } else {
             /* Still waiting. Set up next check. */
@@ -1050,22 +2202,28 @@ static void handle_wifi(TimerHandle_t timer)
         ESP_LOGI(TAG, "[%s] Setting new configuration.", __func__);
         /* Start changing WiFi to new configuration. */
         (void) esp_wifi_scan_stop();
-        (void) esp_wifi_disconnect();
-        result = set_wifi_cfg(&(cfg_state.new));
+        if(cfg_changes(cfg_state, &(cfg_state->new))
+           & (WMNGR_CFG_MODE | WMNGR_CFG_STA | WMNGR_CFG_STA_CONNECT))
+        {
+            (void) esp_wifi_disconnect();
+        }
+        result = set_wifi_cfg(cfg_state, &(cfg_state->new));
         if(result != ESP_OK){
-            cfg_state.state = wmngr_state_fallback;
+            set_state(cfg_state, wmngr_state_fallback);
             delay = CFG_DELAY;
             goto on_exit;
         }
 
-        if(cfg_state.new.mode == WIFI_MODE_AP || !cfg_state.new.sta_connect){
+        if(cfg_state->new.mode == WIFI_MODE_AP || !cfg_state->new.sta_connect){
             /* AP-only mode or not connecting, we are done. */
-            cfg_state.state = wmngr_state_idle;
-            cfg_state.current.is_valid = 1;
+            set_state(cfg_state, wmngr_state_idle);
+            cfg_state->current.is_valid = 1;
+            cfg_publish(cfg_state);
         } else {
             /* System should now connect to the AP. */
-            cfg_state.cfg_timestamp = now;
-            cfg_state.state = wmngr_state_connecting;
+            WMNGR_METRIC_INC(connect_attempts);
+            cfg_state->cfg_timestamp = now;
+            set_state(cfg_state, wmngr_state_connecting);
             delay = CFG_TICKS;
         }
         break;
@@ -1074,32 +2232,38 @@ static void handle_wifi(TimerHandle_t timer)
         if(connected){
             /* We have a connection! \o/ */
             ESP_LOGI(TAG, "[%s] Established connection to AP.", __func__);
-            cfg_state.state = wmngr_state_connected;
+            set_state(cfg_state, wmngr_state_connected);
+            WMNGR_TL_MARK(wmngr_tl_connected);
+            WMNGR_METRIC_INC(connect_success);
 
             /*
              * New config is valid. Make sure we do not fall back to previous
              * config if the AP goes away and then try saving it to the NVS.
              */
-            cfg_state.current.is_valid = true;
-            memcpy(&cfg_state.saved, &cfg_state.current,
-                    sizeof(cfg_state.saved));
+            cfg_state->current.is_valid = true;
+            cfg_publish(cfg_state);
+            memcpy(&cfg_state->saved, &cfg_state->current,
+                    sizeof(cfg_state->saved));
 
-            result = save_config(&cfg_state.current);
+            result = save_config(&cfg_state->current);
+            WMNGR_TRACE_CALL(wmngr_site_save_cfg, result);
             if(result != ESP_OK){
                 ESP_LOGE(TAG, "[%s] Saving config failed.", __func__);
             }
-        } else if(time_after(now, (cfg_state.cfg_timestamp + CFG_TIMEOUT))){
-            if(cfg_state.current.is_valid){
+            WMNGR_TL_MARK(wmngr_tl_saved);
+        } else if(time_after(now, (cfg_state->cfg_timestamp + CFG_TIMEOUT))){
+            if(cfg_state->current.is_valid){
                 /*
                  * We know that the config is valid, so just keep prodding
                  * the WiFI core and hope for the best.
                  */
                 ESP_LOGW(TAG, "[%s] Timeout connecting, re-applying config.",
                         __func__);
+                WMNGR_METRIC_INC(reconnects);
 
-                memcpy(&cfg_state.new, &cfg_state.current,
-                        sizeof(cfg_state.new));
-                cfg_state.state = wmngr_state_update;
+                memcpy(&cfg_state->new, &cfg_state->current,
+                        sizeof(cfg_state->new));
+                set_state(cfg_state, wmngr_state_update);
                 delay = CFG_TICKS;
             } else {
                 /*
@@ -1108,7 +2272,7 @@ static void handle_wifi(TimerHandle_t timer)
                  */
                 ESP_LOGI(TAG, "[%s] Timed out waiting for connection to AP.",
                         __func__);
-                cfg_state.state = wmngr_state_fallback;
+                set_state(cfg_state, wmngr_state_fallback);
                 delay = CFG_DELAY;
             }
         } else {
@@ -1122,39 +2286,73 @@ static void handle_wifi(TimerHandle_t timer)
         /* Something went wrong, try going back to the previous config. */
         ESP_LOGI(TAG, "[%s] Falling back to previous configuration.",
                     __func__);
+        WMNGR_TL_MARK(wmngr_tl_fallback);
+        WMNGR_METRIC_INC(fallbacks);
         (void) esp_wifi_disconnect();
-        (void) set_wifi_cfg(&(cfg_state.saved));
-        cfg_state.state = wmngr_state_failed;
+        (void) set_wifi_cfg(cfg_state, &(cfg_state->saved));
+        set_state(cfg_state, wmngr_state_failed);
         break;
     case wmngr_state_connected:
+        /* Roaming requests are only valid for the current connection. */
+        xEventGroupClearBits(cfg_state->events, BIT_ROAM);
+
         if(!connected){
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+            ap_auto_on(cfg_state, now);
+#endif
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+            /* Only an AP supporting BTM can have sent us elsewhere. */
+            if(cfg_state->btm_supported){
+                roam_btm_begin(cfg_state, now);
+                delay = CFG_DELAY;
+                break;
+            }
+#endif
             /*
              * We should be connected, but are not. Change into update state
              * so current configuration gets re-applied.
              */
             ESP_LOGI(TAG, "[%s] Connection to AP lost, retrying.", __func__);
-            memcpy(&cfg_state.new, &cfg_state.current, sizeof(cfg_state.new));
-            cfg_state.state = wmngr_state_update;
+            WMNGR_TL_MARK(wmngr_tl_link_lost);
+            WMNGR_METRIC_INC(reconnects);
+            memcpy(&cfg_state->new, &cfg_state->current,
+                    sizeof(cfg_state->new));
+            set_state(cfg_state, wmngr_state_update);
+            delay = CFG_DELAY;
+        }
+#if defined(CONFIG_WMNGR_ROAMING)
+        else if((events & BIT_ROAM) && roam_begin(cfg_state, now)){
             delay = CFG_DELAY;
         }
+#endif
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+        else {
+            delay = ap_auto_off(cfg_state, now);
+        }
+#endif
+        break;
+#if defined(CONFIG_WMNGR_ROAMING)
+    case wmngr_state_roaming:
+        delay = handle_roaming(cfg_state, events, connected, now);
         break;
+#endif
     case wmngr_state_idle:
     case wmngr_state_failed:
         break;
     default:
-        ESP_LOGE(TAG, "[%s] Illegal state: 0x%x", __func__, cfg_state.state);
-        cfg_state.state = wmngr_state_failed;
+        ESP_LOGE(TAG, "[%s] Illegal state: 0x%x", __func__, cfg_state->state);
+        set_state(cfg_state, wmngr_state_failed);
     }
 
-    if(cfg_state.state <= wmngr_state_idle){
+    if(cfg_state->state <= wmngr_state_idle){
         if(events & BIT_SCAN_START){
-            wifi_scan_start();
+            wifi_scan_start(cfg_state);
         } else if(events & BIT_SCAN_DONE){
-            wifi_scan_done();
+            wifi_scan_done(cfg_state);
         }
 
         /* Check the SCAN bits and re-schedule if necessary. */
-        events = xEventGroupGetBits(wifi_events);
+        events = xEventGroupGetBits(cfg_state->events);
         if(events & (BIT_SCAN_START | BIT_SCAN_DONE)){
             delay = CFG_DELAY;
         }
@@ -1163,32 +2361,72 @@ static void handle_wifi(TimerHandle_t timer)
 on_exit:
     if(delay > 0){
         /* We are in a transitional state, re-arm the timer. */
-        if(xTimerChangePeriod(config_timer, delay, CFG_DELAY) != pdPASS){
-            cfg_state.state = wmngr_state_failed;
+        if(xTimerChangePeriod(cfg_state->timer, delay, CFG_DELAY) != pdPASS){
+            set_state(cfg_state, wmngr_state_failed);
         }
     }
 
-    xSemaphoreGive(cfg_state.lock);
+    WMNGR_LOCK_GIVE(cfg_state->lock);
 
     ESP_LOGD(TAG, "[%s] Leaving. State: %s delay: %" PRIu32,
-             __func__, wmngr_state_names[cfg_state.state], delay);
+             __func__, wmngr_state_names[cfg_state->state], delay);
 
     return;
 }
 
 static void handle_timer(TimerHandle_t timer)
 {
+    struct wifi_cfg_state *cfg_state = pvTimerGetTimerID(timer);
+
     ESP_LOGD(TAG, "[%s] Called.\n", __FUNCTION__);
 
 #if defined(CONFIG_WMNGR_TASK)
     /* Reset timer to regular tick rate and trigger the task. */
     (void) xTimerChangePeriod(timer, CFG_TICKS, CFG_DELAY);
-    xEventGroupSetBits(wifi_events, BIT_TRIGGER);
+    xEventGroupSetBits(cfg_state->events, BIT_TRIGGER);
 #else
-    handle_wifi(timer);
+    handle_wifi(cfg_state);
 #endif
 }
 
+/*
+ * Account the time from set_wifi_cfg() to the STA connection. For
+ * connects using a cached PMK, the saving is estimated against the
+ * average of the connects that needed the full handshake.
+ */
+static void account_connect(struct wifi_cfg_state *cfg_state)
+{
+    uint32_t ms, avg;
+
+    ms = (xTaskGetTickCount() - cfg_state->connect_timestamp)
+         * portTICK_PERIOD_MS;
+
+    if(!cfg_state->connect_fast){
+        ++cfg_state->full_connects;
+        cfg_state->full_connect_ms += ms;
+        WMNGR_METRIC_INC(connects_full);
+        WMNGR_METRIC_ADD(connect_full_ms, ms);
+        return;
+    }
+
+    WMNGR_METRIC_INC(connects_fast);
+    WMNGR_METRIC_ADD(connect_fast_ms, ms);
+
+    if(cfg_state->full_connects == 0){
+        ESP_LOGI(TAG, "[%s] Reconnected in %" PRIu32 " ms with cached PMK.",
+                 __func__, ms);
+        return;
+    }
+
+    avg = cfg_state->full_connect_ms / cfg_state->full_connects;
+    ESP_LOGI(TAG, "[%s] Reconnected in %" PRIu32 " ms with cached PMK, "
+                  "full handshake averages %" PRIu32 " ms.",
+             __func__, ms, avg);
+    if(avg > ms){
+        WMNGR_METRIC_ADD(connect_saved_ms, avg - ms);
+    }
+}
+
 /*
  * Update state information from system events. This function must be
  * called from the main event handler to keep this module updated about
@@ -1197,15 +2435,45 @@ static void handle_timer(TimerHandle_t timer)
 static void event_handler(void* args, esp_event_base_t base,
                           int32_t id, void* data)
 {
+    struct wifi_cfg_state *cfg_state = args;
     EventBits_t old, new;
     wifi_event_sta_scan_done_t *scan_data;
+    uint32_t scan_ms;
 
     if(base != WIFI_EVENT && base != IP_EVENT){
         ESP_LOGE(TAG, "[%s] Got event for wrong base.", __func__);
         goto on_exit;
     }
 
-    old = xEventGroupGetBits(wifi_events);
+    WMNGR_TRACE_EVENT((base == WIFI_EVENT) ? wmngr_trace_base_wifi
+                                           : wmngr_trace_base_ip, id);
+
+    /*
+     * The status snapshot, link monitor, power-save policy and AP client
+     * table follow the driver even while we are stopped.
+     */
+    WMNGR_AP_EVENT(base, id, data);
+    if(base == WIFI_EVENT && id == WIFI_EVENT_STA_CONNECTED){
+        wmngr_status_sta(true,
+                         ((wifi_event_sta_connected_t *) data)->channel, 0);
+        WMNGR_TUNE_NEW_AP(((wifi_event_sta_connected_t *) data)->bssid);
+        WMNGR_LINK_START();
+        WMNGR_PS_START();
+    } else if(base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED){
+        wmngr_status_sta(false, 0,
+                         ((wifi_event_sta_disconnected_t *) data)->reason);
+        WMNGR_LINK_STOP();
+        WMNGR_PS_STOP();
+        if(cfg_state->state == wmngr_state_connected){
+            WMNGR_TUNE_LOST();
+        }
+    } else if(base == IP_EVENT && id == IP_EVENT_STA_GOT_IP){
+        wmngr_status_sta_ip(&(((ip_event_got_ip_t *) data)->ip_info));
+    } else if(base == IP_EVENT && id == IP_EVENT_STA_LOST_IP){
+        wmngr_status_sta_ip(NULL);
+    }
+
+    old = xEventGroupGetBits(cfg_state->events);
     if(old & BIT_STOPPED){
         goto on_exit;
     }
@@ -1215,35 +2483,52 @@ static void event_handler(void* args, esp_event_base_t base,
         case WIFI_EVENT_SCAN_DONE:
             scan_data = (wifi_event_sta_scan_done_t *) data;
             if(scan_data->status == ESP_OK){
-                xEventGroupSetBits(wifi_events, BIT_SCAN_DONE);
+                scan_ms = (xTaskGetTickCount() - cfg_state->scan_timestamp)
+                          * portTICK_PERIOD_MS;
+                WMNGR_METRIC_INC(scans_done);
+                WMNGR_METRIC_ADD(scan_time_ms, scan_ms);
+                WMNGR_METRIC_SET(scan_last_ms, scan_ms);
+                WMNGR_METRIC_MAX(scan_max_ms, scan_ms);
+                xEventGroupSetBits(cfg_state->events, BIT_SCAN_DONE);
+            } else {
+                WMNGR_METRIC_INC(scans_failed);
             }
-            xEventGroupClearBits(wifi_events, BIT_SCAN_START);
+            xEventGroupClearBits(cfg_state->events, BIT_SCAN_START);
             break;
         case WIFI_EVENT_STA_START:
-            xEventGroupSetBits(wifi_events, BIT_STA_START);
+            WMNGR_TL_MARK(wmngr_tl_sta_start);
+            xEventGroupSetBits(cfg_state->events, BIT_STA_START);
             break;
         case WIFI_EVENT_STA_STOP:
-            xEventGroupClearBits(wifi_events, BIT_STA_START);
+            xEventGroupClearBits(cfg_state->events, BIT_STA_START);
             break;
         case WIFI_EVENT_STA_CONNECTED:
-            xEventGroupSetBits(wifi_events, BIT_STA_CONNECTED);
+            WMNGR_TL_MARK(wmngr_tl_sta_connected);
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+            cfg_state->btm_supported = wmngr_roam_btm_supported();
+#endif
+            if(cfg_state->connect_pending){
+                cfg_state->connect_pending = false;
+                account_connect(cfg_state);
+            }
+            xEventGroupSetBits(cfg_state->events, BIT_STA_CONNECTED);
             break;
         case WIFI_EVENT_STA_DISCONNECTED:
-            xEventGroupClearBits(wifi_events, BIT_STA_CONNECTED);
+            xEventGroupClearBits(cfg_state->events, BIT_STA_CONNECTED);
             break;
         case WIFI_EVENT_AP_START:
-            xEventGroupSetBits(wifi_events, BIT_AP_START);
+            xEventGroupSetBits(cfg_state->events, BIT_AP_START);
             break;
         case WIFI_EVENT_AP_STOP:
-            xEventGroupClearBits(wifi_events, BIT_AP_START);
+            xEventGroupClearBits(cfg_state->events, BIT_AP_START);
             break;
         case WIFI_EVENT_STA_WPS_ER_SUCCESS:
-            xEventGroupSetBits(wifi_events, BIT_WPS_SUCCESS);
+            xEventGroupSetBits(cfg_state->events, BIT_WPS_SUCCESS);
             break;
         case WIFI_EVENT_STA_WPS_ER_FAILED:
         case WIFI_EVENT_STA_WPS_ER_TIMEOUT:
         case WIFI_EVENT_STA_WPS_ER_PIN:
-            xEventGroupSetBits(wifi_events, BIT_WPS_FAILED);
+            xEventGroupSetBits(cfg_state->events, BIT_WPS_FAILED);
             break;
         default:
             break;
@@ -1253,24 +2538,27 @@ static void event_handler(void* args, esp_event_base_t base,
     if(base == IP_EVENT){
         switch(id){
         case IP_EVENT_STA_GOT_IP:
-            xEventGroupSetBits(wifi_events, BIT_STA_GOT_IP);
+            WMNGR_TL_MARK(wmngr_tl_got_ip);
+            xEventGroupSetBits(cfg_state->events, BIT_STA_GOT_IP);
             break;
         case IP_EVENT_STA_LOST_IP:
-            xEventGroupClearBits(wifi_events, BIT_STA_GOT_IP);
+            xEventGroupClearBits(cfg_state->events, BIT_STA_GOT_IP);
             break;
         default:
             break;
         }
     }
 
-    new = xEventGroupGetBits(wifi_events);
+    new = xEventGroupGetBits(cfg_state->events);
 
     if(old != new){
 #if defined(CONFIG_WMNGR_TASK)
-        xEventGroupSetBits(wifi_events, BIT_TRIGGER);
+        xEventGroupSetBits(cfg_state->events, BIT_TRIGGER);
 #else
-        if(xTimerChangePeriod(config_timer, CFG_DELAY, CFG_DELAY) != pdPASS){
-            cfg_state.state = wmngr_state_failed;
+        if(xTimerChangePeriod(cfg_state->timer, CFG_DELAY, CFG_DELAY)
+           != pdPASS)
+        {
+            set_state(cfg_state, wmngr_state_failed);
         }
 #endif
     }
@@ -1280,16 +2568,17 @@ on_exit:
 }
 
 #if defined(CONFIG_WMNGR_TASK)
-void esp_wmngr_task(void *pvParameters)
+static void esp_wmngr_task(void *pvParameters)
 {
+    struct wifi_cfg_state *cfg_state = pvParameters;
     EventBits_t events;
     do{
         /* Wait for and clear timer bit. */
-        events = xEventGroupWaitBits(wifi_events, BIT_TRIGGER,
+        events = xEventGroupWaitBits(cfg_state->events, BIT_TRIGGER,
                                      true, false, portMAX_DELAY);
 
         if((events & BIT_TRIGGER)){
-            handle_wifi(config_timer);
+            handle_wifi(cfg_state);
         }
     } while(1);
 }
@@ -1312,59 +2601,65 @@ void esp_wmngr_task(void *pvParameters)
  */
 esp_err_t esp_wmngr_init(void)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
 #if defined(CONFIG_WMNGR_TASK)
     BaseType_t status;
 #endif
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     esp_err_t result;
 
-    configASSERT(cfg_state.state == wmngr_state_deinit);
-    configASSERT(cfg_state.lock == NULL);
-    configASSERT(wifi_events == NULL);
-    configASSERT(config_timer == NULL);
+    configASSERT(cfg_state->state == wmngr_state_deinit);
+    configASSERT(cfg_state->lock == NULL);
+    configASSERT(cfg_state->events == NULL);
+    configASSERT(cfg_state->timer == NULL);
 
     result = ESP_OK;
-    memset(&cfg_state, 0x0, sizeof(cfg_state));
-    cfg_state.state = wmngr_state_deinit;
+    memset(cfg_state, 0x0, sizeof(*cfg_state));
+    cfg_state->state = wmngr_state_deinit;
+    portMUX_INITIALIZE(&cfg_state->cfg_ref_lock);
+
+    WMNGR_TRACE_INIT();
 
-    wifi_events = xEventGroupCreate();
-    if(wifi_events == NULL){
+    WMNGR_MEM_TRACK(rtos, cfg_state->events = xEventGroupCreate());
+    if(cfg_state->events == NULL){
         ESP_LOGE(TAG, "Unable to create event group.");
         result = ESP_ERR_NO_MEM;
         goto on_exit;
     }
 
     /* Make sure we do not handle any events until we have been started. */
-    xEventGroupSetBits(wifi_events, BIT_STOPPED);
+    xEventGroupSetBits(cfg_state->events, BIT_STOPPED);
 
-    cfg_state.lock = xSemaphoreCreateMutex();
-    if(cfg_state.lock == NULL){
+    WMNGR_MEM_TRACK(rtos, cfg_state->lock = xSemaphoreCreateMutex());
+    if(cfg_state->lock == NULL){
         ESP_LOGE(TAG, "Unable to create state lock.");
         result = ESP_ERR_NO_MEM;
         goto on_exit;
     }
 
     result = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
-                                        &event_handler, NULL);
+                                        &event_handler, cfg_state);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] esp_event_handler_register() failed", __func__);
         goto on_exit;
     }
+    WMNGR_EVREC_HANDLER(WIFI_EVENT, &event_handler, cfg_state);
 
     result = esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID,
-                                        &event_handler, NULL);
+                                        &event_handler, cfg_state);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] esp_event_handler_register() failed", __func__);
         goto on_exit;
     }
+    WMNGR_EVREC_HANDLER(IP_EVENT, &event_handler, cfg_state);
 
     /*
      * Restore saved WiFi config or fall back to compiled-in defaults.
      * Setting state to update will trigger applying this config.
      */
-    result = load_config();
+    result = load_config(cfg_state);
     if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] load_config() failed", __func__);
+        ESP_LOGE(TAG, "[%s] load_config(cfg_state) failed", __func__);
         goto on_exit;
     }
 
@@ -1374,14 +2669,16 @@ esp_err_t esp_wmngr_init(void)
         goto on_exit;
     }
 
-    sta_netif = esp_netif_create_default_wifi_sta();
-    if(sta_netif == NULL){
+    WMNGR_MEM_TRACK(netif,
+                    cfg_state->sta_netif = esp_netif_create_default_wifi_sta());
+    if(cfg_state->sta_netif == NULL){
         ESP_LOGE(TAG, "[%s] *_create_default_wifi_sta() failed", __func__);
         goto on_exit;
     }
 
-    ap_netif = esp_netif_create_default_wifi_ap();
-    if(ap_netif == NULL){
+    WMNGR_MEM_TRACK(netif,
+                    cfg_state->ap_netif = esp_netif_create_default_wifi_ap());
+    if(cfg_state->ap_netif == NULL){
         ESP_LOGE(TAG, "[%s] *_create_default_wifi_ap() failed", __func__);
         goto on_exit;
     }
@@ -1399,52 +2696,56 @@ esp_err_t esp_wmngr_init(void)
     }
 
 #if defined(CONFIG_WMNGR_TASK)
-    config_timer = xTimerCreate("WMngr_Timer",
-                              CFG_TICKS,
-                              pdTRUE, NULL, handle_timer);
+    WMNGR_MEM_TRACK(rtos, cfg_state->timer = xTimerCreate("WMngr_Timer",
+                                                          CFG_TICKS,
+                                                          pdTRUE, cfg_state,
+                                                          handle_timer));
 #else
-    config_timer = xTimerCreate("WMngr_Timer",
-                              CFG_TICKS,
-                              pdFALSE, NULL, handle_timer);
+    WMNGR_MEM_TRACK(rtos, cfg_state->timer = xTimerCreate("WMngr_Timer",
+                                                          CFG_TICKS,
+                                                          pdFALSE, cfg_state,
+                                                          handle_timer));
 #endif /* defined(CONFIG_WMNGR_TASK) */
 
-    if(config_timer == NULL){
+    if(cfg_state->timer == NULL){
         ESP_LOGE(TAG, "[%s] Failed to create config validation timer",
                  __func__);
         result = ESP_ERR_NO_MEM;
         goto on_exit;
     }
 
+    WMNGR_ROAM_ATTACH(roam_trigger, cfg_state);
+
 #if defined(CONFIG_WMNGR_TASK)
-    status = xTaskCreate(&esp_wmngr_task, "WMngr_Task",
-                        CONFIG_WMNGR_TASK_STACK,
-                        NULL,
-                        CONFIG_WMNGR_TASK_PRIO,
-                        NULL);
+    WMNGR_MEM_TRACK(rtos, status = xTaskCreate(&esp_wmngr_task, "WMngr_Task",
+                                               CONFIG_WMNGR_TASK_STACK,
+                                               cfg_state,
+                                               CONFIG_WMNGR_TASK_PRIO,
+                                               NULL));
     if(status != pdPASS){
         ESP_LOGE(TAG, "[%s] Creating WiFi Manager task failed.", __func__);
         result = ESP_ERR_NO_MEM;
     }
 #endif
 
-    cfg_state.state = wmngr_state_stopped;
-    xEventGroupSetBits(wifi_events, BIT_STOPPED);
+    set_state(cfg_state, wmngr_state_stopped);
+    xEventGroupSetBits(cfg_state->events, BIT_STOPPED);
 
 on_exit:
     if(result != ESP_OK){
-        if(wifi_events != NULL){
-            vEventGroupDelete(wifi_events);
-            wifi_events = NULL;
+        if(cfg_state->events != NULL){
+            WMNGR_MEM_TRACK(rtos, vEventGroupDelete(cfg_state->events));
+            cfg_state->events = NULL;
         }
 
-        if(cfg_state.lock != NULL){
-            vSemaphoreDelete(cfg_state.lock);
-            cfg_state.lock = NULL;
+        if(cfg_state->lock != NULL){
+            WMNGR_MEM_TRACK(rtos, vSemaphoreDelete(cfg_state->lock));
+            cfg_state->lock = NULL;
         }
 
-        if(config_timer != NULL){
-            xTimerDelete(config_timer, 0);
-            config_timer = NULL;
+        if(cfg_state->timer != NULL){
+            WMNGR_MEM_TRACK(rtos, xTimerDelete(cfg_state->timer, 0));
+            cfg_state->timer = NULL;
         }
     }
 
@@ -1457,44 +2758,56 @@ on_exit:
  * either read from NVS or set via #esp_wmngr_set_cfg(). May only be called
  * when WiFi Manager is in state #wmngr_state_stopped.
  *
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK on success, ESP_ERR_* otherwise.
  */
-esp_err_t esp_wmngr_start(void)
+esp_err_t esp_wmngr_start_ex(TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     BaseType_t status;
     esp_err_t result;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) != pdTRUE){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_start) != pdTRUE){
         ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
         return ESP_ERR_TIMEOUT;
     }
 
-    if(cfg_state.state != wmngr_state_stopped){
+    if(cfg_state->state != wmngr_state_stopped){
         ESP_LOGW(TAG, "[%s] WiFi Manager already running.", __func__);
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
     }
 
-    status = xTimerStart(config_timer, CFG_TICKS);
+    WMNGR_TL_MARK(wmngr_tl_start);
+
+    status = xTimerStart(cfg_state->timer, CFG_TICKS);
     if(status != pdPASS){
         ESP_LOGE(TAG, "[%s] Starting config timer failed.", __func__);
         result = ESP_FAIL;
         goto on_exit;
     }
 
-    cfg_state.state = wmngr_state_update;
-    xEventGroupClearBits(wifi_events, BIT_STOPPED);
+    set_state(cfg_state, wmngr_state_update);
+    xEventGroupClearBits(cfg_state->events, BIT_STOPPED);
 
     result = ESP_OK;
 
 on_exit:
-    xSemaphoreGive(cfg_state.lock);
+    WMNGR_LOCK_GIVE(cfg_state->lock);
     return result;
 }
 
+/** Same as #esp_wmngr_start_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_start(void)
+{
+    return esp_wmngr_start_ex(API_TIMEOUT);
+}
+
 /** Stop WiFi Manager
  *
  * Stops all WiFi Manager operations and enter state #wmngr_state_stopped
@@ -1502,31 +2815,34 @@ on_exit:
  * A new configuration may be set by calling #esp_wmngr_set_cfg() while
  * in stopped state.
  *
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK on success, ESP_ERR_* otherwise.
  */
-esp_err_t esp_wmngr_stop(void)
+esp_err_t esp_wmngr_stop_ex(TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     BaseType_t status;
     esp_err_t result;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) != pdTRUE){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_stop) != pdTRUE){
         ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
         return ESP_ERR_TIMEOUT;
     }
 
-    if(cfg_state.state == wmngr_state_stopped){
+    if(cfg_state->state == wmngr_state_stopped){
         ESP_LOGW(TAG, "[%s] WiFi Manager not running.", __func__);
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
     }
 
-    xEventGroupSetBits(wifi_events, BIT_STOPPED);
-    cfg_state.state = wmngr_state_stopped;
+    xEventGroupSetBits(cfg_state->events, BIT_STOPPED);
+    set_state(cfg_state, wmngr_state_stopped);
 
-    status = xTimerStop(config_timer, CFG_TICKS);
+    status = xTimerStop(cfg_state->timer, CFG_TICKS);
     if(status != pdPASS){
         /* Not serious, we might just get some timer call backs later. */
         ESP_LOGW(TAG, "[%s] Stopping config timer failed.", __func__);
@@ -1535,11 +2851,18 @@ esp_err_t esp_wmngr_stop(void)
     result = ESP_OK;
 
 on_exit:
-    xSemaphoreGive(cfg_state.lock);
+    WMNGR_LOCK_GIVE(cfg_state->lock);
 
     return result;
 }
 
+/** Same as #esp_wmngr_stop_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_stop(void)
+{
+    return esp_wmngr_stop_ex(API_TIMEOUT);
+}
+
 /** Set a new WiFi Manager configuration.
  *
  * This function is used to set a new WiFi Manager configuration. The current
@@ -1555,128 +2878,202 @@ on_exit:
  * configuration and set the state to #wmngr_state_failed.
  *
  * @param[in] new New WiFi Manager configuration to be set.
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK if config was set, ESP_ERR_* otherwise.
  */
-esp_err_t esp_wmngr_set_cfg(struct wifi_cfg *new)
+esp_err_t esp_wmngr_set_cfg_ex(struct wifi_cfg *new, TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     esp_err_t result;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
+
+    if(!cfg_valid(new)){
+        ESP_LOGE(TAG, "[%s] Invalid country or channel plan.", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) != pdTRUE){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_set_cfg)
+       != pdTRUE)
+    {
         ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
         return ESP_ERR_TIMEOUT;
     }
 
-    if(cfg_state.state > wmngr_state_idle){
+    if(cfg_state->state > wmngr_state_idle){
         ESP_LOGI(TAG, "[%s] WiFi change in progress.", __func__);
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
     }
 
-    /* Save current configuration for fall-back. */
-    result = get_wifi_cfg(&(cfg_state.saved));
-    if(result != ESP_OK){
-        ESP_LOGI(TAG, "[%s] Error fetching current WiFi config.",
-                 __func__);
-        goto on_exit;
-    }
+    result = queue_cfg(cfg_state, new, 0);
 
-    /*
-     * Always save new config if WiFi Manager is stopped. Otherwise check
-     * first if it is an actual configuration change.
-     */
-    if(cfg_state.state == wmngr_state_stopped
-       || !cfgs_are_equal(new, &(cfg_state.saved)))
-    {
-        memmove(&(cfg_state.new), new, sizeof(cfg_state.new));
-        cfg_state.new.is_default = false;
-        cfg_state.new.is_valid = false;
+on_exit:
+    WMNGR_LOCK_GIVE(cfg_state->lock);
+    return result;
+}
 
-        /*
-         * Trigger an asynchronous update if WiFi Manager is not currently
-         * stopped. Otherwise it will be applied once #esp_wmngr_start()
-         * gets called.
-         * This gives the httpd some time to send out the reply before possibly
-         * tearing down the connection.
-         */
-        if(cfg_state.state != wmngr_state_stopped){
-            cfg_state.state = wmngr_state_update;
-            if(xTimerChangePeriod(config_timer, CFG_DELAY, CFG_DELAY) !=pdPASS){
-                cfg_state.state = wmngr_state_failed;
-                result = ESP_ERR_TIMEOUT;
-                goto on_exit;
-            }
-        }
-    }
+/** Same as #esp_wmngr_set_cfg_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_set_cfg(struct wifi_cfg *new)
+{
+    return esp_wmngr_set_cfg_ex(new, API_TIMEOUT);
+}
 
-    result = ESP_OK;
+/** Change selected fields of the WiFi Manager configuration.
+ *
+ * Copies the fields selected by field_mask from patch into the current
+ * configuration and applies the result like #esp_wmngr_set_cfg does.
+ * Reading, patching and queueing happen under the WiFi Manager's lock,
+ * so concurrent updates of different fields do not undo each other.
+ * Only the driver settings belonging to the selected fields are touched,
+ * e.g. changing the AP password keeps an existing STA connection.
+ *
+ * @param[in] patch Configuration holding the new field values. Fields not
+ *            selected by field_mask are ignored.
+ * @param[in] field_mask WMNGR_CFG_* bits from wmngr_cfg.h selecting the
+ *            fields to change.
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
+ * @return ESP_OK if the change was queued or nothing changed,
+ *         ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_update_cfg_ex(const struct wifi_cfg *patch,
+                                  uint32_t field_mask,
+                                  TickType_t timeout)
+{
+    return update_cfg(&default_state, patch, field_mask, timeout);
+}
 
-on_exit:
-    xSemaphoreGive(cfg_state.lock);
-    return result;
+/** Same as #esp_wmngr_update_cfg_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_update_cfg(const struct wifi_cfg *patch,
+                               uint32_t field_mask)
+{
+    return esp_wmngr_update_cfg_ex(patch, field_mask, API_TIMEOUT);
 }
 
 /** Get current WiFi Manager configuration.
  * @param[out] cfg Pointer to a #wifi_cfg struct the current configuration
  *             will be copied into.
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK on success, ESP_ERR_* otherwise.
  */
-esp_err_t esp_wmngr_get_cfg(struct wifi_cfg *cfg)
+esp_err_t esp_wmngr_get_cfg_ex(struct wifi_cfg *cfg, TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     esp_err_t result;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) != pdTRUE){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_get_cfg)
+       != pdTRUE)
+    {
         ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
         return ESP_ERR_TIMEOUT;
     }
 
-    if(cfg_state.state > wmngr_state_idle){
+    if(cfg_state->state > wmngr_state_idle){
         ESP_LOGI(TAG, "[%s] WiFi change in progress.", __func__);
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
     }
 
-    memmove(cfg, &cfg_state.current, sizeof(*cfg));
+    memmove(cfg, &cfg_state->current, sizeof(*cfg));
     result = ESP_OK;
 
 on_exit:
-    xSemaphoreGive(cfg_state.lock);
+    WMNGR_LOCK_GIVE(cfg_state->lock);
     return result;
 }
 
+/** Same as #esp_wmngr_get_cfg_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_get_cfg(struct wifi_cfg *cfg)
+{
+    return esp_wmngr_get_cfg_ex(cfg, API_TIMEOUT);
+}
+
+/** Get a reference to the current configuration.
+ *
+ * Fetches a reference counted pointer to an immutable copy of the
+ * configuration the WiFi Manager is running. A change of configuration
+ * publishes a new copy, so the one returned never changes while it is
+ * held. This does not take the WiFi Manager's mutex, so it neither
+ * waits for nor delays a configuration change in progress. Caller must
+ * at some point release the configuration by calling
+ * #esp_wmngr_put_cfg_ref.
+ *
+ * @return Pointer to a #wifi_cfg or NULL
+ */
+const struct wifi_cfg *esp_wmngr_get_cfg_ref(void)
+{
+    struct wifi_cfg_state *cfg_state = &default_state;
+    struct cfg_data_ref *ref;
+
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+
+    portENTER_CRITICAL(&cfg_state->cfg_ref_lock);
+    ref = cfg_state->cfg_ref;
+    if(ref != NULL){
+        kref_get(&(ref->ref_cnt));
+    }
+    portEXIT_CRITICAL(&cfg_state->cfg_ref_lock);
+
+    return (ref != NULL) ? &(ref->cfg) : NULL;
+}
+
+/** Drop a reference to a configuration, possibly freeing it.
+ * @param[in] cfg Reference from #esp_wmngr_get_cfg_ref.
+ * @return Void
+ */
+void esp_wmngr_put_cfg_ref(const struct wifi_cfg *cfg)
+{
+    struct cfg_data_ref *ref;
+
+    configASSERT(cfg != NULL);
+
+    ref = container_of(cfg, struct cfg_data_ref, cfg);
+    kref_put(&(ref->ref_cnt), free_cfg_data);
+}
+
 /** Connect to AP with WPS.
  *
  * Trigger a connection attemp to an AP using WPS. Can only be used if
  * device is in a stable state (idle, connected, failed).
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK if WPS is started, ESP_ERR_* otherwise.
  */
-esp_err_t esp_wmngr_start_wps(void)
+esp_err_t esp_wmngr_start_wps_ex(TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     struct wifi_cfg cfg;
     esp_err_t result;
     EventBits_t events;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
     /* Abort early if wifi manager has been stopped. */
-    events = xEventGroupGetBits(wifi_events);
+    events = xEventGroupGetBits(cfg_state->events);
     if(events & BIT_STOPPED){
         return ESP_ERR_INVALID_STATE;
     }
 
     /* Make sure we are not in the middle of setting a new WiFi config. */
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) != pdTRUE){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_start_wps)
+       != pdTRUE)
+    {
         ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
         return ESP_ERR_TIMEOUT;
     }
 
-    if(cfg_state.state > wmngr_state_idle){
+    if(cfg_state->state > wmngr_state_idle){
         ESP_LOGI(TAG, "[%s] Can not change config in current state", __func__);
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
@@ -1685,24 +3082,31 @@ esp_err_t esp_wmngr_start_wps(void)
     ESP_LOGI(TAG, "[%s] Starting WPS.", __func__);
 
     /* Save current config for fall-back. */
-    result = get_wifi_cfg(&cfg);
+    result = get_wifi_cfg(cfg_state, &cfg);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] Error fetching WiFi config.", __func__);
         goto on_exit;
     }
 
-    memmove(&cfg_state.saved, &cfg, sizeof(cfg_state.saved));
-    cfg_state.state = wmngr_state_wps_start;
+    memmove(&cfg_state->saved, &cfg, sizeof(cfg_state->saved));
+    set_state(cfg_state, wmngr_state_wps_start);
 
-    if(xTimerChangePeriod(config_timer, CFG_DELAY, CFG_DELAY) != pdTRUE){
-        cfg_state.state = wmngr_state_failed;
+    if(xTimerChangePeriod(cfg_state->timer, CFG_DELAY, CFG_DELAY) != pdTRUE){
+        set_state(cfg_state, wmngr_state_failed);
     }
 
 on_exit:
-    xSemaphoreGive(cfg_state.lock);
+    WMNGR_LOCK_GIVE(cfg_state->lock);
     return result;
 }
 
+/** Same as #esp_wmngr_start_wps_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_start_wps(void)
+{
+    return esp_wmngr_start_wps_ex(API_TIMEOUT);
+}
+
 /** Start AP scan.
  *
  * Calling this function will trigger a scan for available APs. Scanning
@@ -1715,26 +3119,27 @@ on_exit:
  */
 esp_err_t esp_wmngr_start_scan(void)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     esp_err_t result;
     EventBits_t events;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
     result = ESP_OK;
 
     /* Abort early if wifi manager has been stopped. */
-    events = xEventGroupGetBits(wifi_events);
+    events = xEventGroupGetBits(cfg_state->events);
     if(events & BIT_STOPPED){
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
     }
 
-    xEventGroupSetBits(wifi_events, (BIT_SCAN_START | BIT_TRIGGER));
+    xEventGroupSetBits(cfg_state->events, (BIT_SCAN_START | BIT_TRIGGER));
 
 #if !defined(CONFIG_WMNGR_TASK)
-    if(xTimerChangePeriod(config_timer, CFG_DELAY, CFG_DELAY) != pdPASS){
-        cfg_state.state = wmngr_state_failed;
+    if(xTimerChangePeriod(cfg_state->timer, CFG_DELAY, CFG_DELAY) != pdPASS){
+        set_state(cfg_state, wmngr_state_failed);
         result = ESP_FAIL;
     }
 #endif
@@ -1743,36 +3148,112 @@ on_exit:
     return result;
 }
 
+/** Re-evaluate the SoftAP channel.
+ *
+ * Triggers a scan and moves the SoftAP to the least congested channel
+ * once it has completed. This only has an effect if the AP channel in
+ * the config is 0 and the device is in APSTA mode without connecting
+ * the STA. Otherwise the channel is either fixed or follows the STA.
+ * The congestion data can be read with #esp_wmngr_get_chan_survey.
+ *
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_select_ap_channel(void)
+{
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+    struct wifi_cfg_state *cfg_state = &default_state;
+
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+
+    if(xEventGroupGetBits(cfg_state->events) & BIT_STOPPED){
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xEventGroupSetBits(cfg_state->events, BIT_CHAN_SELECT);
+
+    return esp_wmngr_start_scan();
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/** Bring the SoftAP back on.
+ *
+ * Meant to be called from a button or GPIO handler. If the SoftAP has
+ * been switched off because the STA connection was stable, it is turned
+ * back on and stays on for another CONFIG_WMNGR_AP_OFF_DELAY seconds of
+ * stable STA connection.
+ *
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_request_ap(void)
+{
+#if defined(CONFIG_WMNGR_AP_AUTO_OFF)
+    struct wifi_cfg_state *cfg_state = &default_state;
+
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+
+    if(xEventGroupGetBits(cfg_state->events) & BIT_STOPPED){
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xEventGroupSetBits(cfg_state->events, (BIT_AP_REQUEST | BIT_TRIGGER));
+
+#if !defined(CONFIG_WMNGR_TASK)
+    if(xTimerChangePeriod(cfg_state->timer, CFG_DELAY, CFG_DELAY) != pdPASS){
+        set_state(cfg_state, wmngr_state_failed);
+        return ESP_FAIL;
+    }
+#endif
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
 /** Get a pointer to a set of AP scan data.
  *
  * Fetches a reference counted pointer to the latest set of AP scan
  * data. Caller must at some point release the data by calling
  * #esp_wmngr_put_scan.
  *
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return Pointer to a #scan_data or NULL
  */
-struct scan_data *esp_wmngr_get_scan(void)
+struct scan_data *esp_wmngr_get_scan_ex(TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     struct scan_data *data;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
     data = NULL;
-    if(cfg_state.scan_ref == NULL){
+    if(cfg_state->scan_ref == NULL){
         goto on_exit;
     }
 
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) == pdTRUE){
-        data = &(cfg_state.scan_ref->data);
-        kref_get(&(cfg_state.scan_ref->ref_cnt));
-        xSemaphoreGive(cfg_state.lock);
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_get_scan)
+       == pdTRUE)
+    {
+        data = &(cfg_state->scan_ref->data);
+        kref_get(&(cfg_state->scan_ref->ref_cnt));
+        WMNGR_LOCK_GIVE(cfg_state->lock);
     }
 
 on_exit:
     return data;
 }
 
+/** Same as #esp_wmngr_get_scan_ex with the default timeout.
+ */
+struct scan_data *esp_wmngr_get_scan(void)
+{
+    return esp_wmngr_get_scan_ex(API_TIMEOUT);
+}
+
 /** Drop a reference to a scan data set, possibly freeing it.
  * @param[in] data Reference to scan data set.
  * @return Void
@@ -1792,23 +3273,41 @@ void esp_wmngr_put_scan(struct scan_data *data)
  */
 bool esp_wmngr_is_connected(void)
 {
-    return sta_connected();
+    return sta_connected(&default_state);
 }
 
 /** Connect to currently configured AP.
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK on success, ESP_ERR_* otherwise
  */
+esp_err_t esp_wmngr_connect_ex(TickType_t timeout)
+{
+    return set_connect(&default_state, true, timeout);
+}
+
+/** Same as #esp_wmngr_connect_ex with the default timeout.
+ */
 esp_err_t esp_wmngr_connect(void)
 {
-    return set_connect(true);
+    return set_connect(&default_state, true, API_TIMEOUT);
 }
 
 /** Disconnect from currently configured AP.
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK on success, ESP_ERR_* otherwise
  */
+esp_err_t esp_wmngr_disconnect_ex(TickType_t timeout)
+{
+    return set_connect(&default_state, false, timeout);
+}
+
+/** Same as #esp_wmngr_disconnect_ex with the default timeout.
+ */
 esp_err_t esp_wmngr_disconnect(void)
 {
-    return set_connect(false);
+    return set_connect(&default_state, false, API_TIMEOUT);
 }
 
 /** Fetch current WiFI Manager state.
@@ -1816,7 +3315,7 @@ esp_err_t esp_wmngr_disconnect(void)
  */
 enum wmngr_state esp_wmngr_get_state(void)
 {
-    return cfg_state.state;
+    return default_state.state;
 }
 
 /** Check if a valid configuration is stored in NVS.
@@ -1836,21 +3335,26 @@ bool esp_wmngr_nvs_valid(void)
  *
  * Clear and reset the stored and loaded configuration to compile time
  * defaults. WiFi Manager must be in state #wmngr_state_stopped.
+ * @param[in] timeout Ticks to wait for the WiFi Manager's lock, 0 to
+ *            try once.
  * @return ESP_OK on success, ESP_ERR_* otherwise.
  */
-esp_err_t esp_wmngr_reset_cfg(void)
+esp_err_t esp_wmngr_reset_cfg_ex(TickType_t timeout)
 {
+    struct wifi_cfg_state *cfg_state = &default_state;
     esp_err_t result;
 
-    configASSERT(cfg_state.state != wmngr_state_deinit);
-    configASSERT(cfg_state.lock != NULL);
+    configASSERT(cfg_state->state != wmngr_state_deinit);
+    configASSERT(cfg_state->lock != NULL);
 
-    if(xSemaphoreTake(cfg_state.lock, CFG_DELAY) != pdTRUE){
+    if(WMNGR_LOCK_TAKE(cfg_state->lock, timeout, wmngr_lock_reset_cfg)
+       != pdTRUE)
+    {
         ESP_LOGE(TAG, "[%s] Error taking mutex.", __func__);
         return ESP_ERR_TIMEOUT;
     }
 
-    if(cfg_state.state != wmngr_state_stopped){
+    if(cfg_state->state != wmngr_state_stopped){
         ESP_LOGW(TAG, "[%s] WiFi Manager not stopped.", __func__);
         result = ESP_ERR_INVALID_STATE;
         goto on_exit;
@@ -1862,14 +3366,21 @@ esp_err_t esp_wmngr_reset_cfg(void)
         goto on_exit;
     }
 
-    result = load_config();
+    result = load_config(cfg_state);
     if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] load_config() failed\n", __func__);
+        ESP_LOGE(TAG, "[%s] load_config(cfg_state) failed\n", __func__);
         goto on_exit;
     }
 
 on_exit:
-    xSemaphoreGive(cfg_state.lock);
+    WMNGR_LOCK_GIVE(cfg_state->lock);
 
     return result;
 }
+
+/** Same as #esp_wmngr_reset_cfg_ex with the default timeout.
+ */
+esp_err_t esp_wmngr_reset_cfg(void)
+{
+    return esp_wmngr_reset_cfg_ex(API_TIMEOUT);
+}
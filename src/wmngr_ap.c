@@ -0,0 +1,409 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_ap.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_log.h"
+
+#include "kutils.h"
+
+#if defined(CONFIG_WMNGR_AP_CLIENTS)
+
+static const char *TAG = "wmngr_ap";
+
+/* How often the driver's station list is read for RSSI updates. */
+#define AP_POLL_INTERVAL    pdMS_TO_TICKS(10 * 1000)
+/* Stations idle for less than this are never displaced. */
+#define AP_DISPLACE_IDLE    pdMS_TO_TICKS(60 * 1000)
+#define AP_IDLE_MIN         10
+
+_Static_assert(CONFIG_WMNGR_AP_MAX_CLIENTS <= ESP_WIFI_MAX_CONN_NUM,
+               "CONFIG_WMNGR_AP_MAX_CLIENTS exceeds the driver's limit");
+
+static portMUX_TYPE ap_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_ap_client clients[ESP_WIFI_MAX_CONN_NUM];
+static struct wmngr_ap_stats ap_stats;
+static unsigned int ap_max_clients = CONFIG_WMNGR_AP_MAX_CLIENTS;
+static unsigned int ap_idle_s = CONFIG_WMNGR_AP_IDLE_TIMEOUT;
+static TimerHandle_t ap_timer = NULL;
+static bool ap_running;
+
+/* Must be called with ap_lock held. */
+static int find_client(const uint8_t *mac)
+{
+    unsigned int idx;
+
+    for(idx = 0; idx < ap_stats.clients; ++idx){
+        if(memcmp(clients[idx].mac, mac, sizeof(clients[idx].mac)) == 0){
+            return idx;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Find the station that has been idle the longest, skipping those whose
+ * bit is set in skip. Only stations idle for at least min_idle ticks
+ * qualify. Must be called with ap_lock held.
+ */
+static int find_idlest(TickType_t now, TickType_t min_idle, uint32_t skip)
+{
+    unsigned int idx;
+    int victim;
+
+    victim = -1;
+    for(idx = 0; idx < ap_stats.clients; ++idx){
+        if((skip & (1 << idx)) || now - clients[idx].last_active < min_idle){
+            continue;
+        }
+
+        if(victim < 0 || time_after(clients[victim].last_active,
+                                    clients[idx].last_active))
+        {
+            victim = idx;
+        }
+    }
+
+    return victim;
+}
+
+/*
+ * The driver drops stations that stay silent for the inactive time by
+ * itself. In between, a changing RSSI tells us that frames have been
+ * received from a station, which is the best activity hint we get.
+ */
+static void ap_poll(TimerHandle_t timer)
+{
+    wifi_sta_list_t list;
+    TickType_t now;
+    unsigned int idx;
+    int pos;
+
+    if(esp_wifi_ap_get_sta_list(&list) != ESP_OK){
+        return;
+    }
+
+    now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&ap_lock);
+    for(idx = 0; idx < (unsigned int) list.num; ++idx){
+        pos = find_client(list.sta[idx].mac);
+        if(pos < 0){
+            continue;
+        }
+
+        if(clients[pos].rssi != list.sta[idx].rssi){
+            clients[pos].rssi = list.sta[idx].rssi;
+            clients[pos].last_active = now;
+        }
+    }
+    portEXIT_CRITICAL(&ap_lock);
+}
+
+static void ap_start(void)
+{
+    esp_err_t result;
+
+    if(ap_timer == NULL){
+        ap_timer = xTimerCreate("WMngr_AP", AP_POLL_INTERVAL, pdTRUE, NULL,
+                                ap_poll);
+        if(ap_timer == NULL){
+            ESP_LOGE(TAG, "[%s] Creating timer failed.", __func__);
+        }
+    }
+
+    portENTER_CRITICAL(&ap_lock);
+    ap_running = true;
+    ap_stats.clients = 0;
+    portEXIT_CRITICAL(&ap_lock);
+
+    result = esp_wifi_set_inactive_time(WIFI_IF_AP, ap_idle_s);
+    if(result != ESP_OK){
+        ESP_LOGW(TAG, "[%s] Setting inactive time failed: %s",
+                 __func__, esp_err_to_name(result));
+    }
+
+    if(ap_timer != NULL){
+        (void) xTimerStart(ap_timer, 0);
+    }
+}
+
+static void ap_stop(void)
+{
+    if(ap_timer != NULL){
+        (void) xTimerStop(ap_timer, 0);
+    }
+
+    portENTER_CRITICAL(&ap_lock);
+    ap_running = false;
+    ap_stats.clients = 0;
+    portEXIT_CRITICAL(&ap_lock);
+}
+
+static void client_join(const wifi_event_ap_staconnected_t *evt)
+{
+    struct wmngr_ap_client *client;
+    TickType_t now;
+    int pos;
+
+    now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&ap_lock);
+    pos = find_client(evt->mac);
+    if(pos < 0){
+        if(ap_stats.clients >= ARRAY_SIZE(clients)){
+            portEXIT_CRITICAL(&ap_lock);
+            return;
+        }
+        pos = ap_stats.clients++;
+    }
+
+    client = &clients[pos];
+    memset(client, 0x0, sizeof(*client));
+    memcpy(client->mac, evt->mac, sizeof(client->mac));
+    client->aid = evt->aid;
+    client->connected = now;
+    client->last_active = now;
+
+    ++ap_stats.joins;
+    ap_stats.peak = MAX(ap_stats.peak, ap_stats.clients);
+    portEXIT_CRITICAL(&ap_lock);
+}
+
+static void client_leave(const wifi_event_ap_stadisconnected_t *evt)
+{
+    int pos;
+
+    portENTER_CRITICAL(&ap_lock);
+    pos = find_client(evt->mac);
+    if(pos >= 0){
+        clients[pos] = clients[--ap_stats.clients];
+        ++ap_stats.leaves;
+    }
+    portEXIT_CRITICAL(&ap_lock);
+}
+
+static void client_got_ip(const ip_event_ap_staipassigned_t *evt)
+{
+    int pos;
+
+    portENTER_CRITICAL(&ap_lock);
+    pos = find_client(evt->mac);
+    if(pos >= 0){
+        clients[pos].ip = evt->ip.addr;
+        clients[pos].last_active = xTaskGetTickCount();
+    }
+    portEXIT_CRITICAL(&ap_lock);
+}
+
+/*
+ * Called from the WiFi Manager's event handler, even while the manager
+ * is stopped, since the SoftAP keeps running.
+ */
+void wmngr_ap_event(esp_event_base_t base, int32_t id, void *data)
+{
+    if(base == WIFI_EVENT){
+        switch(id){
+        case WIFI_EVENT_AP_START:
+            ap_start();
+            break;
+        case WIFI_EVENT_AP_STOP:
+            ap_stop();
+            break;
+        case WIFI_EVENT_AP_STACONNECTED:
+            client_join(data);
+            break;
+        case WIFI_EVENT_AP_STADISCONNECTED:
+            client_leave(data);
+            break;
+        default:
+            break;
+        }
+    } else if(base == IP_EVENT && id == IP_EVENT_AP_STAIPASSIGNED){
+        client_got_ip(data);
+    }
+}
+
+/* Client limit handed to the driver with the AP config. */
+unsigned int wmngr_ap_max_clients(void)
+{
+    unsigned int max_clients;
+
+    portENTER_CRITICAL(&ap_lock);
+    max_clients = ap_max_clients;
+    portEXIT_CRITICAL(&ap_lock);
+
+    return max_clients;
+}
+
+/** Change the SoftAP client limit and idle timeout at runtime.
+ *
+ * Stations that are silent for idle_s seconds are dropped by the driver.
+ * The driver turns away stations beyond the client limit when they try
+ * to associate. A new limit reaches the driver the next time the WiFi
+ * Manager applies the AP config, the AP is not restarted for it.
+ * Lowering the limit below the number of connected stations removes
+ * the excess stations right away, longest idle first, but only those
+ * idle for at least a minute.
+ *
+ * @param[in] max_clients Number of stations, 1 to ESP_WIFI_MAX_CONN_NUM.
+ * @param[in] idle_s Idle timeout in seconds, at least 10.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_set_ap_limits(unsigned int max_clients,
+                                  unsigned int idle_s)
+{
+    uint16_t aids[ESP_WIFI_MAX_CONN_NUM];
+    unsigned int idx, num;
+    esp_err_t result;
+    TickType_t now;
+    uint32_t picked;
+    bool running;
+    int victim;
+
+    if(max_clients < 1 || max_clients > ESP_WIFI_MAX_CONN_NUM
+       || idle_s < AP_IDLE_MIN || idle_s > UINT16_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    now = xTaskGetTickCount();
+    picked = 0;
+    num = 0;
+
+    portENTER_CRITICAL(&ap_lock);
+    ap_max_clients = max_clients;
+    ap_idle_s = idle_s;
+    running = ap_running;
+
+    /* Only pick the victims, the disconnect events remove them. */
+    while(ap_stats.clients - num > ap_max_clients){
+        victim = find_idlest(now, AP_DISPLACE_IDLE, picked);
+        if(victim < 0){
+            break;
+        }
+        picked |= 1 << victim;
+        aids[num++] = clients[victim].aid;
+        ++ap_stats.displaced;
+    }
+    portEXIT_CRITICAL(&ap_lock);
+
+    result = ESP_OK;
+    if(running){
+        result = esp_wifi_set_inactive_time(WIFI_IF_AP, idle_s);
+    }
+
+    for(idx = 0; idx < num; ++idx){
+        ESP_LOGI(TAG, "[%s] Removing station %u.", __func__, aids[idx]);
+        (void) esp_wifi_deauth_sta(aids[idx]);
+    }
+
+    return result;
+}
+
+/** Read the current SoftAP client limit and idle timeout.
+ * @param[out] max_clients Number of stations allowed, may be NULL.
+ * @param[out] idle_s Idle timeout in seconds, may be NULL.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_ap_limits(unsigned int *max_clients,
+                                  unsigned int *idle_s)
+{
+    portENTER_CRITICAL(&ap_lock);
+    if(max_clients != NULL){
+        *max_clients = ap_max_clients;
+    }
+    if(idle_s != NULL){
+        *idle_s = ap_idle_s;
+    }
+    portEXIT_CRITICAL(&ap_lock);
+
+    return ESP_OK;
+}
+
+/** Copy the table of stations connected to the SoftAP.
+ * @param[out] buf Destination array.
+ * @param[in] num Number of entries in buf.
+ * @return Number of stations copied.
+ */
+size_t esp_wmngr_get_ap_clients(struct wmngr_ap_client *buf, size_t num)
+{
+    if(buf == NULL){
+        return 0;
+    }
+
+    portENTER_CRITICAL(&ap_lock);
+    num = MIN(num, ap_stats.clients);
+    memcpy(buf, clients, num * sizeof(*buf));
+    portEXIT_CRITICAL(&ap_lock);
+
+    return num;
+}
+
+/** Fetch the SoftAP client counters.
+ * @param[out] stats Client counters.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_ap_stats(struct wmngr_ap_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&ap_lock);
+    memcpy(stats, &ap_stats, sizeof(*stats));
+    portEXIT_CRITICAL(&ap_lock);
+
+    return ESP_OK;
+}
+
+#else /* defined(CONFIG_WMNGR_AP_CLIENTS) */
+
+esp_err_t esp_wmngr_set_ap_limits(unsigned int max_clients,
+                                  unsigned int idle_s)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wmngr_get_ap_limits(unsigned int *max_clients,
+                                  unsigned int *idle_s)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t esp_wmngr_get_ap_clients(struct wmngr_ap_client *buf, size_t num)
+{
+    return 0;
+}
+
+esp_err_t esp_wmngr_get_ap_stats(struct wmngr_ap_stats *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_AP_CLIENTS) */
@@ -0,0 +1,431 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_cfg.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "lwip/ip4.h"
+#include "lwip/ip_addr.h"
+
+#include "kutils.h"
+
+static bool ap_cfg_equal(const wifi_ap_config_t *a, const wifi_ap_config_t *b)
+{
+    size_t len;
+
+    /* A zero ssid_len means the SSID is NUL terminated. */
+    if(a->ssid_len != b->ssid_len){
+        return false;
+    }
+
+    len = (a->ssid_len > 0) ? MIN(a->ssid_len, sizeof(a->ssid))
+                            : sizeof(a->ssid);
+    if(strncmp((const char *) a->ssid, (const char *) b->ssid, len)){
+        return false;
+    }
+
+    return a->channel == b->channel
+           && a->authmode == b->authmode
+           && a->ssid_hidden == b->ssid_hidden
+           && a->max_connection == b->max_connection
+           && a->beacon_interval == b->beacon_interval
+           && a->pairwise_cipher == b->pairwise_cipher
+           && a->ftm_responder == b->ftm_responder
+           && a->pmf_cfg.capable == b->pmf_cfg.capable
+           && a->pmf_cfg.required == b->pmf_cfg.required
+           && !strncmp((const char *) a->password, (const char *) b->password,
+                       sizeof(a->password));
+}
+
+static bool sta_cfg_equal(const wifi_sta_config_t *a,
+                          const wifi_sta_config_t *b)
+{
+    if(a->bssid_set != b->bssid_set
+       || (a->bssid_set && memcmp(a->bssid, b->bssid, sizeof(a->bssid))))
+    {
+        return false;
+    }
+
+    return a->scan_method == b->scan_method
+           && a->channel == b->channel
+           && a->listen_interval == b->listen_interval
+           && a->sort_method == b->sort_method
+           && a->threshold.rssi == b->threshold.rssi
+           && a->threshold.authmode == b->threshold.authmode
+           && a->pmf_cfg.capable == b->pmf_cfg.capable
+           && a->pmf_cfg.required == b->pmf_cfg.required
+           && a->rm_enabled == b->rm_enabled
+           && a->btm_enabled == b->btm_enabled
+           && a->mbo_enabled == b->mbo_enabled
+           && a->ft_enabled == b->ft_enabled
+           && a->owe_enabled == b->owe_enabled
+           && a->transition_disable == b->transition_disable
+           && a->sae_pwe_h2e == b->sae_pwe_h2e
+           && a->failure_retry_cnt == b->failure_retry_cnt
+           && !strncmp((const char *) a->ssid, (const char *) b->ssid,
+                       sizeof(a->ssid))
+           && !strncmp((const char *) a->password, (const char *) b->password,
+                       sizeof(a->password));
+}
+
+static bool ip_info_equal(const esp_netif_ip_info_t *a,
+                          const esp_netif_ip_info_t *b)
+{
+    return ip4_addr_cmp(&(a->ip), &(b->ip))
+           && ip4_addr_cmp(&(a->netmask), &(b->netmask))
+           && ip4_addr_cmp(&(a->gw), &(b->gw));
+}
+
+/** Find the parts in which two WiFi configurations differ.
+ *
+ * Only the parts relevant to the configs' modes are compared, e.g. AP
+ * settings are ignored in STA mode and static IP settings when using
+ * DHCP. Strings are compared up to their terminating NUL, so stale bytes
+ * behind them or in unused parts of the wifi_config_t unions do not count
+ * as a change.
+ *
+ * @param[in] a First configuration.
+ * @param[in] b Second configuration.
+ * @return Mask of WMNGR_CFG_* bits, 0 if the configs are equivalent.
+ */
+uint32_t wmngr_cfg_diff(const struct wifi_cfg *a, const struct wifi_cfg *b)
+{
+    unsigned int idx;
+    uint32_t diff;
+
+    diff = 0;
+
+    if(a->mode != b->mode){
+        diff |= WMNGR_CFG_MODE;
+    }
+
+    if(a->mode == WIFI_MODE_AP || a->mode == WIFI_MODE_APSTA
+       || b->mode == WIFI_MODE_AP || b->mode == WIFI_MODE_APSTA)
+    {
+        if(!ip4_addr_cmp(&(a->ap_ip_info.ip), &(b->ap_ip_info.ip))){
+            diff |= WMNGR_CFG_AP_IP;
+        }
+
+        if(!ap_cfg_equal(&(a->ap.ap), &(b->ap.ap))){
+            diff |= WMNGR_CFG_AP;
+        }
+    }
+
+    if((a->mode == WIFI_MODE_STA || a->mode == WIFI_MODE_APSTA
+        || b->mode == WIFI_MODE_STA || b->mode == WIFI_MODE_APSTA)
+       && !sta_cfg_equal(&(a->sta.sta), &(b->sta.sta)))
+    {
+        diff |= WMNGR_CFG_STA;
+    }
+
+    if(a->sta_connect != b->sta_connect){
+        diff |= WMNGR_CFG_STA_CONNECT;
+    }
+
+    if(strncmp(a->country, b->country, sizeof(a->country))
+       || a->chan_first != b->chan_first
+       || a->chan_num != b->chan_num)
+    {
+        diff |= WMNGR_CFG_COUNTRY;
+    }
+
+    if(a->sta_static != b->sta_static){
+        diff |= WMNGR_CFG_STA_IP;
+    } else if(a->sta_static){
+        if(!ip_info_equal(&(a->sta_ip_info), &(b->sta_ip_info))){
+            diff |= WMNGR_CFG_STA_IP;
+        }
+
+        for(idx = 0; idx < ARRAY_SIZE(a->sta_dns_info); ++idx){
+            if(!ip_addr_cmp(&(a->sta_dns_info[idx].ip),
+                            &(b->sta_dns_info[idx].ip)))
+            {
+                diff |= WMNGR_CFG_STA_IP;
+            }
+        }
+    }
+
+    return diff;
+}
+
+/** Copy the fields selected by a field mask from one config to another.
+ *
+ * @param[in,out] cfg Configuration to be changed.
+ * @param[in] patch Configuration holding the new field values.
+ * @param[in] mask WMNGR_CFG_* bits selecting the fields to copy.
+ * @return Mask of the WMNGR_CFG_* parts of cfg that have been touched.
+ */
+uint32_t wmngr_cfg_patch(struct wifi_cfg *cfg, const struct wifi_cfg *patch,
+                         uint32_t mask)
+{
+    uint32_t parts;
+
+    parts = mask & WMNGR_CFG_ALL;
+
+    if(mask & WMNGR_CFG_MODE){
+        cfg->mode = patch->mode;
+    }
+
+    if(mask & WMNGR_CFG_AP){
+        memcpy(&(cfg->ap), &(patch->ap), sizeof(cfg->ap));
+    }
+
+    if(mask & WMNGR_CFG_AP_IP){
+        memcpy(&(cfg->ap_ip_info), &(patch->ap_ip_info),
+               sizeof(cfg->ap_ip_info));
+    }
+
+    if(mask & WMNGR_CFG_STA){
+        memcpy(&(cfg->sta), &(patch->sta), sizeof(cfg->sta));
+    }
+
+    if(mask & WMNGR_CFG_STA_IP){
+        cfg->sta_static = patch->sta_static;
+        memcpy(&(cfg->sta_ip_info), &(patch->sta_ip_info),
+               sizeof(cfg->sta_ip_info));
+        memcpy(cfg->sta_dns_info, patch->sta_dns_info,
+               sizeof(cfg->sta_dns_info));
+    }
+
+    if(mask & WMNGR_CFG_STA_CONNECT){
+        cfg->sta_connect = patch->sta_connect;
+    }
+
+    if(mask & WMNGR_CFG_COUNTRY){
+        memcpy(cfg->country, patch->country, sizeof(cfg->country));
+        cfg->chan_first = patch->chan_first;
+        cfg->chan_num = patch->chan_num;
+    }
+
+    if(mask & WMNGR_CFG_STA_SSID){
+        memcpy(cfg->sta.sta.ssid, patch->sta.sta.ssid,
+               sizeof(cfg->sta.sta.ssid));
+        parts |= WMNGR_CFG_STA;
+    }
+
+    if(mask & WMNGR_CFG_STA_PASSWORD){
+        memcpy(cfg->sta.sta.password, patch->sta.sta.password,
+               sizeof(cfg->sta.sta.password));
+        parts |= WMNGR_CFG_STA;
+    }
+
+    if(mask & WMNGR_CFG_AP_SSID){
+        memcpy(cfg->ap.ap.ssid, patch->ap.ap.ssid, sizeof(cfg->ap.ap.ssid));
+        cfg->ap.ap.ssid_len = patch->ap.ap.ssid_len;
+        parts |= WMNGR_CFG_AP;
+    }
+
+    if(mask & WMNGR_CFG_AP_PASSWORD){
+        memcpy(cfg->ap.ap.password, patch->ap.ap.password,
+               sizeof(cfg->ap.ap.password));
+        parts |= WMNGR_CFG_AP;
+    }
+
+    return parts;
+}
+
+#if defined(CONFIG_WMNGR_BENCH)
+
+static const char *TAG = "wmngr_bench";
+
+/* The comparison used before wmngr_cfg_diff(), kept as a reference. */
+static bool bench_memcmp(const struct wifi_cfg *a, const struct wifi_cfg *b)
+{
+    if(a->mode != b->mode){
+        return false;
+    }
+
+    if((a->mode == WIFI_MODE_AP || a->mode == WIFI_MODE_APSTA)
+       && (!ip4_addr_cmp(&(a->ap_ip_info.ip), &(b->ap_ip_info.ip))
+           || memcmp(&(a->ap), &(b->ap), sizeof(a->ap))))
+    {
+        return false;
+    }
+
+    if((a->mode == WIFI_MODE_STA || a->mode == WIFI_MODE_APSTA)
+       && memcmp(&(a->sta), &(b->sta), sizeof(a->sta)))
+    {
+        return false;
+    }
+
+    return a->sta_connect == b->sta_connect
+           && a->sta_static == b->sta_static
+           && (!a->sta_static
+               || (!memcmp(&(a->sta_ip_info), &(b->sta_ip_info),
+                           sizeof(a->sta_ip_info))
+                   && !memcmp(a->sta_dns_info, b->sta_dns_info,
+                              sizeof(a->sta_dns_info))));
+}
+
+/*
+ * FNV-1a hash over all bytes of a config. Comparing cached fingerprints
+ * is the candidate for a cheap "anything changed?" check. Like memcmp()
+ * it sees bytes the driver ignores, and equal fingerprints still need a
+ * full compare to rule out collisions.
+ */
+static uint32_t bench_fingerprint(const struct wifi_cfg *cfg)
+{
+    const uint8_t *data;
+    uint32_t hash;
+    size_t idx;
+
+    data = (const uint8_t *) cfg;
+    hash = 2166136261U;
+    for(idx = 0; idx < sizeof(*cfg); ++idx){
+        hash ^= data[idx];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/* Configs under test, with their fingerprints cached. */
+struct bench_cfgs {
+    struct wifi_cfg a;
+    struct wifi_cfg b;
+    uint32_t fp_a;
+    uint32_t fp_b;
+};
+
+typedef uint32_t (*bench_fn)(struct bench_cfgs *cfgs);
+
+static uint32_t run_memcmp(struct bench_cfgs *cfgs)
+{
+    return !bench_memcmp(&cfgs->a, &cfgs->b);
+}
+
+static uint32_t run_diff(struct bench_cfgs *cfgs)
+{
+    return wmngr_cfg_diff(&cfgs->a, &cfgs->b);
+}
+
+static uint32_t run_fp_compare(struct bench_cfgs *cfgs)
+{
+    return cfgs->fp_a != cfgs->fp_b;
+}
+
+static uint32_t run_fp_update(struct bench_cfgs *cfgs)
+{
+    cfgs->fp_b = bench_fingerprint(&cfgs->b);
+    return cfgs->fp_b;
+}
+
+static uint32_t run_copy(struct bench_cfgs *cfgs)
+{
+    memcpy(&cfgs->b, &cfgs->a, sizeof(cfgs->b));
+    return cfgs->b.mode;
+}
+
+static void bench(const char *name, bench_fn fn, struct bench_cfgs *cfgs,
+                  unsigned int iterations)
+{
+    volatile uint32_t sink;
+    unsigned int idx;
+    int64_t start;
+    uint32_t ns;
+
+    start = esp_timer_get_time();
+    for(idx = 0; idx < iterations; ++idx){
+        sink = fn(cfgs);
+    }
+    ns = (uint32_t) ((esp_timer_get_time() - start) * 1000 / iterations);
+    (void) sink;
+
+    ESP_LOGI(TAG, "%-28s %8" PRIu32 " ns/op", name, ns);
+}
+
+static void bench_compare(struct bench_cfgs *cfgs, unsigned int iterations)
+{
+    cfgs->fp_a = bench_fingerprint(&cfgs->a);
+    cfgs->fp_b = bench_fingerprint(&cfgs->b);
+
+    bench("memcmp compare", run_memcmp, cfgs, iterations);
+    bench("field diff", run_diff, cfgs, iterations);
+    bench("fingerprint compare", run_fp_compare, cfgs, iterations);
+}
+
+/** Benchmark the config comparison and copy primitives.
+ *
+ * Times the previous whole-union memcmp() comparison, wmngr_cfg_diff()
+ * and a compare of cached fingerprints on two equal APSTA configs, then
+ * on configs differing in the STA's PMF setting. Also times updating a
+ * fingerprint and a plain memcpy() of a struct wifi_cfg. Results are
+ * logged in ns per operation.
+ *
+ * @param[in] iterations Number of calls timed per primitive.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_bench_cfg(unsigned int iterations)
+{
+    struct bench_cfgs *cfgs;
+    struct wifi_cfg *a;
+    esp_err_t result;
+
+    if(iterations == 0){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    result = ESP_OK;
+    cfgs = calloc(1, sizeof(*cfgs));
+    if(cfgs == NULL){
+        result = ESP_ERR_NO_MEM;
+        goto on_exit;
+    }
+
+    a = &cfgs->a;
+    a->mode = WIFI_MODE_APSTA;
+    a->sta_connect = true;
+    strcpy((char *) a->ap.ap.ssid, "ESP WiFi Manager");
+    a->ap.ap.authmode = WIFI_AUTH_OPEN;
+    a->ap.ap.max_connection = 3;
+    strcpy((char *) a->sta.sta.ssid, "Benchmark AP");
+    strcpy((char *) a->sta.sta.password, "benchmark password");
+    memcpy(&cfgs->b, a, sizeof(cfgs->b));
+
+    ESP_LOGI(TAG, "Equal configs, %u iterations:", iterations);
+    bench_compare(cfgs, iterations);
+
+    cfgs->b.sta.sta.pmf_cfg.required = true;
+    ESP_LOGI(TAG, "Configs differing in STA PMF setting:");
+    bench_compare(cfgs, iterations);
+
+    bench("fingerprint update", run_fp_update, cfgs, iterations);
+    bench("memcpy struct wifi_cfg", run_copy, cfgs, iterations);
+
+on_exit:
+    free(cfgs);
+
+    return result;
+}
+
+#else /* defined(CONFIG_WMNGR_BENCH) */
+
+esp_err_t esp_wmngr_bench_cfg(unsigned int iterations)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_BENCH) */
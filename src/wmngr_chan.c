@@ -0,0 +1,171 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_chan.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#if defined(CONFIG_WMNGR_AUTO_CHANNEL)
+
+static const char *TAG = "wmngr_chan";
+
+/*
+ * Channels are 5 MHz apart, so a 20 MHz transmission spans 4 channel
+ * widths and a 40 MHz one 8.
+ */
+#define SPAN_HT20       4
+#define SPAN_HT40       8
+
+/* RSSI range mapped onto AP weights 1 to RSSI_STRONG - RSSI_FLOOR. */
+#define RSSI_FLOOR      (-95)
+#define RSSI_STRONG     (-35)
+
+static portMUX_TYPE chan_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_chan_survey last_survey;
+
+/*
+ * Overlap of a 20 MHz AP on a channel with a transmission of the given
+ * span, in quarters of 20 MHz. Positions are passed as doubled channel
+ * numbers, so the center of a 40 MHz transmission between two channels
+ * can be represented. In these units a span is also half the width.
+ */
+static unsigned int overlap(int chan2, int center2, int span)
+{
+    int lo, hi;
+
+    lo = MAX(chan2 - SPAN_HT20, center2 - span);
+    hi = MIN(chan2 + SPAN_HT20, center2 + span);
+
+    return (hi > lo) ? (hi - lo) / 2 : 0;
+}
+
+/*
+ * Louder APs count more. Weighting is linear in dB, which is crude but
+ * keeps a single close AP from dwarfing a crowd of distant ones.
+ */
+static uint32_t weight(int8_t rssi)
+{
+    return MIN(MAX(rssi, RSSI_FLOOR + 1), RSSI_STRONG) - RSSI_FLOOR;
+}
+
+/*
+ * Compute the congestion of each channel from a scan and remember it
+ * for esp_wmngr_get_chan_survey(). Every AP adds its weight times the
+ * fraction of spectrum it shares with a 20 MHz AP on that channel. Ties
+ * go to the channel with fewer APs on it. Returns the best channel
+ * allowed by the current country setting, 0 if there is none.
+ */
+uint8_t wmngr_chan_survey(const struct scan_data *data)
+{
+    struct wmngr_chan_survey survey;
+    const wifi_ap_record_t *rec;
+    wifi_country_t country;
+    unsigned int idx, chan;
+    int center2, span;
+    uint32_t w;
+
+    memset(&survey, 0x0, sizeof(survey));
+    survey.tstamp = data->tstamp;
+
+    survey.first = 1;
+    survey.num = 11;
+    if(esp_wifi_get_country(&country) == ESP_OK && country.schan > 0){
+        survey.first = country.schan;
+        survey.num = country.nchan;
+    }
+    survey.num = MIN(survey.num, WMNGR_CHAN_NUM + 1 - survey.first);
+
+    for(idx = 0; idx < data->num_records; ++idx){
+        rec = &data->ap_records[idx];
+        if(rec->primary < 1 || rec->primary > WMNGR_CHAN_NUM){
+            continue;
+        }
+
+        ++survey.aps[rec->primary - 1];
+
+        center2 = 2 * rec->primary;
+        span = SPAN_HT20;
+        if(rec->second == WIFI_SECOND_CHAN_ABOVE){
+            center2 += SPAN_HT40 / 2;
+            span = SPAN_HT40;
+        } else if(rec->second == WIFI_SECOND_CHAN_BELOW){
+            center2 -= SPAN_HT40 / 2;
+            span = SPAN_HT40;
+        }
+
+        w = weight(rec->rssi);
+        for(chan = 1; chan <= WMNGR_CHAN_NUM; ++chan){
+            survey.load[chan - 1] += w * overlap(2 * chan, center2, span);
+        }
+    }
+
+    for(chan = survey.first; chan < survey.first + survey.num; ++chan){
+        if(survey.best == 0
+           || survey.load[chan - 1] < survey.load[survey.best - 1]
+           || (   survey.load[chan - 1] == survey.load[survey.best - 1]
+               && survey.aps[chan - 1] < survey.aps[survey.best - 1]))
+        {
+            survey.best = chan;
+        }
+    }
+
+    if(survey.best != 0){
+        ESP_LOGI(TAG, "[%s] Channel %u has load %" PRIu32 " from %u APs.",
+                 __func__, survey.best, survey.load[survey.best - 1],
+                 survey.aps[survey.best - 1]);
+    }
+
+    portENTER_CRITICAL(&chan_lock);
+    memcpy(&last_survey, &survey, sizeof(last_survey));
+    portEXIT_CRITICAL(&chan_lock);
+
+    return survey.best;
+}
+
+/** Fetch the channel congestion computed from the last scan.
+ * @param[out] survey Per channel AP counts and congestion.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no survey has been done.
+ */
+esp_err_t esp_wmngr_get_chan_survey(struct wmngr_chan_survey *survey)
+{
+    if(survey == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&chan_lock);
+    memcpy(survey, &last_survey, sizeof(*survey));
+    portEXIT_CRITICAL(&chan_lock);
+
+    return (survey->num > 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+#else /* defined(CONFIG_WMNGR_AUTO_CHANNEL) */
+
+esp_err_t esp_wmngr_get_chan_survey(struct wmngr_chan_survey *survey)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_AUTO_CHANNEL) */
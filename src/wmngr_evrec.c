@@ -0,0 +1,514 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_evrec.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_wifi_types.h"
+#include "esp_eth.h"
+#include "esp_netif.h"
+#include "esp_log.h"
+
+#include "wmngr_trace.h"
+
+#if defined(CONFIG_WMNGR_EVREC)
+
+static const char *TAG = "wmngr_evrec";
+
+#define EVREC_ENTRIES   CONFIG_WMNGR_EVREC_ENTRIES
+
+/*
+ * Recorded events are kept in a ring that is only allocated while
+ * recording. head counts all events seen since recording started.
+ */
+static portMUX_TYPE evrec_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_evrec *ring = NULL;
+static uint32_t head;
+static volatile bool replaying = false;
+
+/*
+ * Event handlers of the network managers, registered with the private
+ * loop a recording is replayed into. WiFi Manager and Ethernet Manager
+ * each register one for two event bases.
+ */
+#define EVREC_HANDLERS  4
+
+struct evrec_handler {
+    esp_event_base_t base;
+    esp_event_handler_t handler;
+    void *arg;
+};
+
+static struct evrec_handler handlers[EVREC_HANDLERS];
+static unsigned int num_handlers = 0;
+
+/*
+ * The event loop does not pass the payload size to handlers, so we have
+ * to know it for every event we want to record.
+ */
+static size_t payload_size(enum wmngr_trace_base base, int32_t id)
+{
+    size_t size;
+
+    size = 0;
+    switch(base){
+    case wmngr_trace_base_wifi:
+        switch(id){
+        case WIFI_EVENT_SCAN_DONE:
+            size = sizeof(wifi_event_sta_scan_done_t);
+            break;
+        case WIFI_EVENT_STA_CONNECTED:
+            size = sizeof(wifi_event_sta_connected_t);
+            break;
+        case WIFI_EVENT_STA_DISCONNECTED:
+            size = sizeof(wifi_event_sta_disconnected_t);
+            break;
+        case WIFI_EVENT_STA_AUTHMODE_CHANGE:
+            size = sizeof(wifi_event_sta_authmode_change_t);
+            break;
+        case WIFI_EVENT_STA_WPS_ER_SUCCESS:
+            size = sizeof(wifi_event_sta_wps_er_success_t);
+            break;
+        case WIFI_EVENT_STA_WPS_ER_FAILED:
+            size = sizeof(wifi_event_sta_wps_fail_reason_t);
+            break;
+        case WIFI_EVENT_STA_WPS_ER_PIN:
+            size = sizeof(wifi_event_sta_wps_er_pin_t);
+            break;
+        case WIFI_EVENT_AP_STACONNECTED:
+            size = sizeof(wifi_event_ap_staconnected_t);
+            break;
+        case WIFI_EVENT_AP_STADISCONNECTED:
+            size = sizeof(wifi_event_ap_stadisconnected_t);
+            break;
+        case WIFI_EVENT_AP_PROBEREQRECVED:
+            size = sizeof(wifi_event_ap_probe_req_rx_t);
+            break;
+        case WIFI_EVENT_STA_BSS_RSSI_LOW:
+            size = sizeof(wifi_event_bss_rssi_low_t);
+            break;
+        default:
+            break;
+        }
+        break;
+    case wmngr_trace_base_ip:
+        switch(id){
+        case IP_EVENT_STA_GOT_IP:
+        case IP_EVENT_ETH_GOT_IP:
+            size = sizeof(ip_event_got_ip_t);
+            break;
+        case IP_EVENT_GOT_IP6:
+            size = sizeof(ip_event_got_ip6_t);
+            break;
+        case IP_EVENT_AP_STAIPASSIGNED:
+            size = sizeof(ip_event_ap_staipassigned_t);
+            break;
+        default:
+            break;
+        }
+        break;
+    case wmngr_trace_base_eth:
+        size = sizeof(esp_eth_handle_t);
+        break;
+    }
+
+    return size;
+}
+
+static esp_event_base_t event_base(uint8_t base)
+{
+    switch(base){
+    case wmngr_trace_base_wifi:
+        return WIFI_EVENT;
+    case wmngr_trace_base_ip:
+        return IP_EVENT;
+    case wmngr_trace_base_eth:
+        return ETH_EVENT;
+    default:
+        return NULL;
+    }
+}
+
+static void evrec_handler(void *args, esp_event_base_t base,
+                          int32_t id, void *data)
+{
+    struct wmngr_evrec *rec;
+    enum wmngr_trace_base tbase;
+    size_t size;
+
+    if(base == WIFI_EVENT){
+        tbase = wmngr_trace_base_wifi;
+    } else if(base == IP_EVENT){
+        tbase = wmngr_trace_base_ip;
+    } else {
+        tbase = wmngr_trace_base_eth;
+    }
+
+    size = (data != NULL) ? payload_size(tbase, id) : 0;
+
+    taskENTER_CRITICAL(&evrec_lock);
+    if(ring != NULL && !replaying){
+        rec = &ring[head % EVREC_ENTRIES];
+        ++head;
+
+        rec->tick = xTaskGetTickCount();
+        rec->base = tbase;
+        rec->id = id;
+        rec->len = MIN(size, sizeof(rec->data));
+        rec->flags = (size > sizeof(rec->data)) ? WMNGR_EVREC_TRUNCATED : 0;
+        memcpy(rec->data, data, rec->len);
+    }
+    taskEXIT_CRITICAL(&evrec_lock);
+}
+
+void wmngr_evrec_add_handler(esp_event_base_t base,
+                             esp_event_handler_t handler, void *arg)
+{
+    bool full;
+
+    taskENTER_CRITICAL(&evrec_lock);
+    full = (num_handlers >= EVREC_HANDLERS);
+    if(!full){
+        handlers[num_handlers].base = base;
+        handlers[num_handlers].handler = handler;
+        handlers[num_handlers].arg = arg;
+        ++num_handlers;
+    }
+    taskEXIT_CRITICAL(&evrec_lock);
+
+    if(full){
+        ESP_LOGE(TAG, "[%s] No room for event handler.", __func__);
+    }
+}
+
+/** Start recording WiFi, IP and Ethernet events.
+ *
+ * Every event is stored with its tick stamp and payload in a ring of
+ * CONFIG_WMNGR_EVREC_ENTRIES records. Payloads larger than
+ * CONFIG_WMNGR_EVREC_PAYLOAD bytes are truncated. A previous recording
+ * is discarded.
+ *
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_evrec_start(void)
+{
+    struct wmngr_evrec *new, *old;
+    esp_err_t result;
+
+    new = calloc(EVREC_ENTRIES, sizeof(*new));
+    if(new == NULL){
+        return ESP_ERR_NO_MEM;
+    }
+
+    taskENTER_CRITICAL(&evrec_lock);
+    old = ring;
+    ring = new;
+    head = 0;
+    taskEXIT_CRITICAL(&evrec_lock);
+
+    if(old != NULL){
+        /* Already recording, handlers are registered. */
+        free(old);
+        return ESP_OK;
+    }
+
+    result = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                        &evrec_handler, NULL);
+    if(result == ESP_OK){
+        result = esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID,
+                                            &evrec_handler, NULL);
+    }
+
+    if(result == ESP_OK){
+        result = esp_event_handler_register(ETH_EVENT, ESP_EVENT_ANY_ID,
+                                            &evrec_handler, NULL);
+    }
+
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Registering event handlers failed.", __func__);
+        (void) esp_wmngr_evrec_stop();
+    }
+
+    return result;
+}
+
+/** Stop recording events.
+ *
+ * The recording is kept and can still be dumped until recording is
+ * started again.
+ *
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_evrec_stop(void)
+{
+    (void) esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                        &evrec_handler);
+    (void) esp_event_handler_unregister(IP_EVENT, ESP_EVENT_ANY_ID,
+                                        &evrec_handler);
+    (void) esp_event_handler_unregister(ETH_EVENT, ESP_EVENT_ANY_ID,
+                                        &evrec_handler);
+
+    return ESP_OK;
+}
+
+/** Copy the event recording into a buffer.
+ *
+ * The buffer receives a struct wmngr_evrec_hdr followed by as many records
+ * as fit, oldest first.
+ *
+ * @param[out] buf Destination buffer.
+ * @param[in] len Size of buf in bytes.
+ * @return Number of bytes written to buf, 0 if nothing has been recorded
+ *         or buf can not hold the header.
+ */
+size_t esp_wmngr_evrec_dump(void *buf, size_t len)
+{
+    struct wmngr_evrec_hdr hdr;
+    struct wmngr_evrec *out;
+    uint32_t first, num, idx;
+
+    if(buf == NULL || len < sizeof(hdr)){
+        return 0;
+    }
+
+    out = (struct wmngr_evrec *) ((uint8_t *) buf + sizeof(hdr));
+
+    taskENTER_CRITICAL(&evrec_lock);
+    if(ring == NULL){
+        taskEXIT_CRITICAL(&evrec_lock);
+        return 0;
+    }
+
+    num = MIN(head, EVREC_ENTRIES);
+    num = MIN(num, (len - sizeof(hdr)) / sizeof(*out));
+    first = head - num;
+    for(idx = 0; idx < num; ++idx){
+        memcpy(&out[idx], &ring[(first + idx) % EVREC_ENTRIES], sizeof(*out));
+    }
+    taskEXIT_CRITICAL(&evrec_lock);
+
+    hdr.magic = WMNGR_EVREC_MAGIC;
+    hdr.version = WMNGR_EVREC_VERSION;
+    hdr.rec_size = sizeof(*out);
+    hdr.tick_hz = configTICK_RATE_HZ;
+    hdr.num_records = num;
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    return sizeof(hdr) + num * sizeof(*out);
+}
+
+/** Write a hex dump of the event recording to the log.
+ */
+void esp_wmngr_evrec_log(void)
+{
+    size_t len;
+    void *buf;
+
+    len = sizeof(struct wmngr_evrec_hdr)
+          + EVREC_ENTRIES * sizeof(struct wmngr_evrec);
+    buf = malloc(len);
+    if(buf == NULL){
+        ESP_LOGE(TAG, "Out of memory for event dump.");
+        return;
+    }
+
+    len = esp_wmngr_evrec_dump(buf, len);
+    ESP_LOG_BUFFER_HEX(TAG, buf, len);
+    free(buf);
+}
+
+/** Replay an event recording.
+ *
+ * Feeds the recorded events to the WiFi and Ethernet Manager's event
+ * handlers through a private event loop. Neither the live default loop
+ * nor any other handler registered there (netif, application) sees the
+ * replayed events. Gaps between events are reproduced, divided by
+ * speedup. Only the event spacing is compressed, the managers' own
+ * timeouts still run in real time. Events are not recorded while a
+ * replay is running.
+ *
+ * Recordings containing truncated payloads are rejected, the handlers
+ * would read past the recorded data. Recorded payloads may contain
+ * pointers (netif or driver handles) that are only valid on the device
+ * and boot they were recorded on.
+ *
+ * The handlers run in the calling task. This function blocks until all
+ * events have been handled.
+ *
+ * @param[in] buf Recording as produced by #esp_wmngr_evrec_dump.
+ * @param[in] len Size of the recording in bytes.
+ * @param[in] speedup Time compression factor, 1 for original timing.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_evrec_replay(const void *buf, size_t len,
+                                 unsigned int speedup)
+{
+    esp_event_loop_args_t loop_args = {
+        .queue_size = 1,
+        .task_name = NULL,
+    };
+    struct evrec_handler hnd[EVREC_HANDLERS];
+    esp_event_loop_handle_t loop;
+    struct wmngr_evrec_hdr hdr;
+    struct wmngr_evrec rec;
+    const uint8_t *pos;
+    esp_event_base_t base;
+    uint64_t delta_ms;
+    uint32_t idx, last;
+    unsigned int num_hnd;
+    esp_err_t result;
+
+    if(buf == NULL || len < sizeof(hdr) || speedup == 0){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    if(hdr.magic != WMNGR_EVREC_MAGIC || hdr.version != WMNGR_EVREC_VERSION
+       || hdr.rec_size != sizeof(rec) || hdr.tick_hz == 0)
+    {
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    if(len < sizeof(hdr) + (size_t) hdr.num_records * sizeof(rec)){
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pos = (const uint8_t *) buf + sizeof(hdr);
+    for(idx = 0; idx < hdr.num_records; ++idx, pos += sizeof(rec)){
+        memcpy(&rec, pos, sizeof(rec));
+        if((rec.flags & WMNGR_EVREC_TRUNCATED)
+           || rec.len > sizeof(rec.data)
+           || (rec.len > 0 && rec.len != payload_size(rec.base, rec.id)))
+        {
+            ESP_LOGE(TAG, "[%s] Event %" PRIu32 " has an incomplete payload.",
+                     __func__, idx);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    taskENTER_CRITICAL(&evrec_lock);
+    num_hnd = num_handlers;
+    memcpy(hnd, handlers, sizeof(hnd));
+    taskEXIT_CRITICAL(&evrec_lock);
+
+    if(num_hnd == 0){
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /*
+     * Without a task the loop is only dispatched from our own
+     * esp_event_loop_run() calls, so every posted event has been handled
+     * once the call returns.
+     */
+    result = esp_event_loop_create(&loop_args, &loop);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Creating event loop failed.", __func__);
+        return result;
+    }
+
+    for(idx = 0; idx < num_hnd; ++idx){
+        result = esp_event_handler_register_with(loop, hnd[idx].base,
+                                                 ESP_EVENT_ANY_ID,
+                                                 hnd[idx].handler,
+                                                 hnd[idx].arg);
+        if(result != ESP_OK){
+            ESP_LOGE(TAG, "[%s] Registering event handlers failed.",
+                     __func__);
+            goto on_exit;
+        }
+    }
+
+    replaying = true;
+    pos = (const uint8_t *) buf + sizeof(hdr);
+    last = 0;
+
+    for(idx = 0; idx < hdr.num_records; ++idx, pos += sizeof(rec)){
+        memcpy(&rec, pos, sizeof(rec));
+
+        base = event_base(rec.base);
+        if(base == NULL){
+            continue;
+        }
+
+        if(idx > 0){
+            delta_ms = (uint64_t) (rec.tick - last) * 1000
+                       / hdr.tick_hz / speedup;
+            if(delta_ms > 0){
+                vTaskDelay(MAX(pdMS_TO_TICKS(delta_ms), 1));
+            }
+        }
+        last = rec.tick;
+
+        result = esp_event_post_to(loop, base, rec.id,
+                                   (rec.len > 0) ? rec.data : NULL, rec.len,
+                                   0);
+        if(result == ESP_OK){
+            result = esp_event_loop_run(loop, 0);
+        }
+
+        if(result != ESP_OK){
+            ESP_LOGE(TAG, "[%s] Replaying event %" PRIu32 " failed.",
+                     __func__, idx);
+            break;
+        }
+    }
+
+    replaying = false;
+
+on_exit:
+    (void) esp_event_loop_delete(loop);
+
+    return result;
+}
+
+#else /* defined(CONFIG_WMNGR_EVREC) */
+
+esp_err_t esp_wmngr_evrec_start(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wmngr_evrec_stop(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t esp_wmngr_evrec_dump(void *buf, size_t len)
+{
+    return 0;
+}
+
+void esp_wmngr_evrec_log(void)
+{
+}
+
+esp_err_t esp_wmngr_evrec_replay(const void *buf, size_t len,
+                                 unsigned int speedup)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_EVREC) */
@@ -0,0 +1,225 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_hidden.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "kutils.h"
+#include "wmngr_metrics.h"
+
+#if defined(CONFIG_WMNGR_HIDDEN_SSID)
+
+static const char *TAG = "wmngr_hidden";
+
+/* Entries older than this are neither merged nor used as channel hint. */
+#define HIDDEN_MAX_AGE  (30 * 60 * 1000 / portTICK_PERIOD_MS)
+
+static portMUX_TYPE hidden_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_hidden_entry cache[WMNGR_HIDDEN_CACHE];
+
+static bool entry_fresh(const struct wmngr_hidden_entry *entry,
+                        TickType_t now)
+{
+    return entry->ssid[0] != '\0'
+           && !time_after(now, entry->tstamp + HIDDEN_MAX_AGE);
+}
+
+/*
+ * Remember the BSSIDs that answered a directed probe for ssid. An entry
+ * for the same BSSID is updated, otherwise the oldest one is replaced.
+ * Returns the number of BSSIDs seen.
+ */
+unsigned int wmngr_hidden_reveal(const uint8_t *ssid,
+                                 const wifi_ap_record_t *recs,
+                                 unsigned int num)
+{
+    struct wmngr_hidden_entry *entry;
+    unsigned int idx, slot, found;
+    TickType_t now;
+
+    now = xTaskGetTickCount();
+    found = 0;
+
+    for(idx = 0; idx < num; ++idx){
+        if(strncmp((const char *) recs[idx].ssid, (const char *) ssid,
+                   sizeof(recs[idx].ssid)))
+        {
+            continue;
+        }
+
+        portENTER_CRITICAL(&hidden_lock);
+        entry = NULL;
+        for(slot = 0; slot < ARRAY_SIZE(cache); ++slot){
+            if(!memcmp(cache[slot].bssid, recs[idx].bssid,
+                       sizeof(cache[slot].bssid)))
+            {
+                entry = &cache[slot];
+                break;
+            }
+
+            if(entry == NULL
+               || (entry->ssid[0] != '\0'
+                   && (cache[slot].ssid[0] == '\0'
+                       || time_after(entry->tstamp, cache[slot].tstamp))))
+            {
+                entry = &cache[slot];
+            }
+        }
+
+        if(memcmp(entry->bssid, recs[idx].bssid, sizeof(entry->bssid))){
+            WMNGR_METRIC_INC(hidden_revealed);
+        }
+
+        memcpy(entry->bssid, recs[idx].bssid, sizeof(entry->bssid));
+        memcpy(entry->ssid, recs[idx].ssid, sizeof(entry->ssid));
+        entry->ssid[sizeof(entry->ssid) - 1] = '\0';
+        entry->channel = recs[idx].primary;
+        entry->tstamp = now;
+        portEXIT_CRITICAL(&hidden_lock);
+
+        ++found;
+    }
+
+    ESP_LOGD(TAG, "[%s] %u BSSIDs answered.", __func__, found);
+
+    return found;
+}
+
+/*
+ * Fill in the SSIDs of hidden records from the cache. Returns the number
+ * of hidden records left.
+ */
+unsigned int wmngr_hidden_merge(wifi_ap_record_t *recs, unsigned int num)
+{
+    unsigned int idx, slot, hidden;
+    TickType_t now;
+
+    now = xTaskGetTickCount();
+    hidden = 0;
+
+    portENTER_CRITICAL(&hidden_lock);
+    for(idx = 0; idx < num; ++idx){
+        if(recs[idx].ssid[0] != '\0'){
+            continue;
+        }
+
+        for(slot = 0; slot < ARRAY_SIZE(cache); ++slot){
+            if(entry_fresh(&cache[slot], now)
+               && !memcmp(cache[slot].bssid, recs[idx].bssid,
+                          sizeof(cache[slot].bssid)))
+            {
+                memcpy(recs[idx].ssid, cache[slot].ssid,
+                       sizeof(recs[idx].ssid));
+                break;
+            }
+        }
+
+        if(slot == ARRAY_SIZE(cache)){
+            ++hidden;
+        }
+    }
+    portEXIT_CRITICAL(&hidden_lock);
+
+    return hidden;
+}
+
+/*
+ * Point the STA at the channel of a revealed BSSID of its SSID, so the
+ * driver probes that channel first and connects on the first match
+ * instead of sweeping the band. Channels set by the user are kept.
+ */
+void wmngr_hidden_prepare_sta(wifi_sta_config_t *sta)
+{
+    struct wmngr_hidden_entry *entry;
+    unsigned int slot;
+    TickType_t now;
+    uint8_t chan;
+
+    if(sta->channel != 0 || sta->ssid[0] == '\0'){
+        return;
+    }
+
+    now = xTaskGetTickCount();
+    chan = 0;
+
+    portENTER_CRITICAL(&hidden_lock);
+    entry = NULL;
+    for(slot = 0; slot < ARRAY_SIZE(cache); ++slot){
+        if(entry_fresh(&cache[slot], now)
+           && !strncmp((const char *) cache[slot].ssid,
+                       (const char *) sta->ssid, sizeof(sta->ssid))
+           && (entry == NULL || time_after(cache[slot].tstamp, entry->tstamp)))
+        {
+            entry = &cache[slot];
+        }
+    }
+    if(entry != NULL){
+        chan = entry->channel;
+    }
+    portEXIT_CRITICAL(&hidden_lock);
+
+    if(chan != 0){
+        ESP_LOGI(TAG, "[%s] Hidden SSID last seen on channel %u.",
+                 __func__, chan);
+        sta->channel = chan;
+        sta->scan_method = WIFI_FAST_SCAN;
+        WMNGR_METRIC_INC(hidden_hints);
+    }
+}
+
+/** Fetch the hidden BSSIDs revealed by directed probes.
+ * @param[out] buf Array to copy the entries into.
+ * @param[in] num Number of entries buf can hold.
+ * @return Number of entries copied.
+ */
+size_t esp_wmngr_get_hidden(struct wmngr_hidden_entry *buf, size_t num)
+{
+    unsigned int slot;
+    size_t used;
+
+    if(buf == NULL){
+        return 0;
+    }
+
+    used = 0;
+    portENTER_CRITICAL(&hidden_lock);
+    for(slot = 0; slot < ARRAY_SIZE(cache) && used < num; ++slot){
+        if(cache[slot].ssid[0] != '\0'){
+            buf[used++] = cache[slot];
+        }
+    }
+    portEXIT_CRITICAL(&hidden_lock);
+
+    return used;
+}
+
+#else /* defined(CONFIG_WMNGR_HIDDEN_SSID) */
+
+size_t esp_wmngr_get_hidden(struct wmngr_hidden_entry *buf, size_t num)
+{
+    return 0;
+}
+
+#endif /* defined(CONFIG_WMNGR_HIDDEN_SSID) */
@@ -0,0 +1,306 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_link.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "wmngr_roam.h"
+#include "wmngr_tune.h"
+#include "wmngr_status.h"
+
+#if defined(CONFIG_WMNGR_LINK_MONITOR)
+
+static const char *TAG = "wmngr_link";
+
+#define LINK_SAMPLES        CONFIG_WMNGR_LINK_SAMPLES
+#define LINK_INTERVAL_MIN   CONFIG_WMNGR_LINK_INTERVAL_MIN
+#define LINK_INTERVAL_MAX   CONFIG_WMNGR_LINK_INTERVAL_MAX
+
+/* RSSI range mapped onto quality scores 0 to 100. */
+#define RSSI_UNUSABLE       (-90)
+#define RSSI_EXCELLENT      (-50)
+/* RSSI spread within the window that is still considered stable. */
+#define RSSI_SPREAD         6
+/* RSSI change that makes the sampler fall back to its fastest rate. */
+#define RSSI_STEP           4
+/* Below this quality the link is always sampled at the fastest rate. */
+#define QUALITY_POOR        40
+
+_Static_assert(LINK_INTERVAL_MIN <= LINK_INTERVAL_MAX,
+               "CONFIG_WMNGR_LINK_INTERVAL_MIN exceeds the maximum");
+
+static portMUX_TYPE link_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_link_sample ring[LINK_SAMPLES];
+static struct wmngr_link_stats link_stats;
+static TimerHandle_t link_timer = NULL;
+static bool link_running = false;
+static wmngr_link_cb_t link_cb = NULL;
+static void *link_cb_arg = NULL;
+
+/*
+ * The score is the average RSSI mapped linearly from RSSI_UNUSABLE (0) to
+ * RSSI_EXCELLENT (100), minus two points for every dB the samples in the
+ * window spread beyond RSSI_SPREAD. A strong but fluctuating link is
+ * therefore rated lower than a slightly weaker, steady one.
+ */
+static uint8_t quality_score(int avg, int min, int max)
+{
+    int score;
+
+    score = (avg - RSSI_UNUSABLE) * 100 / (RSSI_EXCELLENT - RSSI_UNUSABLE);
+    score -= 2 * MAX(max - min - RSSI_SPREAD, 0);
+
+    return MIN(MAX(score, 0), 100);
+}
+
+static void link_sample(TimerHandle_t timer)
+{
+    struct wmngr_link_stats stats;
+    struct wmngr_link_sample *sample;
+    wifi_ap_record_t ap_info;
+    wmngr_link_cb_t cb;
+    unsigned int idx, num;
+    int min, max, sum;
+    uint32_t interval;
+    void *cb_arg;
+    esp_err_t result;
+    bool running;
+
+    /*
+     * A re-arm racing with wmngr_link_stop() can leave the timer running
+     * for one more expiry. Catch it here, so it dies out.
+     */
+    portENTER_CRITICAL(&link_lock);
+    running = link_running;
+    portEXIT_CRITICAL(&link_lock);
+    if(!running){
+        return;
+    }
+
+    result = esp_wifi_sta_get_ap_info(&ap_info);
+
+    portENTER_CRITICAL(&link_lock);
+    if(result != ESP_OK){
+        ++link_stats.failures;
+        interval = LINK_INTERVAL_MIN;
+        link_stats.interval_ms = interval;
+        portEXIT_CRITICAL(&link_lock);
+        goto on_exit;
+    }
+
+    sample = &ring[link_stats.samples % LINK_SAMPLES];
+    sample->tick = xTaskGetTickCount();
+    sample->rssi = ap_info.rssi;
+    sample->channel = ap_info.primary;
+    sample->phy = (ap_info.phy_11b ? WMNGR_LINK_PHY_11B : 0)
+                  | (ap_info.phy_11g ? WMNGR_LINK_PHY_11G : 0)
+                  | (ap_info.phy_11n ? WMNGR_LINK_PHY_11N : 0)
+                  | (ap_info.phy_lr ? WMNGR_LINK_PHY_LR : 0)
+                  | ((ap_info.second != WIFI_SECOND_CHAN_NONE)
+                        ? WMNGR_LINK_PHY_HT40 : 0);
+    ++link_stats.samples;
+
+    num = MIN(link_stats.samples, LINK_SAMPLES);
+    min = INT8_MAX;
+    max = INT8_MIN;
+    sum = 0;
+    for(idx = 0; idx < num; ++idx){
+        min = MIN(min, ring[idx].rssi);
+        max = MAX(max, ring[idx].rssi);
+        sum += ring[idx].rssi;
+    }
+
+    interval = link_stats.interval_ms;
+    if(num < 2 || abs(ap_info.rssi - link_stats.rssi_last) >= RSSI_STEP){
+        interval = LINK_INTERVAL_MIN;
+    } else {
+        interval = MIN(interval * 2, LINK_INTERVAL_MAX);
+    }
+
+    link_stats.window = num;
+    link_stats.rssi_last = ap_info.rssi;
+    link_stats.rssi_min = min;
+    link_stats.rssi_max = max;
+    link_stats.rssi_avg = sum / (int) num;
+    link_stats.quality = quality_score(link_stats.rssi_avg, min, max);
+    link_stats.channel = sample->channel;
+    link_stats.phy = sample->phy;
+    sample->quality = link_stats.quality;
+
+    if(link_stats.quality < QUALITY_POOR){
+        interval = LINK_INTERVAL_MIN;
+    }
+    link_stats.interval_ms = interval;
+
+    memcpy(&stats, &link_stats, sizeof(stats));
+    cb = link_cb;
+    cb_arg = link_cb_arg;
+    portEXIT_CRITICAL(&link_lock);
+
+    wmngr_status_rssi(ap_info.rssi);
+    WMNGR_ROAM_SAMPLE(&stats);
+    WMNGR_TUNE_SAMPLE(&stats);
+
+    if(cb != NULL){
+        cb(&stats, cb_arg);
+    }
+
+on_exit:
+    portENTER_CRITICAL(&link_lock);
+    running = link_running;
+    portEXIT_CRITICAL(&link_lock);
+    if(!running){
+        return;
+    }
+
+    if(xTimerChangePeriod(timer, pdMS_TO_TICKS(interval), 0) != pdPASS){
+        ESP_LOGW(TAG, "[%s] Failed to re-arm sampling timer.", __func__);
+    }
+}
+
+/* Start sampling a freshly established STA link. */
+void wmngr_link_start(void)
+{
+    if(link_timer == NULL){
+        link_timer = xTimerCreate("WMngr_Link",
+                                  pdMS_TO_TICKS(LINK_INTERVAL_MIN),
+                                  pdFALSE, NULL, link_sample);
+        if(link_timer == NULL){
+            ESP_LOGE(TAG, "[%s] Creating timer failed.", __func__);
+            return;
+        }
+    }
+
+    portENTER_CRITICAL(&link_lock);
+    memset(ring, 0x0, sizeof(ring));
+    memset(&link_stats, 0x0, sizeof(link_stats));
+    link_stats.interval_ms = LINK_INTERVAL_MIN;
+    link_running = true;
+    portEXIT_CRITICAL(&link_lock);
+
+    (void) xTimerChangePeriod(link_timer, pdMS_TO_TICKS(LINK_INTERVAL_MIN), 0);
+}
+
+/* Stop sampling, the last summary stays available. */
+void wmngr_link_stop(void)
+{
+    portENTER_CRITICAL(&link_lock);
+    link_running = false;
+    portEXIT_CRITICAL(&link_lock);
+
+    if(link_timer != NULL){
+        (void) xTimerStop(link_timer, 0);
+    }
+}
+
+/** Fetch a summary of the current STA link quality.
+ *
+ * The summary covers the last CONFIG_WMNGR_LINK_SAMPLES samples. Samples
+ * are taken every CONFIG_WMNGR_LINK_INTERVAL_MIN ms while the link is
+ * changing or poor, backing off to CONFIG_WMNGR_LINK_INTERVAL_MAX ms while
+ * it is stable.
+ *
+ * @param[out] stats Link summary.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no sample has been
+ *         taken since connecting, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_link_stats(struct wmngr_link_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&link_lock);
+    memcpy(stats, &link_stats, sizeof(*stats));
+    portEXIT_CRITICAL(&link_lock);
+
+    return (stats->window > 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+/** Copy the most recent link samples.
+ * @param[out] buf Destination array, oldest sample first.
+ * @param[in] num Number of entries in buf.
+ * @return Number of samples copied.
+ */
+size_t esp_wmngr_get_link_samples(struct wmngr_link_sample *buf, size_t num)
+{
+    uint32_t first, idx;
+
+    if(buf == NULL){
+        return 0;
+    }
+
+    portENTER_CRITICAL(&link_lock);
+    num = MIN(num, link_stats.window);
+    first = link_stats.samples - num;
+    for(idx = 0; idx < num; ++idx){
+        buf[idx] = ring[(first + idx) % LINK_SAMPLES];
+    }
+    portEXIT_CRITICAL(&link_lock);
+
+    return num;
+}
+
+/** Register a function to be called after every link sample.
+ *
+ * This lets roaming, scan scheduling or alerting react to link changes
+ * without polling the driver. Only one callback can be registered,
+ * pass NULL to remove it.
+ *
+ * @param[in] cb Callback function.
+ * @param[in] arg Passed to cb.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_set_link_cb(wmngr_link_cb_t cb, void *arg)
+{
+    portENTER_CRITICAL(&link_lock);
+    link_cb = cb;
+    link_cb_arg = arg;
+    portEXIT_CRITICAL(&link_lock);
+
+    return ESP_OK;
+}
+
+#else /* defined(CONFIG_WMNGR_LINK_MONITOR) */
+
+esp_err_t esp_wmngr_get_link_stats(struct wmngr_link_stats *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t esp_wmngr_get_link_samples(struct wmngr_link_sample *buf, size_t num)
+{
+    return 0;
+}
+
+esp_err_t esp_wmngr_set_link_cb(wmngr_link_cb_t cb, void *arg)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_LINK_MONITOR) */
@@ -0,0 +1,223 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_lock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#if defined(CONFIG_WMNGR_LOCK_STATS)
+
+static const char *TAG = "wmngr_lock";
+
+static const char *site_names[wmngr_lock_handle] = {
+    "esp_wmngr_start",
+    "esp_wmngr_stop",
+    "esp_wmngr_set_cfg",
+    "esp_wmngr_get_cfg",
+    "esp_wmngr_start_wps",
+    "esp_wmngr_get_scan",
+    "esp_wmngr_reset_cfg",
+    "esp_wmngr_update_cfg",
+};
+
+/* Number of sites listed by esp_wmngr_dump_lock_stats(). */
+#define WORST_HOLDERS   5
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_lock_stats lock_stats;
+
+/*
+ * Only one task can hold the config lock, so the holder's details are
+ * only ever written by the task owning it.
+ */
+static enum wmngr_lock_site holder_site;
+static int64_t holder_since;
+
+static uint32_t clamp_us(int64_t delta)
+{
+    return (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t) delta;
+}
+
+/* State machine sites are named after the state, e.g. "handle_wifi/Update". */
+static void site_name(enum wmngr_lock_site site, char *buf, size_t len)
+{
+    if(site < wmngr_lock_handle){
+        snprintf(buf, len, "%s", site_names[site]);
+    } else {
+        snprintf(buf, len, "handle_wifi/%s",
+                 wmngr_state_names[site - wmngr_lock_handle]);
+    }
+}
+
+/** Take the config lock and account for it under the given site. */
+BaseType_t wmngr_lock_take(SemaphoreHandle_t lock, TickType_t timeout,
+                           enum wmngr_lock_site site)
+{
+    struct wmngr_lock_stat *stat;
+    BaseType_t result;
+    int64_t start, now;
+    uint32_t wait;
+
+    start = esp_timer_get_time();
+    result = xSemaphoreTake(lock, timeout);
+    now = esp_timer_get_time();
+
+    wait = clamp_us(now - start);
+    stat = &lock_stats.site[MIN(site, wmngr_lock_site_max - 1)];
+
+    portENTER_CRITICAL(&stats_lock);
+    ++stat->attempts;
+    stat->wait_us += wait;
+    stat->wait_max_us = MAX(stat->wait_max_us, wait);
+    if(result != pdTRUE){
+        ++stat->failures;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    if(result == pdTRUE){
+        holder_site = site;
+        holder_since = now;
+    }
+
+    return result;
+}
+
+/** Release the config lock and account for the time it was held. */
+void wmngr_lock_give(SemaphoreHandle_t lock)
+{
+    struct wmngr_lock_stat *stat;
+    uint32_t hold;
+
+    hold = clamp_us(esp_timer_get_time() - holder_since);
+    stat = &lock_stats.site[MIN(holder_site, wmngr_lock_site_max - 1)];
+
+    portENTER_CRITICAL(&stats_lock);
+    stat->hold_us += hold;
+    stat->hold_max_us = MAX(stat->hold_max_us, hold);
+    portEXIT_CRITICAL(&stats_lock);
+
+    xSemaphoreGive(lock);
+}
+
+/** Fetch a copy of the config lock statistics.
+ * @param[out] stats Per site lock statistics.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_lock_stats(struct wmngr_lock_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&stats_lock);
+    memcpy(stats, &lock_stats, sizeof(*stats));
+    portEXIT_CRITICAL(&stats_lock);
+
+    return ESP_OK;
+}
+
+/** Clear the config lock statistics.
+ */
+void esp_wmngr_reset_lock_stats(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    memset(&lock_stats, 0x0, sizeof(lock_stats));
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+/** Log the sites holding the config lock the longest.
+ *
+ * Lists up to five sites ordered by their longest hold time, together
+ * with their attempt, failure and wait statistics.
+ */
+void esp_wmngr_dump_lock_stats(void)
+{
+    struct wmngr_lock_stats *stats;
+    struct wmngr_lock_stat *stat;
+    uint8_t order[wmngr_lock_site_max];
+    unsigned int idx, pos, num;
+    char name[32];
+
+    stats = malloc(sizeof(*stats));
+    if(stats == NULL){
+        ESP_LOGE(TAG, "Out of memory for lock statistics.");
+        return;
+    }
+
+    (void) esp_wmngr_get_lock_stats(stats);
+
+    /* Insertion sort of the used sites by longest hold time. */
+    num = 0;
+    for(idx = 0; idx < wmngr_lock_site_max; ++idx){
+        if(stats->site[idx].attempts == 0){
+            continue;
+        }
+
+        for(pos = num; pos > 0; --pos){
+            if(stats->site[order[pos - 1]].hold_max_us
+               >= stats->site[idx].hold_max_us)
+            {
+                break;
+            }
+            order[pos] = order[pos - 1];
+        }
+        order[pos] = idx;
+        ++num;
+    }
+
+    for(idx = 0; idx < MIN(num, WORST_HOLDERS); ++idx){
+        stat = &stats->site[order[idx]];
+        site_name(order[idx], name, sizeof(name));
+        ESP_LOGI(TAG, "%-26s n=%" PRIu32 " fail=%" PRIu32
+                      " wait avg/max=%" PRIu32 "/%" PRIu32
+                      " hold avg/max=%" PRIu32 "/%" PRIu32 " us",
+                 name,
+                 stat->attempts, stat->failures,
+                 stat->wait_us / stat->attempts, stat->wait_max_us,
+                 (stat->attempts > stat->failures)
+                    ? stat->hold_us / (stat->attempts - stat->failures) : 0,
+                 stat->hold_max_us);
+    }
+
+    free(stats);
+}
+
+#else /* defined(CONFIG_WMNGR_LOCK_STATS) */
+
+esp_err_t esp_wmngr_get_lock_stats(struct wmngr_lock_stats *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void esp_wmngr_reset_lock_stats(void)
+{
+}
+
+void esp_wmngr_dump_lock_stats(void)
+{
+}
+
+#endif /* defined(CONFIG_WMNGR_LOCK_STATS) */
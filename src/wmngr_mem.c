@@ -0,0 +1,190 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_mem.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+const char *wmngr_mem_names[wmngr_mem_max] = {
+#define WMNGR_X(name, desc) #name,
+    WMNGR_MEM_SUBSYS(WMNGR_X)
+#undef WMNGR_X
+};
+
+#if defined(CONFIG_WMNGR_MEM_STATS)
+
+static const char *TAG = "wmngr_mem";
+
+/*
+ * Tracked allocations carry a small header recording their size and
+ * subsystem, so they can be accounted correctly when freed. It is
+ * sized to keep the returned pointer aligned for any type.
+ */
+struct mem_hdr {
+    uint32_t size;
+    uint32_t sys;
+} __attribute__((aligned(8)));
+
+static portMUX_TYPE mem_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_mem_stats mem_stats;
+
+static void account(enum wmngr_mem_sys sys, int64_t delta)
+{
+    struct wmngr_mem_stat *stat;
+    int64_t cur;
+
+    if(sys >= wmngr_mem_max || delta == 0){
+        return;
+    }
+
+    stat = &mem_stats.sys[sys];
+
+    portENTER_CRITICAL(&mem_lock);
+    cur = (int64_t) stat->cur + delta;
+    stat->cur = (cur < 0) ? 0 : MIN(cur, UINT32_MAX);
+    stat->peak = MAX(stat->peak, stat->cur);
+    if(delta > 0){
+        ++stat->allocs;
+    } else {
+        ++stat->frees;
+    }
+    portEXIT_CRITICAL(&mem_lock);
+}
+
+/* calloc() accounted to a subsystem. Must be released with wmngr_mem_free(). */
+void *wmngr_mem_calloc(enum wmngr_mem_sys sys, size_t num, size_t size)
+{
+    struct mem_hdr *hdr;
+
+    if(size != 0 && num > (SIZE_MAX - sizeof(*hdr)) / size){
+        return NULL;
+    }
+
+    hdr = calloc(1, sizeof(*hdr) + num * size);
+    if(hdr == NULL){
+        return NULL;
+    }
+
+    hdr->size = num * size;
+    hdr->sys = sys;
+    account(sys, hdr->size);
+
+    return &hdr[1];
+}
+
+void wmngr_mem_free(void *ptr)
+{
+    struct mem_hdr *hdr;
+
+    if(ptr == NULL){
+        return;
+    }
+
+    hdr = &((struct mem_hdr *) ptr)[-1];
+    account(hdr->sys, -(int64_t) hdr->size);
+    free(hdr);
+}
+
+size_t wmngr_mem_heap_free(void)
+{
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+/* Account the change of free heap since before was sampled. */
+void wmngr_mem_account(enum wmngr_mem_sys sys, size_t before)
+{
+    account(sys, (int64_t) before - (int64_t) wmngr_mem_heap_free());
+}
+
+/** Fetch the current heap usage of the network managers.
+ *
+ * Allocations made by the managers are tracked exactly. Netifs and
+ * FreeRTOS objects are accounted by the change of free heap while they
+ * are created or deleted, which includes the heap allocator's overhead.
+ *
+ * @param[out] stats Heap usage per subsystem.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_mem_stats(struct wmngr_mem_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&mem_lock);
+    memcpy(stats, &mem_stats, sizeof(*stats));
+    portEXIT_CRITICAL(&mem_lock);
+
+    return ESP_OK;
+}
+
+/** Log the current and peak heap usage of all subsystems.
+ */
+void esp_wmngr_dump_mem_stats(void)
+{
+    struct wmngr_mem_stats stats;
+    unsigned int idx;
+
+    (void) esp_wmngr_get_mem_stats(&stats);
+
+#define WMNGR_X(name, desc) \
+    idx = wmngr_mem_##name; \
+    ESP_LOGI(TAG, "%-20s cur=%" PRIu32 " peak=%" PRIu32 " allocs=%" PRIu32 \
+                  " frees=%" PRIu32, desc, stats.sys[idx].cur, \
+             stats.sys[idx].peak, stats.sys[idx].allocs, stats.sys[idx].frees);
+    WMNGR_MEM_SUBSYS(WMNGR_X)
+#undef WMNGR_X
+}
+
+/** Restart peak tracking from the current heap usage.
+ */
+void esp_wmngr_reset_mem_peaks(void)
+{
+    unsigned int idx;
+
+    portENTER_CRITICAL(&mem_lock);
+    for(idx = 0; idx < wmngr_mem_max; ++idx){
+        mem_stats.sys[idx].peak = mem_stats.sys[idx].cur;
+    }
+    portEXIT_CRITICAL(&mem_lock);
+}
+
+#else /* defined(CONFIG_WMNGR_MEM_STATS) */
+
+esp_err_t esp_wmngr_get_mem_stats(struct wmngr_mem_stats *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void esp_wmngr_reset_mem_peaks(void)
+{
+}
+
+void esp_wmngr_dump_mem_stats(void)
+{
+}
+
+#endif /* defined(CONFIG_WMNGR_MEM_STATS) */
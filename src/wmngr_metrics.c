@@ -0,0 +1,355 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "wmngr_timeline.h"
+#include "wmngr_mem.h"
+
+#define REPORT_NAME_LEN 32
+
+/*
+ * Scenario the report covers. Counters are reported relative to their
+ * values when it began.
+ */
+static portMUX_TYPE report_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_metrics report_base;
+static char report_name[REPORT_NAME_LEN];
+static TickType_t report_start;
+
+/* snprintf() at the end of a buffer, keeps track of the used length. */
+static void json_add(char *buf, size_t size, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void json_add(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    va_list args;
+    int res;
+
+    if(*len >= size){
+        return;
+    }
+
+    va_start(args, fmt);
+    res = vsnprintf(&buf[*len], size - *len, fmt, args);
+    va_end(args);
+
+    *len = (res < 0) ? size : MIN(*len + res, size);
+}
+
+static void json_add_hist(char *buf, size_t size, size_t *len,
+                          const char *name, const struct wmngr_tl_hist *hist)
+{
+    unsigned int idx;
+
+    json_add(buf, size, len, "\"");
+    for(idx = 0; name[idx] != '\0'; ++idx){
+        json_add(buf, size, len, "%c",
+                 (name[idx] == ' ') ? '_' : tolower((int) name[idx]));
+    }
+
+    json_add(buf, size, len,
+             "\":{\"n\":%" PRIu32 ",\"min\":%" PRIu32 ",\"p50\":%" PRIu32
+             ",\"p95\":%" PRIu32 ",\"p99\":%" PRIu32 ",\"max\":%" PRIu32 "}",
+             hist->count, hist->min_us,
+             esp_wmngr_tl_percentile(hist, 50),
+             esp_wmngr_tl_percentile(hist, 95),
+             esp_wmngr_tl_percentile(hist, 99),
+             hist->max_us);
+}
+
+/** Start a new scenario for esp_wmngr_report_json().
+ *
+ * Following reports only cover what happened since this call: counters
+ * are reported as deltas, phase histograms and heap peaks are restarted.
+ * Gauges and the metrics seen by esp_wmngr_get_metrics() are not
+ * touched, but calling esp_wmngr_reset_metrics() during a scenario
+ * spoils its counters.
+ *
+ * @param[in] scenario Name of the scenario, reported with the results.
+ */
+void esp_wmngr_report_begin(const char *scenario)
+{
+    struct wmngr_metrics base;
+
+    if(esp_wmngr_get_metrics(&base) != ESP_OK){
+        memset(&base, 0x0, sizeof(base));
+    }
+
+    esp_wmngr_reset_timeline();
+    esp_wmngr_reset_mem_peaks();
+
+    taskENTER_CRITICAL(&report_lock);
+    memcpy(&report_base, &base, sizeof(report_base));
+    snprintf(report_name, sizeof(report_name), "%s",
+             (scenario != NULL) ? scenario : "");
+    report_start = xTaskGetTickCount();
+    taskEXIT_CRITICAL(&report_lock);
+}
+
+/** Write metrics and phase latencies as a JSON object.
+ *
+ * Produces {"scenario":...,"duration_ms":...,"metrics":{...},
+ * "phases":{...},"memory":{...}} where each phase holds its sample count
+ * and min/p50/p95/p99/max durations in microseconds and each memory
+ * subsystem its current and peak heap usage. Counters, phases and peaks
+ * cover the scenario started by the last #esp_wmngr_report_begin, or
+ * everything since boot if there was none. Sections whose feature is
+ * disabled are left out. Meant to be collected from test rigs and
+ * compared with tools/wmngr_report_compare.py.
+ *
+ * @param[out] buf Destination buffer, always NUL terminated.
+ * @param[in] len Size of buf in bytes.
+ * @return Length of the JSON text, len or more if it has been truncated.
+ */
+size_t esp_wmngr_report_json(char *buf, size_t len)
+{
+    struct wmngr_metrics *metrics, *base;
+    char scenario[REPORT_NAME_LEN];
+    struct wmngr_timeline *tl;
+    struct wmngr_mem_stats mem;
+    TickType_t start;
+    const char *sep;
+    unsigned int idx;
+    size_t used;
+
+    if(buf == NULL || len == 0){
+        return 0;
+    }
+
+    used = 0;
+    buf[0] = '\0';
+
+    /* These are too large to be put on the caller's stack. */
+    metrics = malloc(sizeof(*metrics));
+    base = malloc(sizeof(*base));
+    tl = malloc(sizeof(*tl));
+    if(metrics == NULL || base == NULL || tl == NULL){
+        goto on_exit;
+    }
+
+    taskENTER_CRITICAL(&report_lock);
+    memcpy(base, &report_base, sizeof(*base));
+    memcpy(scenario, report_name, sizeof(scenario));
+    start = report_start;
+    taskEXIT_CRITICAL(&report_lock);
+
+    /* Scenario names come from the test rig, keep them plain. */
+    for(idx = 0; scenario[idx] != '\0'; ++idx){
+        if(scenario[idx] == '"' || scenario[idx] == '\\'
+           || !isprint((int) scenario[idx]))
+        {
+            scenario[idx] = '_';
+        }
+    }
+
+    json_add(buf, len, &used,
+             "{\"scenario\":\"%s\",\"duration_ms\":%" PRIu32, scenario,
+             (uint32_t) ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS));
+
+    if(esp_wmngr_get_metrics(metrics) == ESP_OK){
+        sep = "";
+        json_add(buf, len, &used, ",\"metrics\":{");
+#define WMNGR_X(name, desc) \
+        json_add(buf, len, &used, "%s\"" #name "\":%" PRIu32, sep, \
+                 metrics->name - base->name); \
+        sep = ",";
+        WMNGR_COUNTERS(WMNGR_X)
+#undef WMNGR_X
+#define WMNGR_X(name, desc) \
+        json_add(buf, len, &used, ",\"" #name "\":%" PRIu32, metrics->name);
+        WMNGR_GAUGES(WMNGR_X)
+#undef WMNGR_X
+        json_add(buf, len, &used, "}");
+    }
+
+    if(esp_wmngr_get_timeline(tl) == ESP_OK){
+        json_add(buf, len, &used, ",\"phases\":{");
+        for(idx = 0; idx < wmngr_tl_max; ++idx){
+            json_add_hist(buf, len, &used, wmngr_tl_names[idx], &tl->phase[idx]);
+            json_add(buf, len, &used, ",");
+        }
+        json_add_hist(buf, len, &used, "Total", &tl->total);
+        json_add(buf, len, &used, ",");
+        json_add_hist(buf, len, &used, "Reconnect", &tl->reconnect);
+        json_add(buf, len, &used, ",");
+        json_add_hist(buf, len, &used, "Scenario", &tl->scenario);
+        json_add(buf, len, &used, "}");
+    }
+
+    if(esp_wmngr_get_mem_stats(&mem) == ESP_OK){
+        json_add(buf, len, &used, ",\"memory\":{");
+        for(idx = 0; idx < wmngr_mem_max; ++idx){
+            json_add(buf, len, &used,
+                     "%s\"%s\":{\"cur\":%" PRIu32 ",\"peak\":%" PRIu32 "}",
+                     (idx == 0) ? "" : ",", wmngr_mem_names[idx],
+                     mem.sys[idx].cur, mem.sys[idx].peak);
+        }
+        json_add(buf, len, &used, "}");
+    }
+
+    json_add(buf, len, &used, "}");
+
+on_exit:
+    free(metrics);
+    free(base);
+    free(tl);
+
+    return used;
+}
+
+#if defined(CONFIG_WMNGR_METRICS)
+
+static const char *TAG = "wmngr_metrics";
+
+/*
+ * Counters are kept per core, so increments from tasks running on
+ * different cores never compete for the same word. The relaxed atomic
+ * add only guards against preemption by another task on the same core.
+ */
+static atomic_uint counters[portNUM_PROCESSORS][wmngr_cnt_max];
+static atomic_uint gauges[wmngr_gauge_max];
+
+void wmngr_metric_add(enum wmngr_counter id, uint32_t val)
+{
+    atomic_fetch_add_explicit(&counters[xPortGetCoreID()][id], val,
+                              memory_order_relaxed);
+}
+
+void wmngr_metric_set(enum wmngr_gauge id, uint32_t val)
+{
+    atomic_store_explicit(&gauges[id], val, memory_order_relaxed);
+}
+
+void wmngr_metric_max(enum wmngr_gauge id, uint32_t val)
+{
+    unsigned int old;
+
+    old = atomic_load_explicit(&gauges[id], memory_order_relaxed);
+    while(val > old
+          && !atomic_compare_exchange_weak_explicit(&gauges[id], &old, val,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed))
+    {
+        ;
+    }
+}
+
+static uint32_t counter_sum(enum wmngr_counter id)
+{
+    unsigned int core;
+    uint32_t sum;
+
+    sum = 0;
+    for(core = 0; core < portNUM_PROCESSORS; ++core){
+        sum += atomic_load_explicit(&counters[core][id], memory_order_relaxed);
+    }
+
+    return sum;
+}
+
+/** Fetch a snapshot of the network manager metrics.
+ *
+ * The snapshot is not atomic as a whole, counters updated while it is
+ * taken may or may not be included.
+ *
+ * @param[out] metrics Current counter and gauge values.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_metrics(struct wmngr_metrics *metrics)
+{
+    if(metrics == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+#define WMNGR_X(name, desc) metrics->name = counter_sum(wmngr_cnt_##name);
+    WMNGR_COUNTERS(WMNGR_X)
+#undef WMNGR_X
+
+#define WMNGR_X(name, desc) \
+    metrics->name = atomic_load_explicit(&gauges[wmngr_gauge_##name], \
+                                         memory_order_relaxed);
+    WMNGR_GAUGES(WMNGR_X)
+#undef WMNGR_X
+
+    return ESP_OK;
+}
+
+/** Reset all counters and gauges to zero.
+ */
+void esp_wmngr_reset_metrics(void)
+{
+    unsigned int core, idx;
+
+    for(core = 0; core < portNUM_PROCESSORS; ++core){
+        for(idx = 0; idx < wmngr_cnt_max; ++idx){
+            atomic_store_explicit(&counters[core][idx], 0,
+                                  memory_order_relaxed);
+        }
+    }
+
+    for(idx = 0; idx < wmngr_gauge_max; ++idx){
+        atomic_store_explicit(&gauges[idx], 0, memory_order_relaxed);
+    }
+}
+
+/** Log all counters and gauges.
+ */
+void esp_wmngr_dump_metrics(void)
+{
+    struct wmngr_metrics metrics;
+
+    (void) esp_wmngr_get_metrics(&metrics);
+
+#define WMNGR_X(name, desc) \
+    ESP_LOGI(TAG, "%-24s %" PRIu32, desc, metrics.name);
+    WMNGR_COUNTERS(WMNGR_X)
+    WMNGR_GAUGES(WMNGR_X)
+#undef WMNGR_X
+}
+
+#else /* defined(CONFIG_WMNGR_METRICS) */
+
+esp_err_t esp_wmngr_get_metrics(struct wmngr_metrics *metrics)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void esp_wmngr_reset_metrics(void)
+{
+}
+
+void esp_wmngr_dump_metrics(void)
+{
+}
+
+#endif /* defined(CONFIG_WMNGR_METRICS) */
@@ -0,0 +1,305 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_ps.h"
+
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "kutils.h"
+
+#if defined(CONFIG_WMNGR_PS_POLICY)
+
+static const char *TAG = "wmngr_ps";
+
+#define PS_INTERVAL     pdMS_TO_TICKS(CONFIG_WMNGR_PS_INTERVAL)
+#define PS_BURST_RATE   CONFIG_WMNGR_PS_BURST_RATE
+#define PS_IDLE_RATE    CONFIG_WMNGR_PS_IDLE_RATE
+#define PS_HOLD         CONFIG_WMNGR_PS_HOLD
+
+static portMUX_TYPE ps_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_ps_stats ps_stats;
+static TimerHandle_t ps_timer = NULL;
+static TickType_t ps_last;
+static TickType_t ps_hint_end;
+static unsigned int ps_held;
+static bool ps_running;
+static atomic_uint ps_bytes;
+
+/*
+ * Mode the traffic asks for. Entering a mode needs the rate to cross its
+ * threshold, leaving it again needs a margin of a factor of two, so a
+ * rate close to a threshold does not make the mode flap. Keep this in
+ * sync with tools/wmngr_ps_sim.py.
+ */
+static wifi_ps_type_t ps_target(wifi_ps_type_t mode, uint32_t rate,
+                                enum wmngr_ps_hint hint)
+{
+    if(hint == wmngr_ps_hint_burst){
+        return WIFI_PS_NONE;
+    }
+
+    if(hint == wmngr_ps_hint_idle){
+        return WIFI_PS_MAX_MODEM;
+    }
+
+    if(rate >= PS_BURST_RATE
+       || (mode == WIFI_PS_NONE && rate >= PS_BURST_RATE / 2))
+    {
+        return WIFI_PS_NONE;
+    }
+
+    if(rate < PS_IDLE_RATE
+       || (mode == WIFI_PS_MAX_MODEM && rate < 2 * PS_IDLE_RATE))
+    {
+        return WIFI_PS_MAX_MODEM;
+    }
+
+    return WIFI_PS_MIN_MODEM;
+}
+
+/*
+ * Runs every PS_INTERVAL while the STA is connected. The rate follows
+ * increases at once and decays slowly. Latency wins: less power saving
+ * is applied right away, more only after the traffic has asked for it
+ * PS_HOLD times in a row or on an idle hint.
+ */
+static void ps_eval(TimerHandle_t timer)
+{
+    wifi_ps_type_t mode, next;
+    uint32_t bytes, elapsed, rate;
+    esp_err_t result;
+    TickType_t now;
+    bool running;
+
+    bytes = atomic_exchange_explicit(&ps_bytes, 0, memory_order_relaxed);
+    now = xTaskGetTickCount();
+
+    /*
+     * A re-arm racing with wmngr_ps_stop() can leave the timer running
+     * for one more expiry. Do nothing then, so it dies out.
+     */
+    portENTER_CRITICAL(&ps_lock);
+    if(!ps_running){
+        portEXIT_CRITICAL(&ps_lock);
+        return;
+    }
+
+    mode = ps_stats.mode;
+    elapsed = MAX((now - ps_last) * portTICK_PERIOD_MS, 1);
+    ps_last = now;
+    ps_stats.dwell_ms[mode] += elapsed;
+
+    rate = (uint32_t) ((uint64_t) bytes * 1000 / elapsed);
+    ps_stats.rate = (rate > ps_stats.rate) ? rate
+                                           : (3 * ps_stats.rate + rate) / 4;
+
+    if(ps_stats.hint != wmngr_ps_hint_none && time_after(now, ps_hint_end)){
+        ps_stats.hint = wmngr_ps_hint_none;
+    }
+
+    rate = ps_stats.rate;
+
+    next = ps_target(mode, rate, ps_stats.hint);
+    if(next <= mode){
+        ps_held = 0;
+    } else if(++ps_held < PS_HOLD && ps_stats.hint != wmngr_ps_hint_idle){
+        next = mode;
+    } else {
+        ps_held = 0;
+    }
+    portEXIT_CRITICAL(&ps_lock);
+
+    if(next != mode){
+        result = esp_wifi_set_ps(next);
+
+        portENTER_CRITICAL(&ps_lock);
+        if(result == ESP_OK){
+            ps_stats.mode = next;
+            ++ps_stats.entered[next];
+        } else {
+            ++ps_stats.failures;
+        }
+        portEXIT_CRITICAL(&ps_lock);
+
+        if(result == ESP_OK){
+            ESP_LOGD(TAG, "[%s] Power save %d -> %d at %u B/s.",
+                     __func__, mode, next, (unsigned int) rate);
+        } else {
+            ESP_LOGW(TAG, "[%s] esp_wifi_set_ps(): %s",
+                     __func__, esp_err_to_name(result));
+        }
+    }
+
+    portENTER_CRITICAL(&ps_lock);
+    running = ps_running;
+    portEXIT_CRITICAL(&ps_lock);
+    if(!running){
+        return;
+    }
+
+    if(xTimerChangePeriod(timer, PS_INTERVAL, 0) != pdPASS){
+        ESP_LOGW(TAG, "[%s] Failed to re-arm policy timer.", __func__);
+    }
+}
+
+/* Take over the power-save mode of a freshly established STA link. */
+void wmngr_ps_start(void)
+{
+    wifi_ps_type_t mode;
+
+    if(ps_timer == NULL){
+        ps_timer = xTimerCreate("WMngr_PS", PS_INTERVAL, pdFALSE, NULL,
+                                ps_eval);
+        if(ps_timer == NULL){
+            ESP_LOGE(TAG, "[%s] Creating timer failed.", __func__);
+            return;
+        }
+    }
+
+    if(esp_wifi_get_ps(&mode) != ESP_OK || mode >= WMNGR_PS_MODES){
+        mode = WIFI_PS_MIN_MODEM;
+    }
+
+    (void) atomic_exchange_explicit(&ps_bytes, 0, memory_order_relaxed);
+
+    portENTER_CRITICAL(&ps_lock);
+    ps_stats.mode = mode;
+    ps_stats.rate = 0;
+    ps_last = xTaskGetTickCount();
+    ps_held = 0;
+    ps_running = true;
+    portEXIT_CRITICAL(&ps_lock);
+
+    (void) xTimerChangePeriod(ps_timer, PS_INTERVAL, 0);
+}
+
+/* Stop the policy, the driver keeps the last mode. */
+void wmngr_ps_stop(void)
+{
+    TickType_t now;
+
+    if(ps_timer != NULL){
+        (void) xTimerStop(ps_timer, 0);
+    }
+
+    now = xTaskGetTickCount();
+
+    portENTER_CRITICAL(&ps_lock);
+    if(ps_running){
+        ps_stats.dwell_ms[ps_stats.mode] += (now - ps_last)
+                                            * portTICK_PERIOD_MS;
+        ps_running = false;
+    }
+    portEXIT_CRITICAL(&ps_lock);
+}
+
+/** Account traffic for the power-save policy.
+ *
+ * Call this with the number of bytes sent or received over the STA
+ * interface, e.g. from the application's socket layer. It is cheap
+ * enough to be called for every packet.
+ *
+ * @param[in] bytes Number of bytes transferred.
+ */
+void esp_wmngr_ps_traffic(size_t bytes)
+{
+    atomic_fetch_add_explicit(&ps_bytes, bytes, memory_order_relaxed);
+}
+
+/** Tell the power-save policy about upcoming traffic.
+ *
+ * A burst hint disables power saving at once, an idle hint switches to
+ * maximum power saving without waiting for the traffic rate to settle.
+ * The hint overrides the measured traffic for the given time.
+ *
+ * @param[in] hint Expected traffic, wmngr_ps_hint_none clears a hint.
+ * @param[in] ms Duration of the hint in milliseconds.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_ps_hint(enum wmngr_ps_hint hint, uint32_t ms)
+{
+    bool running;
+
+    if(hint > wmngr_ps_hint_idle){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&ps_lock);
+    ps_stats.hint = hint;
+    ps_hint_end = xTaskGetTickCount() + pdMS_TO_TICKS(ms);
+    running = ps_running;
+    portEXIT_CRITICAL(&ps_lock);
+
+    /*
+     * Evaluate right away instead of waiting for the next interval. If
+     * the policy is stopped meanwhile, ps_eval() ignores the expiry.
+     */
+    if(running && ps_timer != NULL){
+        (void) xTimerChangePeriod(ps_timer, 1, 0);
+    }
+
+    return ESP_OK;
+}
+
+/** Fetch the power-save policy statistics.
+ * @param[out] stats Current mode, traffic rate and time spent per mode.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_ps_stats(struct wmngr_ps_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&ps_lock);
+    memcpy(stats, &ps_stats, sizeof(*stats));
+    if(ps_running){
+        stats->dwell_ms[stats->mode] += (xTaskGetTickCount() - ps_last)
+                                        * portTICK_PERIOD_MS;
+    }
+    portEXIT_CRITICAL(&ps_lock);
+
+    return ESP_OK;
+}
+
+#else /* defined(CONFIG_WMNGR_PS_POLICY) */
+
+void esp_wmngr_ps_traffic(size_t bytes)
+{
+}
+
+esp_err_t esp_wmngr_ps_hint(enum wmngr_ps_hint hint, uint32_t ms)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wmngr_get_ps_stats(struct wmngr_ps_stats *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_PS_POLICY) */
@@ -0,0 +1,418 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_roam.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+#include "esp_rrm.h"
+#include "esp_wnm.h"
+#endif
+
+#include "kutils.h"
+
+#if defined(CONFIG_WMNGR_ROAMING)
+
+static const char *TAG = "wmngr_roam";
+
+#define ROAM_RSSI       CONFIG_WMNGR_ROAM_RSSI
+#define ROAM_MARGIN     CONFIG_WMNGR_ROAM_HYSTERESIS
+#define ROAM_SAMPLES    CONFIG_WMNGR_ROAM_SAMPLES
+#define ROAM_HOLDOFF    pdMS_TO_TICKS(CONFIG_WMNGR_ROAM_HOLDOFF * 1000)
+#define ROAM_HISTORY    8
+
+/* Neighbor report element as defined in IEEE 802.11-2016 9.4.2.37. */
+#define EID_NEIGHBOR_REPORT     52
+#define NR_CHANNEL_OFFSET       11  /* BSSID, BSSID info, operating class */
+#define NR_MIN_LEN              13
+
+static portMUX_TYPE roam_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_roam_stats roam_stats;
+static struct wmngr_roam_rec history[ROAM_HISTORY];
+static uint32_t history_head;
+
+/* Only touched from the link monitor's timer callback. */
+static unsigned int low_samples;
+static TickType_t last_trigger;
+static bool triggered;
+
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+/* Channels from the last neighbor report, -1 while none has arrived. */
+static uint8_t nr_chans[WMNGR_ROAM_MAX_CHANS];
+static int nr_num = -1;
+#endif
+
+/* Only touched under roam_lock. */
+static wmngr_roam_trigger_t roam_trigger_cb = NULL;
+static void *roam_trigger_arg = NULL;
+
+/* Tell the roaming policy whom to wake up when roaming is due. */
+void wmngr_roam_attach(wmngr_roam_trigger_t trigger, void *arg)
+{
+    portENTER_CRITICAL(&roam_lock);
+    roam_trigger_cb = trigger;
+    roam_trigger_arg = arg;
+    portEXIT_CRITICAL(&roam_lock);
+}
+
+static void roam_trigger(void)
+{
+    wmngr_roam_trigger_t trigger;
+    void *arg;
+
+    portENTER_CRITICAL(&roam_lock);
+    trigger = roam_trigger_cb;
+    arg = roam_trigger_arg;
+    portEXIT_CRITICAL(&roam_lock);
+
+    if(trigger != NULL){
+        trigger(arg);
+    }
+}
+
+/*
+ * Called with every link sample. Request a roaming scan once the RSSI
+ * has stayed below the threshold for ROAM_SAMPLES samples in a row, but
+ * not more often than once per hold-off period.
+ */
+void wmngr_roam_sample(const struct wmngr_link_stats *stats)
+{
+    TickType_t now;
+
+    if(stats->rssi_last >= ROAM_RSSI){
+        low_samples = 0;
+        return;
+    }
+
+    if(++low_samples < ROAM_SAMPLES){
+        return;
+    }
+
+    now = xTaskGetTickCount();
+    if(triggered && !time_after(now, last_trigger + ROAM_HOLDOFF)){
+        return;
+    }
+
+    ESP_LOGI(TAG, "RSSI %d dBm below %d dBm, looking for a better AP.",
+             stats->rssi_last, ROAM_RSSI);
+
+    low_samples = 0;
+    last_trigger = now;
+    triggered = true;
+
+    portENTER_CRITICAL(&roam_lock);
+    ++roam_stats.triggers;
+    portEXIT_CRITICAL(&roam_lock);
+
+    roam_trigger();
+}
+
+/*
+ * Enable the roaming related features of the STA config handed to the
+ * driver. The manager's stored configs are left alone, so they do not
+ * change when the options are toggled.
+ */
+void wmngr_roam_prepare_sta(wifi_sta_config_t *sta)
+{
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+    sta->rm_enabled = 1;
+    sta->btm_enabled = 1;
+#endif
+#if defined(CONFIG_WMNGR_ROAM_FT)
+    sta->ft_enabled = 1;
+#endif
+}
+
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+/*
+ * Runs in the supplicant task. The report starts with the dialog token,
+ * followed by neighbor report elements.
+ */
+static void neighbor_cb(void *ctx, const uint8_t *report, size_t len)
+{
+    uint8_t chans[WMNGR_ROAM_MAX_CHANS];
+    unsigned int num, idx;
+    const uint8_t *pos;
+    uint8_t chan;
+
+    num = 0;
+    if(report != NULL && len > 1){
+        pos = report + 1;
+        len -= 1;
+
+        while(len >= 2 && (size_t) pos[1] + 2 <= len){
+            if(pos[0] == EID_NEIGHBOR_REPORT && pos[1] >= NR_MIN_LEN){
+                chan = pos[2 + NR_CHANNEL_OFFSET];
+                for(idx = 0; idx < num && chans[idx] != chan; ++idx){
+                    ;
+                }
+
+                if(idx == num && num < ARRAY_SIZE(chans)){
+                    chans[num++] = chan;
+                }
+            }
+
+            len -= pos[1] + 2;
+            pos += pos[1] + 2;
+        }
+    }
+
+    ESP_LOGI(TAG, "Neighbor report with %u channels.", num);
+
+    portENTER_CRITICAL(&roam_lock);
+    memcpy(nr_chans, chans, num);
+    nr_num = num;
+    ++roam_stats.neighbor_reps;
+    portEXIT_CRITICAL(&roam_lock);
+
+    roam_trigger();
+}
+#endif
+
+/* Ask the AP for its neighbor list, if it supports 802.11k. */
+esp_err_t wmngr_roam_request_neighbors(void)
+{
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+    if(!esp_rrm_is_rrm_supported_connection()){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    portENTER_CRITICAL(&roam_lock);
+    nr_num = -1;
+    portEXIT_CRITICAL(&roam_lock);
+
+    if(esp_rrm_send_neighbor_rep_request(neighbor_cb, NULL) != 0){
+        ESP_LOGW(TAG, "Sending neighbor report request failed.");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/*
+ * Ask the AP to send us a BSS transition request. The supplicant follows
+ * it without dropping its keys, so an 802.11r fast transition is possible.
+ * We can not fill in a candidate list without the neighbor report's BSSID
+ * info and operating class, the AP picks the target itself.
+ */
+esp_err_t wmngr_roam_request_transition(void)
+{
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+    if(!esp_wnm_is_btm_supported_connection()){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if(esp_wnm_send_bss_transition_mgmt_query(REASON_RSSI, NULL, 0) != 0){
+        ESP_LOGW(TAG, "Sending BSS transition query failed.");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/* Check if the current AP supports BSS transition management. */
+bool wmngr_roam_btm_supported(void)
+{
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+    return esp_wnm_is_btm_supported_connection();
+#else
+    return false;
+#endif
+}
+
+/*
+ * Fetch the channels of the last neighbor report. Returns -1 if no
+ * report has arrived yet.
+ */
+int wmngr_roam_get_neighbors(uint8_t *chans, unsigned int max)
+{
+#if defined(CONFIG_WMNGR_ROAM_11KV)
+    int num;
+
+    portENTER_CRITICAL(&roam_lock);
+    num = (nr_num < 0) ? -1 : MIN(nr_num, (int) max);
+    if(num > 0){
+        memcpy(chans, nr_chans, num);
+    }
+    portEXIT_CRITICAL(&roam_lock);
+
+    return num;
+#else
+    return -1;
+#endif
+}
+
+/* Merge a set of scan results into the roaming candidates. */
+void wmngr_roam_collect(struct wmngr_roam_ctx *ctx,
+                        const wifi_ap_record_t *recs, unsigned int num)
+{
+    unsigned int idx;
+
+    for(idx = 0; idx < num; ++idx){
+        if(!memcmp(recs[idx].bssid, ctx->cur_bssid, sizeof(ctx->cur_bssid))){
+            /* Prefer the scan's view of the current AP. */
+            ctx->cur_rssi = recs[idx].rssi;
+            continue;
+        }
+
+        if(!ctx->have_best || recs[idx].rssi > ctx->best.rssi){
+            memcpy(&ctx->best, &recs[idx], sizeof(ctx->best));
+            ctx->have_best = true;
+        }
+    }
+}
+
+/*
+ * Decide whether the best candidate beats the current AP by the
+ * hysteresis margin.
+ */
+bool wmngr_roam_pick(struct wmngr_roam_ctx *ctx)
+{
+    bool roam;
+
+    roam = ctx->have_best && ctx->best.rssi >= ctx->cur_rssi + ROAM_MARGIN;
+
+    portENTER_CRITICAL(&roam_lock);
+    if(!ctx->have_best){
+        ++roam_stats.no_candidate;
+    } else if(!roam){
+        ++roam_stats.avoided;
+    }
+    portEXIT_CRITICAL(&roam_lock);
+
+    if(!ctx->have_best){
+        ESP_LOGI(TAG, "No other AP found.");
+    } else if(!roam){
+        ESP_LOGI(TAG, "Best AP at %d dBm does not beat current %d dBm by "
+                      "%d dB, staying.", ctx->best.rssi, ctx->cur_rssi,
+                 ROAM_MARGIN);
+    }
+
+    return roam;
+}
+
+/* Account a finished roaming attempt. */
+void wmngr_roam_done(const struct wmngr_roam_ctx *ctx, bool success,
+                     int8_t rssi, uint32_t ms)
+{
+    struct wmngr_roam_rec *rec;
+
+    portENTER_CRITICAL(&roam_lock);
+    if(!success){
+        ++roam_stats.failures;
+        portEXIT_CRITICAL(&roam_lock);
+        return;
+    }
+
+    ++roam_stats.roams;
+    roam_stats.last_ms = ms;
+    roam_stats.max_ms = MAX(roam_stats.max_ms, ms);
+    roam_stats.total_ms += ms;
+
+    if(ctx->flags & WMNGR_ROAM_BTM){
+        ++roam_stats.btm_roams;
+    }
+
+    rec = &history[history_head % ROAM_HISTORY];
+    ++history_head;
+    rec->tick = xTaskGetTickCount();
+    rec->ms = ms;
+    rec->rssi_from = ctx->cur_rssi;
+    rec->rssi_to = rssi;
+    rec->channel = ctx->have_best ? ctx->best.primary : 0;
+    rec->flags = ctx->flags;
+#if defined(CONFIG_WMNGR_ROAM_FT)
+    /*
+     * Only the supplicant's own transitions can use FT. The driver does
+     * not tell us whether the target AP took it up.
+     */
+    rec->flags |= WMNGR_ROAM_FT_ENABLED;
+    if(ctx->flags & (WMNGR_ROAM_BTM | WMNGR_ROAM_QUERY)){
+        rec->flags |= WMNGR_ROAM_FT_OFFERED;
+    }
+#endif
+    portEXIT_CRITICAL(&roam_lock);
+}
+
+/** Fetch the roaming statistics.
+ *
+ * @param[out] stats Roaming statistics.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_roam_stats(struct wmngr_roam_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&roam_lock);
+    memcpy(stats, &roam_stats, sizeof(*stats));
+    portEXIT_CRITICAL(&roam_lock);
+
+    return ESP_OK;
+}
+
+/** Fetch the timing of the most recent roams.
+ * @param[out] buf Destination array, oldest roam first.
+ * @param[in] num Number of entries in buf.
+ * @return Number of records copied.
+ */
+size_t esp_wmngr_get_roam_history(struct wmngr_roam_rec *buf, size_t num)
+{
+    uint32_t first, idx;
+
+    if(buf == NULL){
+        return 0;
+    }
+
+    portENTER_CRITICAL(&roam_lock);
+    num = MIN(num, MIN(history_head, ROAM_HISTORY));
+    first = history_head - num;
+    for(idx = 0; idx < num; ++idx){
+        buf[idx] = history[(first + idx) % ROAM_HISTORY];
+    }
+    portEXIT_CRITICAL(&roam_lock);
+
+    return num;
+}
+
+#else /* defined(CONFIG_WMNGR_ROAMING) */
+
+esp_err_t esp_wmngr_get_roam_stats(struct wmngr_roam_stats *stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t esp_wmngr_get_roam_history(struct wmngr_roam_rec *buf, size_t num)
+{
+    return 0;
+}
+
+#endif /* defined(CONFIG_WMNGR_ROAMING) */
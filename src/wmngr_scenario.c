@@ -0,0 +1,298 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_scenario.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "wifi_manager.h"
+#include "wmngr_metrics.h"
+#include "wmngr_timeline.h"
+
+const char *wmngr_scn_names[wmngr_scn_max] = {
+    "cold_boot",
+    "ap_reboot",
+    "wrong_password",
+    "wps_success",
+    "wps_timeout",
+    "scan_connected"
+};
+
+#if defined(CONFIG_WMNGR_BENCH)
+
+static const char *TAG = "wmngr_scn";
+
+#define POLL_TICKS      (100 / portTICK_PERIOD_MS)
+/* Time for the driver to report a dropped association. */
+#define DROP_TICKS      (5 * 1000 / portTICK_PERIOD_MS)
+#define CONNECT_TICKS   (60 * 1000 / portTICK_PERIOD_MS)
+/* WPS and connect timeouts of 60s each, plus some slack. */
+#define FALLBACK_TICKS  (150 * 1000 / portTICK_PERIOD_MS)
+
+typedef bool (*scn_cond)(void *arg);
+
+static bool is_up(void *arg)
+{
+    return esp_wmngr_get_state() == wmngr_state_connected
+           && esp_wmngr_is_connected();
+}
+
+static bool is_down(void *arg)
+{
+    return !esp_wmngr_is_connected();
+}
+
+static bool is_failed(void *arg)
+{
+    return esp_wmngr_get_state() == wmngr_state_failed;
+}
+
+/* Scan data newer than the time stamp arg points to is available. */
+static bool has_scan(void *arg)
+{
+    struct scan_data *data;
+    bool result;
+
+    data = esp_wmngr_get_scan();
+    if(data == NULL){
+        return false;
+    }
+
+    result = data->tstamp != *(TickType_t *) arg;
+    esp_wmngr_put_scan(data);
+
+    return result;
+}
+
+/* Poll until cond holds, false if it did not within timeout ticks. */
+static bool wait_for(scn_cond cond, void *arg, TickType_t timeout)
+{
+    TickType_t start;
+
+    start = xTaskGetTickCount();
+    while(!cond(arg)){
+        if(xTaskGetTickCount() - start >= timeout){
+            return false;
+        }
+        vTaskDelay(POLL_TICKS);
+    }
+
+    return true;
+}
+
+/*
+ * Get back to the connected state after a run that ended in a fall-back.
+ * The manager stays in the failed state until it gets restarted.
+ */
+static esp_err_t recover(bool stop_driver)
+{
+    esp_err_t result;
+
+    (void) esp_wmngr_stop();
+    if(stop_driver){
+        (void) esp_wifi_disconnect();
+        (void) esp_wifi_stop();
+    }
+
+    result = esp_wmngr_start();
+    if(result == ESP_OK && !wait_for(is_up, NULL, CONNECT_TICKS)){
+        result = ESP_ERR_TIMEOUT;
+    }
+
+    return result;
+}
+
+/* Run scn once, cfg holds the working config of the manager. */
+static esp_err_t run_once(enum wmngr_scenario scn, struct wifi_cfg *cfg,
+                          struct wifi_cfg *tmp)
+{
+    struct scan_data *data;
+    TickType_t tstamp;
+    esp_err_t result;
+    int64_t start;
+
+    start = esp_timer_get_time();
+
+    switch(scn){
+    case wmngr_scn_cold_boot:
+        result = recover(true);
+        break;
+    case wmngr_scn_ap_reboot:
+        /* Without control over the AP, drop the association ourselves. */
+        result = esp_wifi_disconnect();
+        if(result == ESP_OK
+           && (!wait_for(is_down, NULL, DROP_TICKS)
+               || !wait_for(is_up, NULL, CONNECT_TICKS)))
+        {
+            result = ESP_ERR_TIMEOUT;
+        }
+        break;
+    case wmngr_scn_wrong_password:
+        memcpy(tmp, cfg, sizeof(*tmp));
+        snprintf((char *) tmp->sta.sta.password,
+                 sizeof(tmp->sta.sta.password), "%s", "wmngr wrong password");
+        result = esp_wmngr_set_cfg(tmp);
+        if(result == ESP_OK && !wait_for(is_failed, NULL, FALLBACK_TICKS)){
+            result = ESP_ERR_TIMEOUT;
+        }
+        break;
+    case wmngr_scn_wps_success:
+        ESP_LOGI(TAG, "[%s] Press the WPS button on the AP.", __func__);
+        /* fall through */
+    case wmngr_scn_wps_timeout:
+        result = esp_wmngr_start_wps();
+        if(result == ESP_OK
+           && !wait_for((scn == wmngr_scn_wps_success) ? is_up : is_failed,
+                        NULL, FALLBACK_TICKS))
+        {
+            result = ESP_ERR_TIMEOUT;
+        }
+        break;
+    case wmngr_scn_scan_connected:
+        data = esp_wmngr_get_scan();
+        tstamp = (data != NULL) ? data->tstamp : 0;
+        if(data != NULL){
+            esp_wmngr_put_scan(data);
+        }
+
+        result = esp_wmngr_start_scan();
+        if(result == ESP_OK && !wait_for(has_scan, &tstamp, CONNECT_TICKS)){
+            result = ESP_ERR_TIMEOUT;
+        }
+        break;
+    default:
+        result = ESP_ERR_INVALID_ARG;
+    }
+
+    if(result == ESP_OK){
+        WMNGR_TL_SCENARIO(esp_timer_get_time() - start);
+        ESP_LOGI(TAG, "[%s] %s: %" PRId64 " ms", __func__,
+                 wmngr_scn_names[scn], (esp_timer_get_time() - start) / 1000);
+    } else {
+        ESP_LOGE(TAG, "[%s] %s failed: %s", __func__,
+                 wmngr_scn_names[scn], esp_err_to_name(result));
+    }
+
+    /* Runs ending in a fall-back leave the manager in the failed state. */
+    if(is_failed(NULL) && recover(false) != ESP_OK && result == ESP_OK){
+        result = ESP_ERR_INVALID_STATE;
+    }
+
+    /* A successful WPS run may have changed the config. */
+    if(esp_wmngr_get_cfg(cfg) != ESP_OK && result == ESP_OK){
+        result = ESP_FAIL;
+    }
+
+    return result;
+}
+
+/** Run a scripted scenario and report its latencies.
+ *
+ * Starts a report with esp_wmngr_report_begin() named after the scenario
+ * and runs the scenario the given number of times on the live driver.
+ * The STA has to be connected when this is called. Every run is timed
+ * from its first action to reaching its end state and collected in the
+ * "scenario" phase, so the report holds the p50/p95/p99 latencies of the
+ * runs along with the connection phases, state machine runs and NVS
+ * bytes written. Recovering from a fall-back restarts the manager, which
+ * shows up in the connection phases but not in the scenario phase.
+ *
+ * Scenarios talking to the AP need a suitable test setup: the AP has to
+ * accept WPS for wmngr_scn_wps_success and the button has to be pressed
+ * for each run, while wmngr_scn_wps_timeout needs nobody to press it.
+ *
+ * Only available with CONFIG_WMNGR_BENCH. Phases are only reported with
+ * CONFIG_WMNGR_TIMELINE, counters only with CONFIG_WMNGR_METRICS.
+ *
+ * @param[in] scn Scenario to run.
+ * @param[in] runs Number of runs.
+ * @param[out] buf Buffer for the JSON report, see esp_wmngr_report_json().
+ *             May be NULL.
+ * @param[in] len Size of buf in bytes.
+ * @return ESP_OK if every run reached its end state, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_run_scenario(enum wmngr_scenario scn, unsigned int runs,
+                                 char *buf, size_t len)
+{
+    struct wifi_cfg *cfg;
+    esp_err_t result, tmp;
+    unsigned int idx;
+
+    if(scn >= wmngr_scn_max || runs == 0){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(!is_up(NULL)){
+        ESP_LOGE(TAG, "[%s] STA not connected.", __func__);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /* These are too large to be put on the caller's stack. */
+    cfg = calloc(2, sizeof(*cfg));
+    if(cfg == NULL){
+        return ESP_ERR_NO_MEM;
+    }
+
+    result = esp_wmngr_get_cfg(cfg);
+    if(result != ESP_OK){
+        goto on_exit;
+    }
+
+    esp_wmngr_report_begin(wmngr_scn_names[scn]);
+
+    for(idx = 0; idx < runs; ++idx){
+        tmp = run_once(scn, cfg, &cfg[1]);
+        if(tmp != ESP_OK){
+            result = tmp;
+        }
+
+        if(!is_up(NULL)){
+            ESP_LOGE(TAG, "[%s] Not connected, giving up.", __func__);
+            break;
+        }
+    }
+
+    if(buf != NULL){
+        (void) esp_wmngr_report_json(buf, len);
+    }
+
+on_exit:
+    free(cfg);
+
+    return result;
+}
+
+#else /* defined(CONFIG_WMNGR_BENCH) */
+
+esp_err_t esp_wmngr_run_scenario(enum wmngr_scenario scn, unsigned int runs,
+                                 char *buf, size_t len)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_BENCH) */
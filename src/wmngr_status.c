@@ -0,0 +1,207 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_status.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+/*
+ * The snapshot is updated from the event handlers and the WiFi Manager's
+ * timer as things happen, so reading it only costs a copy under the
+ * spinlock. Every update that changes a field bumps the version.
+ */
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct netmgr_status snap = {
+    .version = 1,
+    .wifi_state = wmngr_state_deinit,
+    .last_err = ESP_OK,
+};
+
+/*
+ * Finish an update, called with status_lock held. The uplink follows
+ * esp_netif's default route priorities, which put the STA before
+ * Ethernet. Version 0 is never used, so it can be passed to
+ * netmgr_get_status() to always get a copy.
+ */
+static void status_commit(bool changed)
+{
+    if(!changed){
+        return;
+    }
+
+    if(snap.sta_got_ip){
+        snap.uplink = netmgr_uplink_wifi;
+    } else if(snap.eth_got_ip){
+        snap.uplink = netmgr_uplink_eth;
+    } else {
+        snap.uplink = netmgr_uplink_none;
+    }
+
+    if(++snap.version == 0){
+        snap.version = 1;
+    }
+}
+
+static bool ip_info_update(esp_netif_ip_info_t *dst,
+                           const esp_netif_ip_info_t *src)
+{
+    esp_netif_ip_info_t zero;
+
+    if(src == NULL){
+        memset(&zero, 0x0, sizeof(zero));
+        src = &zero;
+    }
+
+    if(!memcmp(dst, src, sizeof(*dst))){
+        return false;
+    }
+
+    memcpy(dst, src, sizeof(*dst));
+
+    return true;
+}
+
+void wmngr_status_wifi(enum wmngr_state state)
+{
+    bool changed;
+
+    portENTER_CRITICAL(&status_lock);
+    changed = snap.wifi_state != state;
+    snap.wifi_state = state;
+    status_commit(changed);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+/* Channel is only used on connect, reason only on disconnect. */
+void wmngr_status_sta(bool connected, uint8_t channel, uint8_t reason)
+{
+    portENTER_CRITICAL(&status_lock);
+    if(connected){
+        snap.sta_connected = true;
+        snap.channel = channel;
+    } else {
+        snap.sta_connected = false;
+        snap.rssi = 0;
+        snap.last_reason = reason;
+    }
+    status_commit(true);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+/* Pass NULL when the address was lost. */
+void wmngr_status_sta_ip(const esp_netif_ip_info_t *ip)
+{
+    bool changed;
+
+    portENTER_CRITICAL(&status_lock);
+    changed = ip_info_update(&snap.sta_ip, ip);
+    changed |= snap.sta_got_ip != (ip != NULL);
+    snap.sta_got_ip = (ip != NULL);
+    status_commit(changed);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+void wmngr_status_rssi(int8_t rssi)
+{
+    bool changed;
+
+    portENTER_CRITICAL(&status_lock);
+    changed = snap.rssi != rssi;
+    snap.rssi = rssi;
+    status_commit(changed);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+void wmngr_status_eth_link(bool up)
+{
+    bool changed;
+
+    portENTER_CRITICAL(&status_lock);
+    changed = snap.eth_link != up;
+    snap.eth_link = up;
+    status_commit(changed);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+/* Pass NULL when the address was lost. */
+void wmngr_status_eth_ip(const esp_netif_ip_info_t *ip)
+{
+    bool changed;
+
+    portENTER_CRITICAL(&status_lock);
+    changed = ip_info_update(&snap.eth_ip, ip);
+    changed |= snap.eth_got_ip != (ip != NULL);
+    snap.eth_got_ip = (ip != NULL);
+    status_commit(changed);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+void wmngr_status_error(esp_err_t err)
+{
+    bool changed;
+
+    portENTER_CRITICAL(&status_lock);
+    changed = snap.last_err != err;
+    snap.last_err = err;
+    status_commit(changed);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+void wmngr_status_scan(uint16_t aps, TickType_t tstamp)
+{
+    portENTER_CRITICAL(&status_lock);
+    snap.scan_aps = aps;
+    snap.scan_tstamp = tstamp;
+    status_commit(true);
+    portEXIT_CRITICAL(&status_lock);
+}
+
+/** Fetch a consistent snapshot of the network state.
+ *
+ * Takes no mutex and touches neither the driver nor the NVS, so it can
+ * be polled frequently. A caller that already holds a snapshot passes
+ * its version and only gets a new copy if something has changed since.
+ *
+ * @param[out] status WiFi and Ethernet state.
+ * @param[in] since_version Version of the caller's copy, 0 for none.
+ * @return ESP_OK if status has been filled in, ESP_ERR_NOT_FOUND if
+ *         nothing changed since since_version, ESP_ERR_* otherwise.
+ */
+esp_err_t netmgr_get_status(struct netmgr_status *status,
+                            uint32_t since_version)
+{
+    esp_err_t result;
+
+    if(status == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&status_lock);
+    if(snap.version == since_version){
+        result = ESP_ERR_NOT_FOUND;
+    } else {
+        memcpy(status, &snap, sizeof(*status));
+        result = ESP_OK;
+    }
+    portEXIT_CRITICAL(&status_lock);
+
+    return result;
+}
@@ -0,0 +1,305 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_timeline.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+const char *wmngr_tl_names[wmngr_tl_max] = {
+    "Start",
+    "Config Begin",
+    "WiFi Start",
+    "Config End",
+    "STA Start",
+    "STA Connected",
+    "Got IP",
+    "Connected",
+    "Saved",
+    "WPS Done",
+    "Fall Back",
+    "Link Lost",
+    "Scan Start",
+    "Scan Done"
+};
+
+/** Estimate a percentile of a phase histogram.
+ *
+ * The result is the upper bound of the log2 bucket holding the requested
+ * sample, limited to the longest duration seen. It is therefore accurate
+ * to within a factor of two.
+ *
+ * @param[in] hist Histogram to evaluate.
+ * @param[in] pct Percentile, 0 to 100.
+ * @return Estimated duration in microseconds, 0 if hist is empty.
+ */
+uint32_t esp_wmngr_tl_percentile(const struct wmngr_tl_hist *hist,
+                                 unsigned int pct)
+{
+    uint64_t rank, seen;
+    unsigned int idx;
+    uint32_t bound;
+
+    if(hist->count == 0){
+        return 0;
+    }
+
+    rank = ((uint64_t) hist->count * MIN(pct, 100) + 99) / 100;
+    rank = MAX(rank, 1);
+
+    seen = 0;
+    for(idx = 0; idx < WMNGR_TL_BUCKETS - 1; ++idx){
+        seen += hist->buckets[idx];
+        if(seen >= rank){
+            break;
+        }
+    }
+
+    if(idx == WMNGR_TL_BUCKETS - 1){
+        return hist->max_us;
+    }
+
+    bound = (idx == 0) ? 0 : (uint32_t) ((1ULL << idx) - 1);
+
+    return MAX(MIN(bound, hist->max_us), hist->min_us);
+}
+
+#if defined(CONFIG_WMNGR_TIMELINE)
+
+static const char *TAG = "wmngr_tl";
+
+static portMUX_TYPE tl_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_timeline timeline;
+static enum wmngr_tl_mark tl_prev = wmngr_tl_max;
+static int64_t tl_cycle_us;
+
+static void hist_add(struct wmngr_tl_hist *hist, int64_t delta)
+{
+    unsigned int bucket;
+    uint32_t us;
+
+    us = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t) delta;
+
+    bucket = (us == 0) ? 0 : 32 - __builtin_clz(us);
+
+    if(hist->count == 0 || us < hist->min_us){
+        hist->min_us = us;
+    }
+
+    if(us > hist->max_us){
+        hist->max_us = us;
+    }
+
+    ++hist->count;
+    hist->sum_us += us;
+    ++hist->buckets[bucket];
+}
+
+/** Record a timeline boundary.
+ *
+ * A phase is measured from the latest earlier boundary seen in the
+ * current connection cycle. A cycle starts with esp_wmngr_start() or
+ * whenever a config gets applied again after later boundaries have
+ * been reached, e.g. on reconnects and fall-backs.
+ *
+ * Boundaries from #wmngr_tl_link_lost on are not part of the cycle.
+ * A lost connection is closed by the next connected state and counted
+ * in the reconnect histogram, a scan started while connected by the
+ * next finished scan.
+ */
+void wmngr_tl_mark(enum wmngr_tl_mark mark)
+{
+    int64_t now;
+    int idx;
+
+    if(mark >= wmngr_tl_max){
+        return;
+    }
+
+    now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&tl_lock);
+
+    if(mark >= wmngr_tl_link_lost){
+        if(mark == wmngr_tl_scan_done
+           && timeline.last_us[wmngr_tl_scan_start]
+              > timeline.last_us[wmngr_tl_scan_done])
+        {
+            hist_add(&timeline.phase[mark],
+                     now - timeline.last_us[wmngr_tl_scan_start]);
+        }
+
+        timeline.last_us[mark] = now;
+        goto on_exit;
+    }
+
+    if(mark == wmngr_tl_connected
+       && timeline.last_us[wmngr_tl_link_lost]
+          > timeline.last_us[wmngr_tl_connected])
+    {
+        hist_add(&timeline.reconnect,
+                 now - timeline.last_us[wmngr_tl_link_lost]);
+    }
+
+    if(mark <= wmngr_tl_cfg_begin
+       && (tl_prev == wmngr_tl_max || tl_prev >= mark))
+    {
+        tl_cycle_us = now;
+    }
+
+    for(idx = mark - 1; idx >= 0; --idx){
+        if(timeline.last_us[idx] != 0
+           && timeline.last_us[idx] >= tl_cycle_us)
+        {
+            hist_add(&timeline.phase[mark], now - timeline.last_us[idx]);
+            break;
+        }
+    }
+
+    if(mark == wmngr_tl_connected
+       && timeline.last_us[wmngr_tl_cfg_begin] >= tl_cycle_us
+       && timeline.last_us[wmngr_tl_cfg_begin] != 0)
+    {
+        hist_add(&timeline.total, now - timeline.last_us[wmngr_tl_cfg_begin]);
+    }
+
+    timeline.last_us[mark] = now;
+    tl_prev = mark;
+
+on_exit:
+    portEXIT_CRITICAL(&tl_lock);
+}
+
+/** Record the duration of one scenario run.
+ * @param[in] us Duration of the run in microseconds.
+ */
+void wmngr_tl_scenario(int64_t us)
+{
+    portENTER_CRITICAL(&tl_lock);
+    hist_add(&timeline.scenario, us);
+    portEXIT_CRITICAL(&tl_lock);
+}
+
+/** Fetch a copy of the connection timeline.
+ * @param[out] tl Timeline statistics.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_timeline(struct wmngr_timeline *tl)
+{
+    if(tl == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&tl_lock);
+    memcpy(tl, &timeline, sizeof(*tl));
+    portEXIT_CRITICAL(&tl_lock);
+
+    return ESP_OK;
+}
+
+/** Clear all recorded timeline statistics.
+ */
+void esp_wmngr_reset_timeline(void)
+{
+    portENTER_CRITICAL(&tl_lock);
+    memset(&timeline, 0x0, sizeof(timeline));
+    tl_prev = wmngr_tl_max;
+    tl_cycle_us = 0;
+    portEXIT_CRITICAL(&tl_lock);
+}
+
+/* Log one histogram. It is copied first, the whole timeline is too
+ * large for the caller's stack. */
+static void dump_hist(const char *name, const struct wmngr_tl_hist *src)
+{
+    char buf[WMNGR_TL_BUCKETS * 12];
+    struct wmngr_tl_hist hist;
+    unsigned int idx;
+    size_t len;
+    int res;
+
+    portENTER_CRITICAL(&tl_lock);
+    memcpy(&hist, src, sizeof(hist));
+    portEXIT_CRITICAL(&tl_lock);
+
+    if(hist.count == 0){
+        return;
+    }
+
+    len = 0;
+    buf[0] = '\0';
+    for(idx = 0; idx < WMNGR_TL_BUCKETS; ++idx){
+        if(hist.buckets[idx] == 0){
+            continue;
+        }
+
+        res = snprintf(&buf[len], sizeof(buf) - len, " %u:%" PRIu32,
+                       idx, hist.buckets[idx]);
+        if(res < 0 || (size_t) res >= sizeof(buf) - len){
+            break;
+        }
+        len += res;
+    }
+
+    ESP_LOGI(TAG, "%-13s n=%" PRIu32 " min=%" PRIu32 " avg=%" PRIu32
+                  " max=%" PRIu32 " us |%s",
+             name, hist.count, hist.min_us,
+             (uint32_t) (hist.sum_us / hist.count), hist.max_us, buf);
+}
+
+/** Log the connection timeline histograms.
+ *
+ * Prints one line per phase with its min/avg/max durations, followed by
+ * the non-empty log2 buckets as "bucket:count" pairs.
+ */
+void esp_wmngr_dump_timeline(void)
+{
+    unsigned int idx;
+
+    for(idx = 0; idx < wmngr_tl_max; ++idx){
+        dump_hist(wmngr_tl_names[idx], &timeline.phase[idx]);
+    }
+
+    dump_hist("Total", &timeline.total);
+    dump_hist("Reconnect", &timeline.reconnect);
+    dump_hist("Scenario", &timeline.scenario);
+}
+
+#else /* defined(CONFIG_WMNGR_TIMELINE) */
+
+esp_err_t esp_wmngr_get_timeline(struct wmngr_timeline *tl)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void esp_wmngr_reset_timeline(void)
+{
+}
+
+void esp_wmngr_dump_timeline(void)
+{
+}
+
+#endif /* defined(CONFIG_WMNGR_TIMELINE) */
@@ -0,0 +1,168 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#if defined(CONFIG_WMNGR_TRACE)
+
+static const char *TAG = "wmngr_trace";
+
+#define TRACE_ENTRIES   CONFIG_WMNGR_TRACE_ENTRIES
+#define TRACE_MASK      (TRACE_ENTRIES - 1)
+
+_Static_assert((TRACE_ENTRIES & TRACE_MASK) == 0,
+               "CONFIG_WMNGR_TRACE_ENTRIES must be a power of two");
+_Static_assert(sizeof(struct wmngr_trace_rec) == 8,
+               "Trace records must stay compact");
+
+struct trace_ring {
+    uint32_t magic;
+    atomic_uint head;   /* Total number of records written. */
+    struct wmngr_trace_rec rec[TRACE_ENTRIES];
+};
+
+/*
+ * Keep the ring in RTC memory that is not cleared on reset, so the events
+ * leading up to a crash or watchdog reset can be read out afterwards.
+ */
+#if defined(CONFIG_WMNGR_TRACE_NOINIT)
+static RTC_NOINIT_ATTR struct trace_ring ring;
+#else
+static struct trace_ring ring;
+#endif
+
+/* Validate ring contents that may have survived a reset. */
+void wmngr_trace_init(void)
+{
+    if(ring.magic != WMNGR_TRACE_MAGIC){
+        esp_wmngr_trace_clear();
+    } else {
+        ESP_LOGI(TAG, "Keeping %u trace records from before reset.",
+                 MIN(atomic_load(&ring.head), TRACE_ENTRIES));
+    }
+}
+
+void wmngr_trace_add(enum wmngr_trace_type type, uint8_t arg0, int16_t arg1)
+{
+    struct wmngr_trace_rec *rec;
+
+    rec = &ring.rec[atomic_fetch_add_explicit(&ring.head, 1,
+                                              memory_order_relaxed)
+                    & TRACE_MASK];
+    rec->tick = xTaskGetTickCount();
+    rec->type = type;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+}
+
+/** Copy the trace ring into a buffer.
+ *
+ * The buffer receives a struct wmngr_trace_hdr followed by as many records
+ * as fit, oldest first. Feed the result to tools/wmngr_trace_decode.py.
+ *
+ * @param[out] buf Destination buffer.
+ * @param[in] len Size of buf in bytes.
+ * @return Number of bytes written to buf, 0 if buf can not hold the header.
+ */
+size_t esp_wmngr_trace_dump(void *buf, size_t len)
+{
+    struct wmngr_trace_hdr hdr;
+    struct wmngr_trace_rec *out;
+    unsigned int head, first, num, idx;
+
+    if(buf == NULL || len < sizeof(hdr)){
+        return 0;
+    }
+
+    head = atomic_load(&ring.head);
+    num = MIN(head, TRACE_ENTRIES);
+    num = MIN(num, (len - sizeof(hdr)) / sizeof(*out));
+    first = head - num;
+
+    hdr.magic = WMNGR_TRACE_MAGIC;
+    hdr.version = WMNGR_TRACE_VERSION;
+    hdr.rec_size = sizeof(*out);
+    hdr.tick_hz = configTICK_RATE_HZ;
+    hdr.num_records = num;
+    memcpy(buf, &hdr, sizeof(hdr));
+
+    out = (struct wmngr_trace_rec *) ((uint8_t *) buf + sizeof(hdr));
+    for(idx = 0; idx < num; ++idx){
+        memcpy(&out[idx], &ring.rec[(first + idx) & TRACE_MASK],
+               sizeof(*out));
+    }
+
+    return sizeof(hdr) + num * sizeof(*out);
+}
+
+/** Write a hex dump of the trace ring to the log.
+ */
+void esp_wmngr_trace_log(void)
+{
+    size_t len;
+    void *buf;
+
+    len = sizeof(struct wmngr_trace_hdr)
+          + TRACE_ENTRIES * sizeof(struct wmngr_trace_rec);
+    buf = malloc(len);
+    if(buf == NULL){
+        ESP_LOGE(TAG, "Out of memory for trace dump.");
+        return;
+    }
+
+    len = esp_wmngr_trace_dump(buf, len);
+    ESP_LOG_BUFFER_HEX(TAG, buf, len);
+    free(buf);
+}
+
+/** Discard all trace records.
+ */
+void esp_wmngr_trace_clear(void)
+{
+    memset(&ring, 0x0, sizeof(ring));
+    atomic_init(&ring.head, 0);
+    ring.magic = WMNGR_TRACE_MAGIC;
+}
+
+#else /* defined(CONFIG_WMNGR_TRACE) */
+
+size_t esp_wmngr_trace_dump(void *buf, size_t len)
+{
+    return 0;
+}
+
+void esp_wmngr_trace_log(void)
+{
+}
+
+void esp_wmngr_trace_clear(void)
+{
+}
+
+#endif /* defined(CONFIG_WMNGR_TRACE) */
@@ -0,0 +1,317 @@
+/*
+ * This file is part of the ESP WiFi Manager project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include "wmngr_tune.h"
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_wifi.h"
+#include "esp_log.h"
+
+#include "wmngr_metrics.h"
+
+#if defined(CONFIG_WMNGR_TUNER)
+
+static const char *TAG = "wmngr_tune";
+
+/* Bounds in the 0.25 dBm units of esp_wifi_set_max_tx_power(). */
+#define TX_POWER_MIN    (CONFIG_WMNGR_TUNE_TX_POWER_MIN * 4)
+#define TX_POWER_MAX    (CONFIG_WMNGR_TUNE_TX_POWER_MAX * 4)
+#define TX_POWER_STEP   (2 * 4)
+
+_Static_assert(TX_POWER_MIN <= TX_POWER_MAX,
+               "CONFIG_WMNGR_TUNE_TX_POWER_MIN exceeds the maximum");
+
+/*
+ * Average RSSI bands. Above RSSI_STRONG the TX power is lowered, below
+ * RSSI_WEAK it is raised. 40 MHz needs RSSI_HT40, below RSSI_FALLBACK
+ * 802.11n is dropped.
+ */
+#define RSSI_STRONG     (-55)
+#define RSSI_WEAK       (-70)
+#define RSSI_HT40       (-60)
+#define RSSI_FALLBACK   (-80)
+
+/* Samples needed before acting, and to forget connection losses. */
+#define WINDOW_MIN      4
+#define STABLE_SAMPLES  16
+/* Connection losses that make the tuner play it safe. */
+#define FAILURES_MAX    2
+
+#define PROTO_BGN       (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G \
+                         | WIFI_PROTOCOL_11N)
+#define PROTO_BG        (WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G)
+
+static portMUX_TYPE tune_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct wmngr_tune_state tune;
+static bool tune_pending;
+/* AP the failures and the TX power floor were seen with. */
+static uint8_t tune_bssid[6];
+
+static void set_tx_power(int8_t power)
+{
+    esp_err_t result;
+
+    result = esp_wifi_set_max_tx_power(power);
+    if(result != ESP_OK){
+        ESP_LOGW(TAG, "[%s] esp_wifi_set_max_tx_power(): %s",
+                 __func__, esp_err_to_name(result));
+        return;
+    }
+
+    ESP_LOGI(TAG, "[%s] TX power %d -> %d (0.25 dBm).",
+             __func__, tune.tx_power, power);
+    if(tune.tx_power != 0){
+        if(power > tune.tx_power){
+            WMNGR_METRIC_INC(tune_tx_up);
+        } else {
+            WMNGR_METRIC_INC(tune_tx_down);
+        }
+    }
+    WMNGR_METRIC_SET(tune_tx_power, power);
+
+    portENTER_CRITICAL(&tune_lock);
+    tune.tx_power = power;
+    ++tune.decisions;
+    portEXIT_CRITICAL(&tune_lock);
+}
+
+/*
+ * Called with every link sample. TX power is changed right away, one
+ * step per sample. Bandwidth and protocol only take effect when
+ * associating, so they are remembered for the next connect.
+ */
+void wmngr_tune_sample(const struct wmngr_link_stats *stats)
+{
+    uint8_t bandwidth, protocol;
+    int8_t power;
+    bool weak;
+
+    if(stats->window < WINDOW_MIN){
+        return;
+    }
+
+    /* The link has been stable for a while, forget earlier losses. */
+    if((tune.failures > 0 || tune.tx_floor != 0)
+       && stats->samples >= STABLE_SAMPLES)
+    {
+        portENTER_CRITICAL(&tune_lock);
+        tune.failures = 0;
+        tune.tx_floor = 0;
+        portEXIT_CRITICAL(&tune_lock);
+    }
+
+    weak = stats->rssi_avg < RSSI_WEAK || tune.failures > 0;
+
+    if(tune.tx_power == 0
+       && esp_wifi_get_max_tx_power(&power) == ESP_OK)
+    {
+        tune.tx_power = power;
+        WMNGR_METRIC_SET(tune_tx_power, power);
+    }
+
+    /*
+     * A strong downlink does not prove the AP still hears us. Never go
+     * below the floor left by the last connection loss.
+     */
+    power = tune.tx_power;
+    if(weak){
+        power = MIN(power + TX_POWER_STEP, TX_POWER_MAX);
+    } else if(stats->rssi_avg > RSSI_STRONG){
+        power = MAX(power - TX_POWER_STEP, MAX(tune.tx_floor, TX_POWER_MIN));
+    }
+    power = MIN(MAX(power, TX_POWER_MIN), TX_POWER_MAX);
+
+    if(power != tune.tx_power){
+        set_tx_power(power);
+    }
+
+    bandwidth = WIFI_BW_HT20;
+#if defined(CONFIG_WMNGR_TUNE_HT40)
+    if(!weak && stats->rssi_avg >= RSSI_HT40){
+        bandwidth = WIFI_BW_HT40;
+    }
+#endif
+
+    protocol = PROTO_BGN;
+#if defined(CONFIG_WMNGR_TUNE_FALLBACK)
+    if(stats->rssi_avg < RSSI_FALLBACK || tune.failures >= FAILURES_MAX){
+        protocol = PROTO_BG;
+    }
+#endif
+
+    if(bandwidth != tune.bandwidth || protocol != tune.protocol){
+        ESP_LOGI(TAG, "[%s] Next association: %s, protocols 0x%x.",
+                 __func__, (bandwidth == WIFI_BW_HT40) ? "HT40" : "HT20",
+                 protocol);
+        if(bandwidth != tune.bandwidth){
+            WMNGR_METRIC_INC(tune_bw_changes);
+        }
+        if(protocol != tune.protocol){
+            WMNGR_METRIC_INC(tune_proto_changes);
+        }
+
+        portENTER_CRITICAL(&tune_lock);
+        tune.bandwidth = bandwidth;
+        tune.protocol = protocol;
+        ++tune.decisions;
+        tune_pending = true;
+        portEXIT_CRITICAL(&tune_lock);
+    }
+}
+
+/*
+ * The STA link was lost. Raise TX power at once and fall back to the
+ * robust settings for the reconnect if it keeps happening. The power we
+ * lost the link at might have been too low for the uplink, so the tuner
+ * stays a step above it until the link has been stable again.
+ */
+void wmngr_tune_lost(void)
+{
+    portENTER_CRITICAL(&tune_lock);
+    if(tune.failures < UINT8_MAX){
+        ++tune.failures;
+    }
+    if(tune.tx_power != 0){
+        tune.tx_floor = MAX(tune.tx_floor,
+                            MIN(tune.tx_power + TX_POWER_STEP, TX_POWER_MAX));
+    }
+    if(tune.failures >= FAILURES_MAX){
+        tune.bandwidth = WIFI_BW_HT20;
+#if defined(CONFIG_WMNGR_TUNE_FALLBACK)
+        tune.protocol = PROTO_BG;
+#else
+        tune.protocol = PROTO_BGN;
+#endif
+        tune_pending = true;
+    }
+    portEXIT_CRITICAL(&tune_lock);
+
+    if(tune.tx_power != 0 && tune.tx_power < TX_POWER_MAX){
+        set_tx_power(TX_POWER_MAX);
+    }
+}
+
+/*
+ * The driver settings were restored to their defaults, which resets
+ * protocol, bandwidth and TX power. Apply our choices again on the next
+ * connect.
+ */
+void wmngr_tune_restored(void)
+{
+    portENTER_CRITICAL(&tune_lock);
+    tune_pending = (tune.protocol != 0 || tune.tx_power != 0);
+    portEXIT_CRITICAL(&tune_lock);
+}
+
+/*
+ * The STA connected to bssid, or got a new config if bssid is NULL.
+ * Losses on another AP say nothing about this one, so forget them.
+ */
+void wmngr_tune_new_ap(const uint8_t *bssid)
+{
+    portENTER_CRITICAL(&tune_lock);
+    if(bssid == NULL || memcmp(bssid, tune_bssid, sizeof(tune_bssid))){
+        tune.failures = 0;
+        tune.tx_floor = 0;
+        if(bssid != NULL){
+            memcpy(tune_bssid, bssid, sizeof(tune_bssid));
+        } else {
+            memset(tune_bssid, 0x0, sizeof(tune_bssid));
+        }
+    }
+    portEXIT_CRITICAL(&tune_lock);
+}
+
+/* Apply bandwidth and protocol before the STA associates. */
+void wmngr_tune_prepare(void)
+{
+    uint8_t bandwidth, protocol;
+    esp_err_t result;
+    int8_t power;
+    bool pending;
+
+    portENTER_CRITICAL(&tune_lock);
+    pending = tune_pending;
+    tune_pending = false;
+    bandwidth = tune.bandwidth;
+    protocol = tune.protocol;
+    power = tune.tx_power;
+    portEXIT_CRITICAL(&tune_lock);
+
+    if(!pending){
+        return;
+    }
+
+    if(power != 0){
+        result = esp_wifi_set_max_tx_power(power);
+        if(result != ESP_OK){
+            ESP_LOGW(TAG, "[%s] esp_wifi_set_max_tx_power(): %s",
+                     __func__, esp_err_to_name(result));
+        }
+    }
+
+    /* Nothing decided yet, keep the driver defaults. */
+    if(protocol == 0){
+        return;
+    }
+
+    result = esp_wifi_set_protocol(WIFI_IF_STA, protocol);
+    if(result != ESP_OK){
+        ESP_LOGW(TAG, "[%s] esp_wifi_set_protocol(): %s",
+                 __func__, esp_err_to_name(result));
+    }
+
+    result = esp_wifi_set_bandwidth(WIFI_IF_STA, bandwidth);
+    if(result != ESP_OK){
+        ESP_LOGW(TAG, "[%s] esp_wifi_set_bandwidth(): %s",
+                 __func__, esp_err_to_name(result));
+    }
+
+    WMNGR_METRIC_SET(tune_bandwidth, bandwidth);
+    WMNGR_METRIC_SET(tune_protocol, protocol);
+}
+
+/** Fetch the radio settings chosen by the link tuner.
+ * @param[out] state TX power, bandwidth and protocols.
+ * @return ESP_OK on success, ESP_ERR_* otherwise.
+ */
+esp_err_t esp_wmngr_get_tune_state(struct wmngr_tune_state *state)
+{
+    if(state == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&tune_lock);
+    memcpy(state, &tune, sizeof(*state));
+    portEXIT_CRITICAL(&tune_lock);
+
+    return ESP_OK;
+}
+
+#else /* defined(CONFIG_WMNGR_TUNER) */
+
+esp_err_t esp_wmngr_get_tune_state(struct wmngr_tune_state *state)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif /* defined(CONFIG_WMNGR_TUNER) */
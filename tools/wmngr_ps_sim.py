@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ESP WiFi Manager project.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+"""Simulate the power-save policy on a traffic trace.
+
+Runs the policy of src/wmngr_ps.c on a trace of bytes per interval and
+compares it with the three fixed modes. Each mode is modelled by its
+average supply current and by the delay it adds to downlink traffic,
+which waits for the next beacon (MIN_MODEM) or listen interval
+(MAX_MODEM) on average half of that period. The trace is read from a
+file with one "bytes" or "seconds bytes" line per interval, or generated
+as alternating bursts and idle periods.
+"""
+
+import argparse
+import random
+import sys
+
+NONE, MIN_MODEM, MAX_MODEM = range(3)
+NAMES = ('NONE', 'MIN_MODEM', 'MAX_MODEM')
+
+
+class Policy:
+    """Mirror of ps_target() and ps_eval() in src/wmngr_ps.c."""
+
+    def __init__(self, burst_rate, idle_rate, hold, interval_ms):
+        self.burst_rate = burst_rate
+        self.idle_rate = idle_rate
+        self.hold = hold
+        self.interval_ms = interval_ms
+        self.mode = MIN_MODEM
+        self.rate = 0
+        self.held = 0
+
+    def target(self):
+        if (self.rate >= self.burst_rate
+                or (self.mode == NONE and self.rate >= self.burst_rate // 2)):
+            return NONE
+        if (self.rate < self.idle_rate
+                or (self.mode == MAX_MODEM
+                    and self.rate < 2 * self.idle_rate)):
+            return MAX_MODEM
+        return MIN_MODEM
+
+    def step(self, nbytes):
+        rate = nbytes * 1000 // self.interval_ms
+        self.rate = rate if rate > self.rate else (3 * self.rate + rate) // 4
+        nxt = self.target()
+        if nxt <= self.mode:
+            self.held = 0
+        else:
+            self.held += 1
+            if self.held < self.hold:
+                nxt = self.mode
+            else:
+                self.held = 0
+        self.mode = nxt
+        return self.mode
+
+
+def gen_trace(seconds, interval_ms, burst_rate, seed):
+    rng = random.Random(seed)
+    trace = []
+    steps = seconds * 1000 // interval_ms
+    while len(trace) < steps:
+        for _ in range(rng.randint(2, 10)):
+            trace.append(int(rng.uniform(1.0, 4.0) * burst_rate
+                             * interval_ms / 1000))
+        for _ in range(rng.randint(10, 60)):
+            trace.append(rng.choice((0, 0, 0, 64, 200)))
+    return trace[:steps]
+
+
+def load_trace(path):
+    trace = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if fields and not fields[0].startswith('#'):
+                trace.append(int(fields[-1]))
+    return trace
+
+
+def run(trace, modes, args):
+    """Return average current, byte weighted latency, dwell and switches."""
+    current = (args.ma_none, args.ma_min, args.ma_max)
+    delay = (0.0,
+             args.beacon_ms * args.dtim / 2.0,
+             args.beacon_ms * args.listen_interval / 2.0)
+    charge = 0.0
+    wait = 0.0
+    total = 0
+    dwell = [0, 0, 0]
+    for nbytes, mode in zip(trace, modes):
+        charge += current[mode] * args.interval_ms
+        wait += delay[mode] * nbytes
+        total += nbytes
+        dwell[mode] += args.interval_ms
+    switches = sum(a != b for a, b in zip(modes, modes[1:]))
+    duration = len(trace) * args.interval_ms
+    return (charge / duration, wait / total if total else 0.0, dwell,
+            switches, duration)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('trace', nargs='?', help='trace file, one line per '
+                        'interval (default: generate one)')
+    parser.add_argument('--seconds', type=int, default=3600,
+                        help='length of a generated trace')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--interval-ms', type=int, default=1000,
+                        help='CONFIG_WMNGR_PS_INTERVAL')
+    parser.add_argument('--burst-rate', type=int, default=20000,
+                        help='CONFIG_WMNGR_PS_BURST_RATE in B/s')
+    parser.add_argument('--idle-rate', type=int, default=500,
+                        help='CONFIG_WMNGR_PS_IDLE_RATE in B/s')
+    parser.add_argument('--hold', type=int, default=5,
+                        help='CONFIG_WMNGR_PS_HOLD')
+    parser.add_argument('--ma-none', type=float, default=100.0,
+                        help='average current without power save [mA]')
+    parser.add_argument('--ma-min', type=float, default=25.0,
+                        help='average current in MIN_MODEM [mA]')
+    parser.add_argument('--ma-max', type=float, default=12.0,
+                        help='average current in MAX_MODEM [mA]')
+    parser.add_argument('--beacon-ms', type=float, default=102.4)
+    parser.add_argument('--dtim', type=int, default=1)
+    parser.add_argument('--listen-interval', type=int, default=3)
+    args = parser.parse_args()
+
+    if args.trace:
+        trace = load_trace(args.trace)
+    else:
+        trace = gen_trace(args.seconds, args.interval_ms, args.burst_rate,
+                          args.seed)
+    if not trace:
+        sys.exit('empty trace')
+
+    policy = Policy(args.burst_rate, args.idle_rate, args.hold,
+                    args.interval_ms)
+    # The mode chosen after an interval applies to the next one.
+    chosen = [policy.step(n) for n in trace]
+    candidates = [('policy', [MIN_MODEM] + chosen[:-1])]
+    for mode in (NONE, MIN_MODEM, MAX_MODEM):
+        candidates.append((NAMES[mode], [mode] * len(trace)))
+
+    print('%-10s %9s %13s %8s  %s' % ('', 'avg [mA]', 'latency [ms]',
+                                      'switches', 'dwell NONE/MIN/MAX [%]'))
+    for name, modes in candidates:
+        ma, lat, dwell, switches, duration = run(trace, modes, args)
+        print('%-10s %9.1f %13.1f %8d  %s' %
+              (name, ma, lat, switches,
+               '/'.join('%.0f' % (100.0 * d / duration) for d in dwell)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ESP WiFi Manager project.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+"""Compare two sets of esp_wmngr_report_json() reports and flag regressions.
+
+Each file holds one report per line, one per scenario started with
+esp_wmngr_report_begin() or run with esp_wmngr_run_scenario(). Reports
+are matched by scenario name. Phase
+latencies (p50/p95/p99), the NVS and state machine counters and the peak
+heap usage per subsystem of each current report are checked against its
+baseline. The exit status is 1 if any value grew by more than the given
+tolerance or a baseline scenario is missing.
+"""
+
+import argparse
+import json
+import sys
+
+PERCENTILES = ('p50', 'p95', 'p99')
+COUNTERS = ('handle_calls', 'nvs_writes', 'nvs_bytes', 'fallbacks',
+            'reconnects', 'lock_failures')
+
+
+def load(path):
+    reports = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            report = json.loads(line)
+            reports[report.get('scenario', '')] = report
+    return reports
+
+
+def check(name, old, new, tolerance, slack, out):
+    limit = old * (1.0 + tolerance / 100.0) + slack
+    bad = new > limit
+    if bad or old != new:
+        out.write('%-4s %-32s %10d -> %10d\n' %
+                  ('FAIL' if bad else 'ok', name, old, new))
+    return bad
+
+
+def compare(scenario, base, cur, args, out):
+    failed = False
+    prefix = scenario + ':' if scenario else ''
+
+    for phase, old in sorted(base.get('phases', {}).items()):
+        new = cur.get('phases', {}).get(phase)
+        if new is None or old['n'] == 0 or new['n'] == 0:
+            continue
+        for pct in PERCENTILES:
+            failed |= check('%s%s.%s' % (prefix, phase, pct), old[pct],
+                            new[pct], args.tolerance, args.slack_us, out)
+
+    for name in COUNTERS:
+        old = base.get('metrics', {}).get(name)
+        new = cur.get('metrics', {}).get(name)
+        if old is None or new is None:
+            continue
+        failed |= check(prefix + name, old, new, args.tolerance, 0, out)
+
+    for name, old in sorted(base.get('memory', {}).items()):
+        new = cur.get('memory', {}).get(name)
+        if new is None:
+            continue
+        failed |= check('%smemory.%s.peak' % (prefix, name), old['peak'],
+                        new['peak'], args.tolerance, args.slack_bytes, out)
+
+    return failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('baseline', help='baseline JSON reports')
+    parser.add_argument('current', help='JSON reports to check')
+    parser.add_argument('--tolerance', type=float, default=20.0,
+                        help='allowed growth in percent (default 20)')
+    parser.add_argument('--slack-us', type=int, default=1000,
+                        help='allowed absolute latency growth in us')
+    parser.add_argument('--slack-bytes', type=int, default=256,
+                        help='allowed absolute heap growth in bytes')
+    args = parser.parse_args()
+
+    base = load(args.baseline)
+    cur = load(args.current)
+    failed = False
+
+    for scenario, old in sorted(base.items()):
+        new = cur.get(scenario)
+        if new is None:
+            sys.stdout.write('FAIL scenario %r missing\n' % scenario)
+            failed = True
+            continue
+        failed |= compare(scenario, old, new, args, sys.stdout)
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
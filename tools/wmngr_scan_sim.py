@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ESP WiFi Manager project.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+"""Estimate scan durations for country channel plans.
+
+Models the driver's all-channel scan as started by wifi_scan_start() in
+src/wifi_manager.c. Each channel is probed for the active dwell time, or
+listened on for the passive dwell time if the country does not allow
+probing there. With the SoftAP running or the STA connected, the radio
+returns to its home channel between two scanned channels. The first plan
+is the baseline the others are compared with.
+
+Plans are given as COUNTRY[:FIRST-LAST], e.g. "JP", "DE:1-11" or "01",
+mirroring the country, chan_first and chan_num fields of struct wifi_cfg.
+"""
+
+import argparse
+import sys
+
+# First and last channel of some countries, as set by
+# esp_wifi_set_country_code(). "01" is the driver's world safe default.
+COUNTRIES = {
+    '01': (1, 14),
+    'CN': (1, 13),
+    'DE': (1, 13),
+    'EU': (1, 13),
+    'GB': (1, 13),
+    'JP': (1, 14),
+    'US': (1, 11),
+    'CA': (1, 11),
+}
+
+# Channels the world safe default only scans passively.
+PASSIVE_01 = (12, 13, 14)
+
+
+def parse_plan(text):
+    country, _, chans = text.partition(':')
+    country = country.upper()
+    if country not in COUNTRIES:
+        raise ValueError('unknown country %s' % country)
+    first, last = COUNTRIES[country]
+    if chans:
+        lo, _, hi = chans.partition('-')
+        lo = int(lo)
+        hi = int(hi) if hi else lo
+        # Clipped to the country, like set_country() does.
+        first, last = max(first, lo), min(last, hi)
+        if first > last:
+            raise ValueError('no channel of %s allowed in %s' % (chans,
+                                                                  country))
+    passive = PASSIVE_01 if country == '01' else ()
+    return [(ch, ch in passive) for ch in range(first, last + 1)]
+
+
+def scan_ms(channels, args):
+    total = 0.0
+    for idx, (_, passive) in enumerate(channels):
+        total += args.switch_ms
+        total += args.passive_ms if passive else args.active_ms
+        if args.home and idx < len(channels) - 1:
+            total += args.switch_ms + args.home_ms
+    return total
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('plans', nargs='*', default=['01', 'DE', 'US',
+                                                     'DE:1-11', 'DE:1-6'],
+                        help='channel plans, the first is the baseline')
+    parser.add_argument('--active-ms', type=float, default=120.0,
+                        help='active dwell time per channel')
+    parser.add_argument('--passive-ms', type=float, default=360.0,
+                        help='passive dwell time per channel')
+    parser.add_argument('--switch-ms', type=float, default=2.0,
+                        help='channel switch time')
+    parser.add_argument('--home-ms', type=float, default=30.0,
+                        help='home channel dwell time between channels')
+    parser.add_argument('--home', action='store_true',
+                        help='SoftAP running or STA connected')
+    parser.add_argument('--scans-per-hour', type=float, default=60.0,
+                        help='for the radio time saved per hour')
+    args = parser.parse_args()
+
+    results = []
+    for text in args.plans:
+        try:
+            channels = parse_plan(text)
+        except ValueError as err:
+            sys.exit(str(err))
+        results.append((text, channels, scan_ms(channels, args)))
+
+    base = results[0][2]
+    print('%-10s %8s %10s %9s %12s' % ('plan', 'channels', 'scan [ms]',
+                                       'vs. base', 'saved [s/h]'))
+    for text, channels, ms in results:
+        print('%-10s %8s %10.0f %8.0f%% %12.1f' %
+              (text, '%d-%d' % (channels[0][0], channels[-1][0]), ms,
+               100.0 * (ms - base) / base,
+               (base - ms) * args.scans_per_hour / 1000.0))
+
+
+if __name__ == '__main__':
+    main()
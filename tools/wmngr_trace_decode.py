@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+#
+# This file is part of the ESP WiFi Manager project.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+"""Decode a WiFi Manager trace or event recording into a readable timeline.
+
+The input is either the raw buffer filled by esp_wmngr_trace_dump() or
+esp_wmngr_evrec_dump(), or a device log containing the hex dump written by
+esp_wmngr_trace_log() or esp_wmngr_evrec_log().
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = 0x52544d57
+EVREC_MAGIC = 0x56454d57
+HDR = struct.Struct('<IHHII')
+REC = struct.Struct('<IBBh')
+EVREC = struct.Struct('<IBBBB')
+
+# Must match enum wmngr_state in include/wifi_manager.h
+STATES = ['Deinit', 'Stopped', 'Failed', 'Connected', 'Idle', 'Update',
+          'WPS Start', 'WPS Active', 'Connecting', 'Disconnecting',
+          'Fall Back', 'Roaming']
+
+# Must match enum wmngr_trace_site in include/wmngr_trace.h
+SITES = ['esp_wifi_restore', 'esp_wifi_set_mode', 'esp_wifi_set_config(AP)',
+         'esp_wifi_set_config(STA)', 'esp_netif_set_ip_info(STA)',
+         'esp_wifi_start', 'esp_wifi_connect', 'esp_wifi_scan_start',
+         'esp_wifi_wps_enable', 'esp_wifi_wps_start', 'save_config',
+         'esp_eth_start', 'esp_eth_stop']
+
+WIFI_EVENTS = ['WIFI_READY', 'SCAN_DONE', 'STA_START', 'STA_STOP',
+               'STA_CONNECTED', 'STA_DISCONNECTED', 'STA_AUTHMODE_CHANGE',
+               'STA_WPS_ER_SUCCESS', 'STA_WPS_ER_FAILED',
+               'STA_WPS_ER_TIMEOUT', 'STA_WPS_ER_PIN',
+               'STA_WPS_ER_PBC_OVERLAP', 'AP_START', 'AP_STOP',
+               'AP_STACONNECTED', 'AP_STADISCONNECTED', 'AP_PROBEREQRECVED']
+IP_EVENTS = ['STA_GOT_IP', 'STA_LOST_IP', 'AP_STAIPASSIGNED', 'GOT_IP6',
+             'ETH_GOT_IP', 'ETH_LOST_IP']
+ETH_EVENTS = ['START', 'STOP', 'CONNECTED', 'DISCONNECTED']
+BASES = [('WIFI_EVENT', WIFI_EVENTS), ('IP_EVENT', IP_EVENTS),
+         ('ETH_EVENT', ETH_EVENTS)]
+
+ERRORS = {0: 'ESP_OK', -1: 'ESP_FAIL', 0x101: 'ESP_ERR_NO_MEM',
+          0x102: 'ESP_ERR_INVALID_ARG', 0x103: 'ESP_ERR_INVALID_STATE',
+          0x105: 'ESP_ERR_NOT_FOUND', 0x107: 'ESP_ERR_TIMEOUT',
+          0x3001: 'ESP_ERR_WIFI_NOT_INIT', 0x3002: 'ESP_ERR_WIFI_NOT_STARTED',
+          0x3003: 'ESP_ERR_WIFI_NOT_STOPPED', 0x3004: 'ESP_ERR_WIFI_IF',
+          0x3005: 'ESP_ERR_WIFI_MODE', 0x3006: 'ESP_ERR_WIFI_STATE',
+          0x3007: 'ESP_ERR_WIFI_CONN', 0x3008: 'ESP_ERR_WIFI_NVS',
+          0x300A: 'ESP_ERR_WIFI_SSID', 0x300B: 'ESP_ERR_WIFI_PASSWORD',
+          0x300C: 'ESP_ERR_WIFI_TIMEOUT'}
+
+
+def name(table, idx):
+    return table[idx] if 0 <= idx < len(table) else '#%d' % idx
+
+
+def load(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    if (len(data) >= 4
+            and struct.unpack_from('<I', data)[0] in (MAGIC, EVREC_MAGIC)):
+        return data
+
+    # Not a raw dump, collect hex bytes from ESP_LOG_BUFFER_HEX lines.
+    hexbytes = []
+    for line in data.decode('utf-8', 'replace').splitlines():
+        line = re.sub(r'\x1b\[[0-9;]*m', '', line)
+        m = re.search(r'wmngr_(?:trace|evrec): ((?:[0-9a-fA-F]{2} ?)+)\s*$',
+                      line)
+        if m:
+            hexbytes.extend(m.group(1).split())
+    return bytes(int(b, 16) for b in hexbytes)
+
+
+def decode_events(data, out):
+    magic, version, rec_size, tick_hz, num = HDR.unpack_from(data)
+    if version != 1 or rec_size < EVREC.size:
+        raise ValueError('unsupported recording version %d' % version)
+
+    offset = HDR.size
+    first = None
+    for _ in range(num):
+        if offset + rec_size > len(data):
+            break
+        tick, base, event, length, flags = EVREC.unpack_from(data, offset)
+        payload = data[offset + EVREC.size:offset + EVREC.size + length]
+        offset += rec_size
+
+        if first is None:
+            first = tick
+        secs = ((tick - first) & 0xffffffff) / tick_hz
+
+        base, events = BASES[base] if base < len(BASES) else ('#%d' % base, [])
+        text = 'event %s.%s' % (base, name(events, event))
+        if payload:
+            text += ' [%s]' % payload.hex(' ')
+        if flags & 1:
+            text += ' (truncated)'
+
+        out.write('%10.3f  [%10u]  %s\n' % (secs, tick, text))
+
+
+def decode(data, out):
+    magic, version, rec_size, tick_hz, num = HDR.unpack_from(data)
+    if magic == EVREC_MAGIC:
+        decode_events(data, out)
+        return
+    if magic != MAGIC:
+        raise ValueError('no trace header found')
+    if version != 1 or rec_size != REC.size:
+        raise ValueError('unsupported trace version %d' % version)
+
+    offset = HDR.size
+    first = None
+    for _ in range(num):
+        if offset + REC.size > len(data):
+            break
+        tick, rtype, arg0, arg1 = REC.unpack_from(data, offset)
+        offset += REC.size
+
+        if first is None:
+            first = tick
+        secs = ((tick - first) & 0xffffffff) / tick_hz
+
+        if rtype == 1:
+            text = 'state %s -> %s' % (name(STATES, arg0), name(STATES, arg1))
+        elif rtype == 2:
+            base, events = BASES[arg0] if arg0 < len(BASES) else ('#%d' % arg0, [])
+            text = 'event %s.%s' % (base, name(events, arg1))
+        elif rtype == 3:
+            text = 'call  %s = %s' % (name(SITES, arg0),
+                                      ERRORS.get(arg1, '0x%x' % arg1))
+        else:
+            text = 'type %d: %d %d' % (rtype, arg0, arg1)
+
+        out.write('%10.3f  [%10u]  %s\n' % (secs, tick, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('dump', help='raw trace or event dump, or device log')
+    args = parser.parse_args()
+
+    decode(load(args.dump), sys.stdout)
+
+
+if __name__ == '__main__':
+    main()